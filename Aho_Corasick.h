@@ -0,0 +1,357 @@
+#ifndef AHO_CORASICK_H
+#define AHO_CORASICK_H
+
+#include "Common.h"
+#include "Byte_Set.h"
+#include "Byte_DFA.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+  Aho-Corasick automaton over a set of words (byte strings), used for
+  expressions that are just an alternation of literals such as
+  "GET|POST|PUT".
+
+  The trie is built directly from the words, in time linear in their
+  total length, with no NFA or subset construction. It is kept as one
+  dense table with one row per state and one column per byte class,
+  the same layout as DFA< uint8_t, uint32_t >, completed in place with
+  the failure links. The edge from q to r is a trie edge exactly when
+  r is one deeper than q, so full matching walks the same table:
+
+    trie_dfa()    accepts exactly the words (full matching)
+    search_dfa()  accepts every string ending with a word (searching)
+
+  State 0 is the dead state and state 1 is the root.
+
+  If memory_limit is not 0 and the trie would take more bytes than it,
+  NFA_To_DFA_Memory_Limit_Error is thrown as soon as a state too many
+  is added, like subset construction does.
+
+  When the words start with few distinct bytes, searching skips ahead
+  to the next byte that can start a word whenever the automaton is
+  back at the root, with memchr for one such byte or SSE2 compares of
+  16 bytes at a time for up to max_skip_bytes of them.
+*/
+class Aho_Corasick
+{
+public:
+    static constexpr uint32_t root = 1;
+    static constexpr int max_skip_bytes = 8;
+
+    Aho_Corasick(const std::vector< std::string > & words,
+                 size_t memory_limit = 0)
+        : num_words_(words.size())
+    {
+        //Each byte used by a word gets its own class.
+        Byte_Set used;
+        for (const std::string & w : words)
+            for (const char & c : w)
+                used.insert(uint8_t(c));
+        for (int c = 0; c < 256; ++c)
+        {
+            if (used.contains(uint8_t(c)))
+            {
+                Byte_Set s;
+                s.insert(uint8_t(c));
+                classes_.refine(s);
+            }
+        }
+        num_classes_ = classes_.size();
+
+        //Dead state and root.
+        table_.assign(2 * num_classes_, 0);
+        depth_.assign(2, 0);
+        words_at_.resize(2);
+
+        for (uint32_t id = 0; id < words.size(); ++id)
+        {
+            uint32_t q = root;
+            for (const char & c : words[id])
+            {
+                uint32_t next = table_[q * num_classes_ + classes_[uint8_t(c)]];
+                if (next == 0)
+                {
+                    next = words_at_.size();
+                    if (memory_limit != 0 && bytes_with(next + 1) > memory_limit)
+                        throw NFA_To_DFA_Memory_Limit_Error();
+
+                    words_at_.push_back({});
+                    depth_.push_back(depth_[q] + 1);
+                    table_.resize(table_.size() + num_classes_, 0);
+                    table_[q * num_classes_ + classes_[uint8_t(c)]] = next;
+                }
+                q = next;
+            }
+            words_at_[q].push_back(id);
+
+            if (!words[id].empty())
+                first_bytes_.insert(uint8_t(words[id][0]));
+        }
+
+        build_links();
+
+        for (int c = 0; c < 256; ++c)
+            if (first_bytes_.contains(uint8_t(c)))
+                skip_bytes_.push_back(uint8_t(c));
+
+        return;
+    }
+
+    // Number of words, counting repeated words.
+    size_t size() const
+    { return num_words_; }
+
+    // Number of states, including the dead state.
+    uint32_t states() const
+    { return words_at_.size(); }
+
+    // Bytes held by the tables of this automaton.
+    size_t memory_bytes() const
+    {
+        size_t ret = helper::vector_bytes(table_) + helper::vector_bytes(depth_) +
+            helper::vector_bytes(accept_) + helper::vector_bytes(output_link_) +
+            helper::vector_bytes(words_at_);
+        for (const std::vector< uint32_t > & ids : words_at_)
+            ret += helper::vector_bytes(ids);
+        return ret;
+    }
+
+    // Throws NFA_To_DFA_Memory_Limit_Error if memory_limit is not 0
+    // and the table of the DFA would take more bytes than it.
+    DFA< uint8_t, uint32_t > trie_dfa(size_t memory_limit = 0) const
+    {
+        if (memory_limit != 0 &&
+            helper::vector_bytes(table_) + helper::vector_bytes(accept_) > memory_limit)
+        {
+            throw NFA_To_DFA_Memory_Limit_Error();
+        }
+
+        std::vector< uint32_t > trie(table_.size(), 0);
+        std::vector< uint8_t > accept(states(), 0);
+        for (uint32_t q = 1; q < states(); ++q)
+        {
+            for (int k = 0; k < num_classes_; ++k)
+            {
+                uint32_t r = table_[q * num_classes_ + k];
+                if (depth_[r] == depth_[q] + 1)
+                    trie[q * num_classes_ + k] = r;
+            }
+            accept[q] = !words_at_[q].empty();
+        }
+        return DFA< uint8_t, uint32_t >(classes_, trie, accept, root);
+    }
+
+    DFA< uint8_t, uint32_t > search_dfa() const
+    { return DFA< uint8_t, uint32_t >(classes_, table_, accept_, root); }
+
+    // Returns the ids of the words equal to the given string.
+    const std::vector< uint32_t > & lookup(const uint8_t * str, size_t n) const
+    { return words_at_[trie_walk(str, n)]; }
+
+    // Returns true if the given string is one of the words.
+    bool matches(const uint8_t * str, size_t n) const
+    { return !lookup(str, n).empty(); }
+
+    // Returns true if the given string is a prefix of one of the words.
+    bool can_still_match(const uint8_t * str, size_t n) const
+    { return trie_walk(str, n) != 0; }
+
+    // Returns true if some word occurs in the given string.
+    bool search(const uint8_t * str, size_t n) const
+    {
+        if (accept_[root])
+            return true;
+
+        bool skip = !skip_bytes_.empty() && skip_bytes_.size() <= max_skip_bytes;
+        uint32_t q = root;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (q == root && skip)
+            {
+                i = next_start(str, i, n);
+                if (i == n)
+                    return false;
+            }
+
+            q = table_[q * num_classes_ + classes_[str[i]]];
+            if (accept_[q])
+                return true;
+        }
+
+        return false;
+    }
+
+    /*
+      Calls found(id) once for the id of every word that occurs in the
+      given string.
+    */
+    template< typename F >
+    void occurrences(const uint8_t * str, size_t n, F found) const
+    {
+        std::vector< uint8_t > reported(states(), 0);
+        auto report = [&](uint32_t q)
+        {
+            //Words ending at q, then at its suffixes, stopping at a
+            //state whose suffixes were already reported.
+            if (words_at_[q].empty())
+                q = output_link_[q];
+            while (q != 0 && !reported[q])
+            {
+                reported[q] = 1;
+                for (const uint32_t & id : words_at_[q])
+                    found(id);
+                q = output_link_[q];
+            }
+        };
+
+        bool skip = !skip_bytes_.empty() && skip_bytes_.size() <= max_skip_bytes;
+        uint32_t q = root;
+        report(root);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (q == root && skip)
+            {
+                i = next_start(str, i, n);
+                if (i == n)
+                    return;
+            }
+
+            q = table_[q * num_classes_ + classes_[str[i]]];
+            if (accept_[q])
+                report(q);
+        }
+
+        return;
+    }
+
+private:
+    // Bytes the tables take with n states, counting each state once in
+    // words_at_ and each word id as it is added.
+    size_t bytes_with(size_t n) const
+    {
+        return n * (num_classes_ * sizeof(uint32_t) + 2 * sizeof(uint32_t) +
+                    sizeof(uint8_t) + sizeof(std::vector< uint32_t >)) +
+            num_words_ * sizeof(uint32_t);
+    }
+
+    // Follows the trie edges for the given string, returning the state
+    // reached or 0 if it leaves the trie.
+    uint32_t trie_walk(const uint8_t * str, size_t n) const
+    {
+        uint32_t q = root;
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint32_t r = table_[q * num_classes_ + classes_[str[i]]];
+            if (depth_[r] != depth_[q] + 1)
+                return 0;
+            q = r;
+        }
+        return q;
+    }
+
+    /*
+      Computes the failure links breadth first, completing the table
+      with them in place: a missing trie edge from q goes where the edge
+      from the failure state of q goes. The failure state is shallower,
+      so its row is already complete, while the rows of q and deeper
+      states still hold only trie edges.
+    */
+    void build_links()
+    {
+        uint32_t n = states();
+        accept_.assign(n, 0);
+        output_link_.assign(n, 0);
+        std::vector< uint32_t > fail(n, root);
+
+        std::vector< uint32_t > queue = { root };
+        accept_[root] = !words_at_[root].empty();
+        for (size_t i = 0; i < queue.size(); ++i)
+        {
+            uint32_t q = queue[i];
+            for (int k = 0; k < num_classes_; ++k)
+            {
+                uint32_t child = table_[q * num_classes_ + k];
+                uint32_t fallback = q == root ? root :
+                    table_[fail[q] * num_classes_ + k];
+                if (child == 0)
+                {
+                    table_[q * num_classes_ + k] = fallback;
+                    continue;
+                }
+
+                fail[child] = fallback;
+                output_link_[child] = words_at_[fallback].empty() ?
+                    output_link_[fallback] : fallback;
+                accept_[child] = !words_at_[child].empty() || accept_[fallback];
+                queue.push_back(child);
+            }
+        }
+
+        return;
+    }
+
+    // Returns the first position from i on holding a byte that starts
+    // some word, or n if there is none.
+    size_t next_start(const uint8_t * str, size_t i, size_t n) const
+    {
+        if (skip_bytes_.size() == 1)
+        {
+            const void * p = memchr(str + i, skip_bytes_[0], n - i);
+            return p == nullptr ? n : (const uint8_t *)p - str;
+        }
+
+#ifdef __SSE2__
+        __m128i bytes[max_skip_bytes];
+        int m = skip_bytes_.size();
+        for (int k = 0; k < m; ++k)
+            bytes[k] = _mm_set1_epi8(char(skip_bytes_[k]));
+
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i *)(str + i));
+            __m128i hits = _mm_cmpeq_epi8(block, bytes[0]);
+            for (int k = 1; k < m; ++k)
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, bytes[k]));
+
+            int mask = _mm_movemask_epi8(hits);
+            if (mask != 0)
+                return i + __builtin_ctz(mask);
+        }
+#endif
+
+        for (; i < n; ++i)
+            if (first_bytes_.contains(str[i]))
+                return i;
+        return n;
+    }
+
+    size_t num_words_;
+    Byte_Classes classes_;
+    int num_classes_;
+
+    //Trie edges completed with the failure links.
+    std::vector< uint32_t > table_;
+
+    //Length of the word prefix each state stands for, 0 for the dead
+    //state and the root.
+    std::vector< uint32_t > depth_;
+
+    //True if a word ends at the state or at one of its suffixes.
+    std::vector< uint8_t > accept_;
+
+    //Ids of the words that end exactly at each state.
+    std::vector< std::vector< uint32_t > > words_at_;
+
+    //Longest proper suffix state at which a word ends, 0 if none.
+    std::vector< uint32_t > output_link_;
+
+    Byte_Set first_bytes_;
+    std::vector< uint8_t > skip_bytes_;
+};
+
+#endif
@@ -0,0 +1,786 @@
+#ifndef BYTE_DFA_H
+#define BYTE_DFA_H
+
+#include "Common.h"
+#include "Byte_Set.h"
+#include "DFA.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace helper
+{
+    /*
+      Finds the '\n' ending each line of a buffer, 64 bytes at a time:
+      the positions of the newlines of a block are kept as a bit mask,
+      so the lines of a block after the first cost no more than a bit
+      scan, where memchr would be called once per line.
+    */
+    class Line_Splitter
+    {
+    public:
+        Line_Splitter(const uint8_t * str, size_t n)
+            : str_(str), n_(n), base_(0), mask_(newlines(0))
+        {}
+
+        /*
+          Returns the position of the first '\n' at or after i, or n if
+          there is none. i must not be before the position given by the
+          previous call.
+        */
+        size_t next(size_t i)
+        {
+            size_t offset = i - base_;
+            mask_ &= offset < 64 ? ~uint64_t(0) << offset : 0;
+            while (mask_ == 0)
+            {
+                base_ += 64;
+                if (base_ >= n_)
+                    return n_;
+                mask_ = newlines(base_);
+            }
+            return base_ + __builtin_ctzll(mask_);
+        }
+
+    private:
+        // Bit k is set if str[i + k] is a '\n'.
+        uint64_t newlines(size_t i) const
+        {
+            uint64_t ret = 0;
+            size_t k = 0;
+#ifdef __SSE2__
+            const __m128i newline = _mm_set1_epi8('\n');
+            for (; k < 64 && i + k + 16 <= n_; k += 16)
+            {
+                __m128i block = _mm_loadu_si128((const __m128i *)(str_ + i + k));
+                uint32_t hits = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+                ret |= uint64_t(hits) << k;
+            }
+#endif
+            for (; k < 64 && i + k < n_; ++k)
+                ret |= uint64_t(str_[i + k] == '\n') << k;
+            return ret;
+        }
+
+        const uint8_t * str_;
+        size_t n_;
+        size_t base_;
+        uint64_t mask_;
+    };
+}
+
+/*
+  DFA over raw bytes with integer states.
+
+  The 256 byte values are mapped to equivalence classes (see
+  Byte_Classes) and delta is a dense table with one row per state and
+  one column per class, plus a last column holding the flags of the
+  state (whether it accepts and its status, see below). Transitions
+  hold the offset of the row of their target, its number premultiplied
+  by the size of a row, so a step of matching is an add and a load:
+
+    row = num_classes + 1
+    delta(q, c) = table[q * row + classes[c]] / row
+
+  and the flags checked at each step are in the row just read.
+  Outside of matching, states are given by their numbers.
+
+  State 0 is always the dead state: it is not accepting and every
+  transition out of it leads back to it. The states are renumbered in
+  breadth first order from the initial state, or by how often a
+  sample visits them (see renumber()), so the rows used most are
+  close together.
+
+  The DFA is analyzed once when it is built (see DFA_Analysis in
+  Language.h), so matching stops in any state that can no longer
+  accept or can no longer reject, and strings too short or too long to
+  be accepted are rejected without being read.
+*/
+template <>
+class DFA< uint8_t, uint32_t >
+{
+public:
+    static constexpr uint32_t dead_state = 0;
+
+    // The DFA of the empty language.
+    DFA() : num_classes_(1), row_(2), accept_(1, 0),
+            initial_state_(dead_state), stride_(1), stride_width_(0),
+            stride_limit_(0)
+    { build(std::vector< uint32_t >(1, dead_state)); }
+
+    /*
+      table holds the number of the target of each transition, at
+      q * num_classes + k for class k. States are renumbered in
+      breadth first order.
+    */
+    DFA(const Byte_Classes & classes,
+        const std::vector< uint32_t > & table,
+        const std::vector< uint8_t > & accept,
+        uint32_t initial_state)
+        : classes_(classes),
+          num_classes_(classes.size()),
+          row_(num_classes_ + 1),
+          accept_(accept),
+          initial_state_(initial_state),
+          stride_(1),
+          stride_width_(0),
+          stride_limit_(0)
+    { build(table, breadth_first_order(table)); }
+
+    // Returns true if this DFA accepts the given string of bytes.
+    bool operator()(const uint8_t * str, size_t n) const
+    {
+        if (!analysis_.length_possible(n))
+            return false;
+        
+        const uint32_t * table = table_.data();
+        const uint32_t flags = num_classes_;
+        size_t i = 0;
+
+        //Whole strides first, by state number, then the bytes left one
+        //at a time.
+        uint32_t q = initial_state_;
+        const uint8_t * status = analysis_.status.data();
+        const uint32_t * stride_table = stride_table_.data();
+        const uint32_t * c = stride_classes_.data();
+        if (stride_ == 4)
+        {
+            for (; i + 4 <= n && status[q] == helper::DFA_Analysis::UNDECIDED; i += 4)
+                q = stride_table[q * stride_width_ + c[str[i]] +
+                                 c[256 + str[i + 1]] + c[512 + str[i + 2]] +
+                                 c[768 + str[i + 3]]];
+        }
+        else if (stride_ == 2)
+        {
+            for (; i + 2 <= n && status[q] == helper::DFA_Analysis::UNDECIDED; i += 2)
+                q = stride_table[q * stride_width_ + c[str[i]] + c[256 + str[i + 1]]];
+        }
+
+        uint32_t state = q * row_;
+        for (; i < n; ++i)
+        {
+            //The rest of the string cannot change the answer.
+            uint32_t decided = table[state + flags] & status_mask;
+            if (decided != helper::DFA_Analysis::UNDECIDED)
+                return decided == helper::DFA_Analysis::ACCEPTS;
+            
+            state = table[state + classes_[str[i]]];
+        }
+
+        return (table[state + flags] & accepting_flag) != 0;
+    }
+
+    bool operator()(const std::string & str) const
+    { return operator()((const uint8_t *)str.data(), str.size()); }
+
+    // Number of strings match_batch() runs at the same time.
+    static constexpr int batch_lanes = 8;
+
+    /*
+      Sets results[i] to whether strs[i], of lengths[i] bytes, is
+      accepted, for i from 0 to count - 1.
+
+      Each step of a single string depends on the load of the step
+      before, so matching one string at a time leaves the CPU waiting
+      on the table. Here groups of batch_lanes strings are run side by
+      side, every step advancing all of them, so the loads of the
+      lanes are independent and overlap. A group advances in lockstep
+      over as many bytes as its shortest string has, and the lanes
+      with bytes left, or whose answer is still undecided, then finish
+      one at a time.
+
+      The strings are taken 256 at a time, in order, and sorted by
+      length (a counting sort, which does not branch on the data), so
+      the strings of a group have about the same length and little is
+      left to finish alone. Taking them in order keeps the strings that
+      are read close together in memory.
+    */
+    void match_batch(const uint8_t * const * strs, const size_t * lengths,
+                     size_t count, bool * results) const
+    {
+        const int lanes = batch_lanes;
+        const size_t window = 256, buckets = 64;
+        const uint32_t * table = table_.data();
+        const uint32_t flags = num_classes_, initial = initial_state_ * row_;
+        size_t order[window];
+
+        for (size_t first = 0; first < count; first += window)
+        {
+            //Counting sort of the window by length, so the lanes of a
+            //group have strings of about the same length.
+            size_t last = std::min(count, first + window);
+            size_t bucket[buckets + 1] = {};
+            for (size_t i = first; i < last; ++i)
+            {
+                if (analysis_.length_possible(lengths[i]))
+                    ++bucket[std::min(lengths[i], buckets - 1) + 1];
+                else
+                    results[i] = false;
+            }
+            for (size_t b = 1; b <= buckets; ++b)
+                bucket[b] += bucket[b - 1];
+            size_t m = bucket[buckets];
+            for (size_t i = first; i < last; ++i)
+                if (analysis_.length_possible(lengths[i]))
+                    order[bucket[std::min(lengths[i], buckets - 1)]++] = i;
+
+            size_t g = 0;
+            for (; g + lanes <= m; g += lanes)
+            {
+                const size_t * group = order + g;
+                uint32_t q[lanes];
+                const uint8_t * p[lanes];
+#pragma GCC unroll 8
+                for (int k = 0; k < lanes; ++k)
+                {
+                    q[k] = initial;
+                    p[k] = strs[group[k]];
+                }
+
+                //The bytes every lane has, 4 at a time, with no check
+                //in between: a state that is decided stays decided.
+                size_t common = lengths[group[0]], i = 0;
+                for (int k = 1; k < lanes; ++k)
+                    common = std::min(common, lengths[group[k]]);
+                while (i < common)
+                {
+                    size_t to = std::min(common, i + 4);
+                    for (; i < to; ++i)
+#pragma GCC unroll 8
+                        for (int k = 0; k < lanes; ++k)
+                            q[k] = table[q[k] + classes_[p[k][i]]];
+
+                    bool undecided = false;
+#pragma GCC unroll 8
+                    for (int k = 0; k < lanes; ++k)
+                        undecided |= (table[q[k] + flags] & status_mask) ==
+                            helper::DFA_Analysis::UNDECIDED;
+                    if (!undecided)
+                        break;
+                }
+
+                for (int k = 0; k < lanes; ++k)
+                {
+                    uint32_t state = q[k];
+                    size_t j = i, n = lengths[group[k]];
+                    for (; j < n && (table[state + flags] & status_mask) ==
+                             helper::DFA_Analysis::UNDECIDED; ++j)
+                        state = table[state + classes_[p[k][j]]];
+                    results[group[k]] = j == n ?
+                        (table[state + flags] & accepting_flag) != 0 :
+                        (table[state + flags] & status_mask) == helper::DFA_Analysis::ACCEPTS;
+                }
+            }
+
+            for (; g < m; ++g)
+                results[order[g]] = operator()(strs[order[g]], lengths[order[g]]);
+        }
+
+        return;
+    }
+
+    /*
+      Returns the number of lines, ended by '\n' or by the end of the
+      buffer, that this DFA accepts in whole. A buffer ending with
+      '\n' has no empty line after it. See for_each_matching_line().
+    */
+    size_t count_matching_lines(const uint8_t * str, size_t n) const
+    {
+        size_t count = 0;
+        for_each_matching_line(str, n, [&](size_t, size_t) { ++count; });
+        return count;
+    }
+
+    /*
+      Calls f(begin, end) for every line of the buffer, ended by '\n'
+      or by the end of the buffer, that is accepted, where [begin, end)
+      are the offsets of the line without its '\n'. The lines are
+      matched in place: the state goes back to the initial state at
+      each newline, and a line is only read until its answer is
+      decided, then skipped to its end.
+    */
+    template< typename F >
+    void for_each_matching_line(const uint8_t * str, size_t n, F f) const
+    {
+        const uint32_t * table = table_.data();
+        const uint32_t flags = num_classes_, initial = initial_state_ * row_;
+        helper::Line_Splitter lines(str, n);
+        size_t begin = 0;
+        while (begin < n)
+        {
+            size_t end = lines.next(begin);
+            if (analysis_.length_possible(end - begin))
+            {
+                uint32_t state = initial;
+                size_t i = begin;
+                while (i < end && (table[state + flags] & status_mask) ==
+                       helper::DFA_Analysis::UNDECIDED)
+                    state = table[state + classes_[str[i++]]];
+                if (i == end ? (table[state + flags] & accepting_flag) != 0 :
+                    (table[state + flags] & status_mask) == helper::DFA_Analysis::ACCEPTS)
+                {
+                    f(begin, end);
+                }
+            }
+            begin = end + 1;
+        }
+
+        return;
+    }
+
+    bool operator()(const std::vector< uint8_t > & str) const
+    { return operator()(str.data(), str.size()); }
+
+    /*
+      Returns true if some string starting with prefix is accepted,
+      for instance to check input while it is being typed.
+    */
+    bool can_still_match(const uint8_t * prefix, size_t n) const
+    {
+        uint32_t state = initial_state_;
+        for (size_t i = 0; i < n && !is_dead(state); ++i)
+            state = next_state(state, prefix[i]);
+        
+        return !is_dead(state);
+    }
+
+    bool can_still_match(const std::string & prefix) const
+    { return can_still_match((const uint8_t *)prefix.data(), prefix.size()); }
+
+    uint32_t next_state(uint32_t q, uint8_t c) const
+    { return table_[q * row_ + classes_[c]] / row_; }
+
+    // Number of states, including the dead state.
+    uint32_t size() const
+    { return accept_.size(); }
+
+    int num_classes() const
+    { return num_classes_; }
+
+    const Byte_Classes & classes() const
+    { return classes_; }
+
+    uint32_t initial_state() const
+    { return initial_state_; }
+
+    bool is_accepting(uint32_t q) const
+    { return accept_[q]; }
+
+    // Returns true if no accepting state can be reached from q.
+    bool is_dead(uint32_t q) const
+    { return analysis_.status[q] == helper::DFA_Analysis::REJECTS; }
+
+    // Returns true if every string is accepted from q.
+    bool always_accepts(uint32_t q) const
+    { return analysis_.status[q] == helper::DFA_Analysis::ACCEPTS; }
+
+    // Length of the shortest accepted string, unbounded if none.
+    size_t min_length() const
+    { return analysis_.min_length; }
+
+    // Length of the longest accepted string, unbounded if there is no
+    // longest one.
+    size_t max_length() const
+    { return analysis_.max_length; }
+
+    /*
+      Returns the NFA of the reverse language (defined in Byte_NFA.h).
+      It is left to be determinized lazily, see Lazy_DFA.
+    */
+    NFA< uint8_t, uint32_t > reverse() const;
+
+    /*
+      Builds a table that operator() reads stride bytes at a time, one
+      dependent load per stride instead of one per byte:
+
+        delta(q, c1 c2) = stride_table[q * n^2 + classes[c1] * n + classes[c2]]
+
+      for n classes, and likewise with 4 bytes. The stride is 4 if its
+      table takes at most memory_limit bytes, else 2 if that fits, so
+      only DFAs with few states and classes get one, and the limit
+      should keep it in the cache. Returns the stride, 1 if no table
+      fits.
+    */
+    int build_stride_table(size_t memory_limit)
+    {
+        size_t states = size(), n = num_classes_;
+        stride_limit_ = memory_limit;
+        stride_ = 1;
+        stride_width_ = 0;
+        stride_table_.clear();
+        stride_classes_.clear();
+        for (int stride : { 4, 2 })
+        {
+            size_t width = stride == 4 ? n * n * n * n : n * n;
+            if (n <= 256 && width * states <= memory_limit / sizeof(uint32_t))
+            {
+                stride_ = stride;
+                stride_width_ = width;
+                break;
+            }
+        }
+        if (stride_ == 1)
+            return stride_;
+
+        //Pairs of classes, then pairs of pairs.
+        std::vector< uint32_t > pairs(states * n * n);
+        for (size_t q = 0; q < states; ++q)
+            for (size_t a = 0; a < n; ++a)
+                for (size_t b = 0; b < n; ++b)
+                    pairs[(q * n + a) * n + b] = target(target(q, a), b);
+
+        if (stride_ == 2)
+            stride_table_ = std::move(pairs);
+        else
+        {
+            size_t m = n * n;
+            stride_table_.resize(states * m * m);
+            for (size_t q = 0; q < states; ++q)
+                for (size_t a = 0; a < m; ++a)
+                    for (size_t b = 0; b < m; ++b)
+                        stride_table_[(q * m + a) * m + b] = pairs[pairs[q * m + a] * m + b];
+        }
+
+        //Class of the j-th byte of a stride, times its place value.
+        stride_classes_.resize(stride_ * 256);
+        for (int j = 0; j < stride_; ++j)
+        {
+            size_t place = 1;
+            for (int k = j + 1; k < stride_; ++k)
+                place *= n;
+            for (int c = 0; c < 256; ++c)
+                stride_classes_[j * 256 + c] = classes_[c] * place;
+        }
+
+        return stride_;
+    }
+
+    // Bytes read per lookup by operator(), see build_stride_table().
+    int stride() const
+    { return stride_; }
+
+    /*
+      Adds to visits[q] the number of bytes of the string read in
+      state q by operator(), growing visits to one count per state.
+      Counts over a sample of the input give renumber_by_visits().
+    */
+    void count_visits(const uint8_t * str, size_t n,
+                      std::vector< size_t > & visits) const
+    {
+        visits.resize(std::max(visits.size(), size_t(size())), 0);
+        if (!analysis_.length_possible(n))
+            return;
+        uint32_t q = initial_state_;
+        for (size_t i = 0; i < n && !is_dead(q) && !always_accepts(q); ++i)
+        {
+            ++visits[q];
+            q = next_state(q, str[i]);
+        }
+        return;
+    }
+
+    /*
+      Renumbers the states so state i is the state order[i] was.
+      order must hold every state once and start with the dead state.
+      The stride table, if any, is rebuilt.
+    */
+    void renumber(const std::vector< uint32_t > & order)
+    {
+        std::vector< uint32_t > ids(size() * num_classes_);
+        for (uint32_t q = 0; q < size(); ++q)
+            for (int k = 0; k < num_classes_; ++k)
+                ids[q * num_classes_ + k] = target(q, k);
+        build(ids, order);
+        if (stride_ != 1)
+            build_stride_table(stride_limit_);
+        return;
+    }
+
+    /*
+      Renumbers the states from the most visited to the least, the
+      dead state staying first, so the rows read most by matching
+      share the fewest cache lines. Ties keep their order.
+    */
+    void renumber_by_visits(const std::vector< size_t > & visits)
+    {
+        std::vector< uint32_t > order;
+        for (uint32_t q = 1; q < size(); ++q)
+            order.push_back(q);
+        auto count = [&](uint32_t q) { return q < visits.size() ? visits[q] : 0; };
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y)
+                         { return count(x) > count(y); });
+        order.insert(order.begin(), dead_state);
+        renumber(order);
+        return;
+    }
+
+    // Bytes held by the tables of this DFA.
+    size_t memory_bytes() const
+    {
+        return sizeof(Byte_Classes) + helper::vector_bytes(table_) +
+            helper::vector_bytes(accept_) +
+            helper::vector_bytes(analysis_.status) +
+            helper::vector_bytes(stride_table_) +
+            helper::vector_bytes(stride_classes_);
+    }
+
+private:
+    //Flags in the last column of a row.
+    static constexpr uint32_t status_mask = 3;
+    static constexpr uint32_t accepting_flag = 4;
+
+    // Number of the target of the transition of q on class k.
+    uint32_t target(uint32_t q, int k) const
+    { return table_[q * row_ + k] / row_; }
+
+    /*
+      Returns the states of a table of state numbers in breadth first
+      order from the initial state, the dead state first and the
+      states that cannot be reached last.
+    */
+    std::vector< uint32_t > breadth_first_order(const std::vector< uint32_t > & ids) const
+    {
+        uint32_t n = accept_.size();
+        std::vector< uint8_t > seen(n, 0);
+        std::vector< uint32_t > order(1, dead_state);
+        seen[dead_state] = 1;
+        if (!seen[initial_state_])
+        {
+            seen[initial_state_] = 1;
+            order.push_back(initial_state_);
+        }
+        for (size_t i = 1; i < order.size(); ++i)
+        {
+            for (int k = 0; k < num_classes_; ++k)
+            {
+                uint32_t r = ids[order[i] * num_classes_ + k];
+                if (!seen[r])
+                {
+                    seen[r] = 1;
+                    order.push_back(r);
+                }
+            }
+        }
+        for (uint32_t q = 0; q < n; ++q)
+            if (!seen[q])
+                order.push_back(q);
+        return order;
+    }
+
+    /*
+      Builds the table of rows from a table of state numbers, with the
+      states renumbered so that state i is order[i], and analyzes the
+      DFA.
+    */
+    void build(const std::vector< uint32_t > & ids,
+               const std::vector< uint32_t > & order)
+    {
+        uint32_t n = order.size();
+        std::vector< uint32_t > number(n);
+        for (uint32_t i = 0; i < n; ++i)
+            number[order[i]] = i;
+
+        std::vector< uint8_t > accept(n);
+        for (uint32_t i = 0; i < n; ++i)
+            accept[i] = accept_[order[i]];
+        accept_ = std::move(accept);
+        initial_state_ = number[initial_state_];
+
+        auto successor = [&](uint32_t q, int k) -> uint32_t
+        { return number[ids[order[q] * num_classes_ + k]]; };
+
+        analysis_ = helper::analyze_dfa(
+            n, initial_state_, accept_,
+            [&](uint32_t q, std::vector< int > & out)
+            {
+                for (int k = 0; k < num_classes_; ++k)
+                    out.push_back(successor(q, k));
+            });
+
+        table_.assign(size_t(n) * row_, 0);
+        for (uint32_t q = 0; q < n; ++q)
+        {
+            for (int k = 0; k < num_classes_; ++k)
+                table_[q * row_ + k] = successor(q, k) * row_;
+            table_[q * row_ + num_classes_] = analysis_.status[q] |
+                (accept_[q] ? accepting_flag : 0);
+        }
+        return;
+    }
+
+    void build(const std::vector< uint32_t > & ids)
+    {
+        std::vector< uint32_t > order(accept_.size());
+        for (uint32_t q = 0; q < order.size(); ++q)
+            order[q] = q;
+        build(ids, order);
+        return;
+    }
+    
+
+    Byte_Classes classes_;
+    int num_classes_;
+    int row_;
+    std::vector< uint32_t > table_;
+    std::vector< uint8_t > accept_;
+    uint32_t initial_state_;
+    helper::DFA_Analysis analysis_;
+
+    //Table of strides of several bytes, empty when stride_ is 1.
+    int stride_;
+    size_t stride_width_;
+    size_t stride_limit_;
+    std::vector< uint32_t > stride_table_;
+    std::vector< uint32_t > stride_classes_;
+};
+
+// Returns the byte classes that refine the classes of both M0 and M1.
+inline Byte_Classes joint_classes(const DFA< uint8_t, uint32_t > & M0,
+                                  const DFA< uint8_t, uint32_t > & M1)
+{
+    Byte_Classes ret;
+    for (int k = 0; k < M0.num_classes(); ++k)
+        ret.refine(M0.classes().members(k));
+    for (int k = 0; k < M1.num_classes(); ++k)
+        ret.refine(M1.classes().members(k));
+    return ret;
+}
+
+// Returns the smallest byte of every class.
+inline std::vector< uint8_t > class_representatives(const Byte_Classes & classes)
+{
+    std::vector< uint8_t > ret(classes.size());
+    for (int k = 0; k < classes.size(); ++k)
+        ret[k] = classes.representative(k);
+    return ret;
+}
+
+/*
+  Returns the product of two byte DFAs under a boolean operation.
+
+  The byte classes of the result refine the classes of both DFAs, and
+  the product is built by a search from the pair of initial states so
+  only reachable pairs are created. Pairs that can never accept under
+  the operation (for instance any pair holding a state that can no
+  longer accept, for an intersection) all become the dead state of the
+  result.
+*/
+inline DFA< uint8_t, uint32_t > dfa_product(
+    const DFA< uint8_t, uint32_t > & M0,
+    const DFA< uint8_t, uint32_t > & M1,
+    DFA_Product_Operation op
+    )
+{
+    const uint32_t dead_state = DFA< uint8_t, uint32_t >::dead_state;
+    
+    Byte_Classes classes = joint_classes(M0, M1);
+    int num_classes = classes.size();
+    std::vector< uint8_t > representatives = class_representatives(classes);
+
+    auto is_dead = [&](uint32_t q0, uint32_t q1) -> bool
+    {
+        switch (op)
+        {
+        case DFA_INTERSECTION:
+            return M0.is_dead(q0) || M1.is_dead(q1);
+        case DFA_DIFFERENCE:
+            return M0.is_dead(q0);
+        default:
+            return M0.is_dead(q0) && M1.is_dead(q1);
+        }
+    };
+
+    std::unordered_map< uint64_t, uint32_t > ids;
+    std::vector< std::pair< uint32_t, uint32_t > > pairs;
+    std::vector< uint32_t > table(num_classes, dead_state);
+    std::vector< uint8_t > accept(1, 0);
+    pairs.push_back({dead_state, dead_state});
+
+    uint32_t initial_state = dead_state;
+    if (!is_dead(M0.initial_state(), M1.initial_state()))
+    {
+        initial_state = 1;
+        pairs.push_back({M0.initial_state(), M1.initial_state()});
+        ids[(uint64_t(M0.initial_state()) << 32) | M1.initial_state()] = 1;
+    }
+
+    for (uint32_t i = 1; i < pairs.size(); ++i)
+    {
+        std::pair< uint32_t, uint32_t > q = pairs[i];
+        accept.push_back(dfa_product_accepts(op,
+                                             M0.is_accepting(q.first),
+                                             M1.is_accepting(q.second)));
+        table.resize(table.size() + num_classes, dead_state);
+        
+        for (int k = 0; k < num_classes; ++k)
+        {
+            uint32_t next0 = M0.next_state(q.first, representatives[k]),
+                next1 = M1.next_state(q.second, representatives[k]);
+            if (is_dead(next0, next1))
+                continue;
+
+            uint64_t key = (uint64_t(next0) << 32) | next1;
+            std::unordered_map< uint64_t, uint32_t >::iterator it =
+                ids.find(key);
+            uint32_t id;
+            if (it == ids.end())
+            {
+                id = pairs.size();
+                ids[key] = id;
+                pairs.push_back({next0, next1});
+            }
+            else
+                id = it->second;
+
+            table[i * num_classes + k] = id;
+        }
+    }
+
+    return DFA< uint8_t, uint32_t >(classes, table, accept, initial_state);
+}
+
+/*
+  Language checks on byte DFAs (see Language.h). A byte DFA is its own
+  explorer, its dead state being the sink, and only one byte per joint
+  class is tried. Counterexamples are returned as strings of bytes.
+*/
+inline bool equivalent(const DFA< uint8_t, uint32_t > & M0,
+                       const DFA< uint8_t, uint32_t > & M1,
+                       std::string * counterexample = nullptr)
+{
+    std::vector< uint8_t > str;
+    bool ret = helper::explore_equivalent(
+        M0, M1, class_representatives(joint_classes(M0, M1)), &str);
+    if (!ret && counterexample != nullptr)
+        counterexample->assign(str.begin(), str.end());
+    return ret;
+}
+
+// Returns true if every string accepted by M1 is accepted by M0.
+inline bool includes(const DFA< uint8_t, uint32_t > & M0,
+                     const DFA< uint8_t, uint32_t > & M1,
+                     std::string * counterexample = nullptr)
+{
+    std::vector< uint8_t > str;
+    bool ret = helper::explore_includes(
+        M0, M1, class_representatives(joint_classes(M0, M1)), &str);
+    if (!ret && counterexample != nullptr)
+        counterexample->assign(str.begin(), str.end());
+    return ret;
+}
+
+inline bool is_empty(const DFA< uint8_t, uint32_t > & M,
+                     std::string * witness = nullptr)
+{
+    std::vector< uint8_t > str;
+    bool ret = helper::explore_is_empty(
+        M, class_representatives(M.classes()), &str);
+    if (!ret && witness != nullptr)
+        witness->assign(str.begin(), str.end());
+    return ret;
+}
+
+#endif
@@ -0,0 +1,830 @@
+#ifndef BYTE_NFA_H
+#define BYTE_NFA_H
+
+#include "Common.h"
+#include "Byte_Set.h"
+#include "Byte_DFA.h"
+#include "Stats.h"
+#include "Concurrent.h"
+
+#include <deque>
+#include <exception>
+#include <map>
+#include <thread>
+
+/*
+  NFA over raw bytes with integer states, used as the computational
+  automaton of a Regex.
+
+  Every transition is labelled with a whole Byte_Set, so a character
+  class such as [a-z0-9] or [^"] is a single edge. Epsilon edges are
+  kept apart from the labelled edges.
+*/
+template <>
+class NFA< uint8_t, uint32_t >
+{
+public:
+    struct Edge
+    {
+        Byte_Set symbols;
+        uint32_t to;
+    };
+
+    NFA() : initial_state_(0)
+    {}
+
+    // Adds a new state and returns it.
+    uint32_t add_state()
+    {
+        states_.push_back(State());
+        return states_.size() - 1;
+    }
+
+    void add_transition(uint32_t q, const Byte_Set & symbols, uint32_t r)
+    {
+        Edge e;
+        e.symbols = symbols;
+        e.to = r;
+        states_[q].edges.push_back(e);
+    }
+
+    void add_epsilon(uint32_t q, uint32_t r)
+    { states_[q].epsilon.push_back(r); }
+
+    void set_initial_state(uint32_t q)
+    { initial_state_ = q; }
+
+    void set_accepting(uint32_t q, bool accepting = true)
+    { states_[q].accepting = accepting; }
+
+    // Number of states.
+    uint32_t size() const
+    { return states_.size(); }
+
+    uint32_t initial_state() const
+    { return initial_state_; }
+
+    bool is_accepting(uint32_t q) const
+    { return states_[q].accepting; }
+
+    const std::vector< Edge > & transitions(uint32_t q) const
+    { return states_[q].edges; }
+
+    const std::vector< uint32_t > & epsilon_transitions(uint32_t q) const
+    { return states_[q].epsilon; }
+
+    // Returns the epsilon closure of a given state.
+    std::vector< uint32_t > epsilon_closure(uint32_t q) const
+    {
+        std::vector< uint32_t > ret;
+        std::vector< uint32_t > marks(size(), 0);
+        closure(q, ret, marks, 1);
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    }
+
+    // Bytes held by the states and edges of this NFA.
+    size_t memory_bytes() const
+    {
+        size_t ret = helper::vector_bytes(states_);
+        for (const State & s : states_)
+            ret += helper::vector_bytes(s.edges) + helper::vector_bytes(s.epsilon);
+        return ret;
+    }
+
+    // Returns the byte classes every transition of this NFA respects.
+    Byte_Classes byte_classes() const
+    {
+        Byte_Classes ret;
+        std::unordered_set< Byte_Set > seen;
+        for (const State & s : states_)
+            for (const Edge & e : s.edges)
+                if (seen.insert(e.symbols).second)
+                    ret.refine(e.symbols);
+        return ret;
+    }
+
+    /*
+      Returns true if this NFA accepts the given string of bytes.
+      The set of active states is kept as a bit vector.
+    */
+    bool operator()(const uint8_t * str, size_t n) const
+    {
+        Simulation s(*this);
+        for (size_t i = 0; i < n; ++i)
+            //No active states left, this string can never be accepted.
+            if (!s.step(str[i]))
+                return false;
+
+        return s.accepting();
+    }
+
+    bool operator()(const std::string & str) const
+    { return operator()((const uint8_t *)str.data(), str.size()); }
+
+    static constexpr size_t npos = size_t(-1);
+
+    // Length of the shortest prefix of the string this NFA accepts, or
+    // npos if it accepts none.
+    size_t shortest_prefix(const uint8_t * str, size_t n) const
+    { return accepted_prefix(str, n, false); }
+
+    // Length of the longest prefix of the string this NFA accepts, or
+    // npos if it accepts none.
+    size_t longest_prefix(const uint8_t * str, size_t n) const
+    { return accepted_prefix(str, n, true); }
+
+    // Returns true if some string starting with prefix is accepted.
+    bool can_still_match(const uint8_t * prefix, size_t n) const
+    {
+        Simulation s(*this);
+        for (size_t i = 0; i < n; ++i)
+            if (!s.step(prefix[i]))
+                return false;
+
+        //Look for an accepting state reachable from an active one.
+        std::vector< uint64_t > & seen = s.current;
+        std::vector< uint32_t > check_stack;
+        for (uint32_t q = 0; q < size(); ++q)
+            if ((seen[q / 64] >> (q % 64)) & 1)
+                check_stack.push_back(q);
+        while (!check_stack.empty())
+        {
+            uint32_t q = check_stack.back();
+            check_stack.pop_back();
+            if (states_[q].accepting)
+                return true;
+
+            std::vector< uint32_t > next = states_[q].epsilon;
+            for (const Edge & e : states_[q].edges)
+                if (!e.symbols.empty())
+                    next.push_back(e.to);
+            for (const uint32_t & r : next)
+            {
+                if (((seen[r / 64] >> (r % 64)) & 1) == 0)
+                {
+                    seen[r / 64] |= uint64_t(1) << (r % 64);
+                    check_stack.push_back(r);
+                }
+            }
+        }
+
+        return false;
+    }
+
+    /*
+      Returns the NFA of the reverse language, accepting the strings
+      this NFA accepts read backwards. States keep their numbers, and a
+      new initial state has epsilon edges to the accepting states.
+    */
+    NFA reverse() const
+    {
+        NFA ret;
+        ret.states_.resize(size());
+        for (uint32_t q = 0; q < size(); ++q)
+        {
+            for (const Edge & e : states_[q].edges)
+                ret.add_transition(e.to, e.symbols, q);
+            for (const uint32_t & r : states_[q].epsilon)
+                ret.add_epsilon(r, q);
+        }
+        ret.set_accepting(initial_state_);
+
+        uint32_t initial = ret.add_state();
+        for (uint32_t q = 0; q < size(); ++q)
+            if (states_[q].accepting)
+                ret.add_epsilon(initial, q);
+        ret.set_initial_state(initial);
+
+        return ret;
+    }
+
+    // Length of the shortest accepted string, unbounded if none.
+    size_t min_length() const
+    {
+        //Breadth first search where epsilon edges cost nothing.
+        const size_t unbounded = helper::DFA_Analysis::unbounded;
+        std::vector< size_t > length(size(), unbounded);
+        std::deque< uint32_t > check_queue = { initial_state_ };
+        length[initial_state_] = 0;
+        while (!check_queue.empty())
+        {
+            uint32_t q = check_queue.front();
+            check_queue.pop_front();
+            if (states_[q].accepting)
+                return length[q];
+
+            for (const uint32_t & r : states_[q].epsilon)
+            {
+                if (length[q] < length[r])
+                {
+                    length[r] = length[q];
+                    check_queue.push_front(r);
+                }
+            }
+            for (const Edge & e : states_[q].edges)
+            {
+                if (!e.symbols.empty() && length[q] + 1 < length[e.to])
+                {
+                    length[e.to] = length[q] + 1;
+                    check_queue.push_back(e.to);
+                }
+            }
+        }
+
+        return unbounded;
+    }
+
+    /*
+      Returns the DFA of this NFA through subset construction.
+
+      Transitions are computed per byte class rather than per byte, so
+      a state with edges on [^"] and '"' is expanded with two columns,
+      not 256. DFA state 0 is the empty set of NFA states (the dead
+      state).
+
+      If stats is not null, the construction is recorded in it. If
+      memory_limit is not 0 and the states found so far take more bytes
+      than it, NFA_To_DFA_Memory_Limit_Error is thrown.
+
+      With more than one thread, states are expanded by all of them at
+      once (see parallel_subsets()). The DFA is the same either way.
+    */
+    DFA< uint8_t, uint32_t > to_dfa(Automaton_Stats * stats = nullptr,
+                                    size_t memory_limit = 0,
+                                    int threads = 1) const
+    {
+        Stats_Timer timer(stats, "determinize");
+        size_t closures = 0, hash_probes = 0, set_bytes = 0;
+        
+        Byte_Classes classes = byte_classes();
+        int num_classes = classes.size();
+
+        //For each edge, the list of classes it covers.
+        std::vector< std::vector< std::vector< uint8_t > > > edge_classes(size());
+        std::vector< uint8_t > representatives(num_classes);
+        for (int k = 0; k < num_classes; ++k)
+            representatives[k] = classes.representative(k);
+        for (uint32_t q = 0; q < size(); ++q)
+        {
+            for (const Edge & e : states_[q].edges)
+            {
+                std::vector< uint8_t > covered;
+                for (int k = 0; k < num_classes; ++k)
+                    if (e.symbols.contains(representatives[k]))
+                        covered.push_back(k);
+                edge_classes[q].push_back(covered);
+            }
+        }
+
+        if (threads > 1)
+            return parallel_subsets(classes, edge_classes, stats,
+                                    memory_limit, threads);
+
+        std::unordered_map< std::vector< uint32_t >, uint32_t,
+                            State_Set_Hash > ids;
+        std::vector< std::vector< uint32_t > > sets;
+        std::vector< uint32_t > table;
+        std::vector< uint8_t > accept;
+
+        //Dead state.
+        sets.push_back({});
+        ids[sets[0]] = 0;
+        table.assign(num_classes, 0);
+        accept.push_back(0);
+
+        std::vector< uint32_t > marks(size(), 0);
+        uint32_t mark = 0;
+
+        std::vector< uint32_t > initial;
+        closure(initial_state_, initial, marks, ++mark);
+        ++closures;
+        std::sort(initial.begin(), initial.end());
+        ids[initial] = 1;
+        sets.push_back(initial);
+
+        std::vector< std::vector< uint32_t > > buckets(num_classes);
+        for (uint32_t i = 1; i < sets.size(); ++i)
+        {
+            table.resize(table.size() + num_classes, 0);
+
+            bool accepting = false;
+            for (auto & b : buckets)
+                b.clear();
+
+            for (const uint32_t & q : sets[i])
+            {
+                accepting = accepting || states_[q].accepting;
+
+                const std::vector< Edge > & edges = states_[q].edges;
+                for (int e = 0, n = edges.size(); e < n; ++e)
+                    for (const uint8_t & k : edge_classes[q][e])
+                        buckets[k].push_back(edges[e].to);
+            }
+            accept.push_back(accepting);
+
+            for (int k = 0; k < num_classes; ++k)
+            {
+                if (buckets[k].empty())
+                    continue;
+
+                std::vector< uint32_t > next;
+                ++mark;
+                for (const uint32_t & q : buckets[k])
+                    closure(q, next, marks, mark);
+                std::sort(next.begin(), next.end());
+                closures += buckets[k].size();
+                ++hash_probes;
+
+                std::unordered_map< std::vector< uint32_t >, uint32_t,
+                                    State_Set_Hash >::iterator it =
+                    ids.find(next);
+                uint32_t id;
+                if (it == ids.end())
+                {
+                    id = sets.size();
+                    ids[next] = id;
+                    sets.push_back(next);
+                    set_bytes += next.size() * sizeof(uint32_t);
+
+                    if (memory_limit != 0 &&
+                        working_bytes(sets.size(), set_bytes, num_classes) > memory_limit)
+                    {
+                        throw NFA_To_DFA_Memory_Limit_Error();
+                    }
+                }
+                else
+                    id = it->second;
+
+                table[i * num_classes + k] = id;
+            }
+        }
+
+        if (stats != nullptr)
+        {
+            stats->nfa_states = size();
+            stats->dfa_states = sets.size();
+            stats->closures += closures;
+            stats->hash_probes += hash_probes;
+
+            stats->add_bytes(memory_bytes() +
+                             working_bytes(sets.size(), set_bytes, num_classes));
+        }
+
+        return DFA< uint8_t, uint32_t >(classes,
+                                        table,
+                                        accept,
+                                        1);
+    }
+
+private:
+    struct State
+    {
+        State() : accepting(false)
+        {}
+
+        std::vector< Edge > edges;
+        std::vector< uint32_t > epsilon;
+        bool accepting;
+    };
+
+    struct State_Set_Hash
+    {
+        size_t operator()(const std::vector< uint32_t > & x) const
+        {
+            size_t h = x.size();
+            for (const uint32_t & q : x)
+                h = h * 0x9e3779b97f4a7c15ULL + q;
+            return h;
+        }
+    };
+
+    /*
+      Subset construction on several threads, for to_dfa().
+
+      Threads take DFA states to expand in the order they were found,
+      each from a shared counter, so the frontier is expanded by all
+      of them at once. A new set of NFA states is given the next
+      number and published through a concurrent intern table (see
+      Concurrent_Id_Table), and a thread that loses the race for a set
+      takes the number of the winner, leaving its own unused. A thread
+      whose state was not found yet waits for it, until no state is
+      left to expand.
+
+      The table can, rarely, publish one set under two numbers. So at
+      the end every state is mapped to the number the table gives its
+      set, and the used numbers are packed. The DFA then renumbers its
+      states breadth first, which only depends on the transitions, so
+      the result is the DFA built on one thread.
+    */
+    DFA< uint8_t, uint32_t > parallel_subsets(
+        const Byte_Classes & classes,
+        const std::vector< std::vector< std::vector< uint8_t > > > & edge_classes,
+        Automaton_Stats * stats, size_t memory_limit, int threads) const
+    {
+        //Status of each state number, 0 until it is decided.
+        enum { FOUND = 1, UNUSED = 2 };
+
+        int num_classes = classes.size();
+        helper::Segmented_Array< std::vector< uint32_t > > sets;
+        helper::Segmented_Array< uint32_t > table(size_t(64) << 8);
+        helper::Segmented_Array< uint8_t > accept;
+        helper::Segmented_Array< std::atomic< uint8_t > > status;
+        helper::Concurrent_Id_Table ids;
+
+        auto set_hash = [](const std::vector< uint32_t > & set) -> size_t
+        {
+            uint64_t h = State_Set_Hash()(set);
+            return h ^ (h >> 29);
+        };
+
+        //Dead state and initial state.
+        std::vector< uint32_t > marks(size(), 0);
+        sets.at(0).clear();
+        closure(initial_state_, sets.at(1), marks, 1);
+        std::sort(sets.at(1).begin(), sets.at(1).end());
+        for (uint32_t q = 0; q < 2; ++q)
+        {
+            ids.insert(set_hash(sets[q]), q, [&](uint32_t other)
+                       { return sets[other] == sets[q]; });
+            status.at(q).store(FOUND, std::memory_order_relaxed);
+        }
+        for (int k = 0; k < num_classes; ++k)
+            table.at(k) = 0;
+        accept.at(0) = 0;
+
+        //found: state numbers given out, next: the next state to
+        //expand, pending: states found and not expanded yet.
+        std::atomic< uint32_t > found(2), next(1), pending(1);
+        std::atomic< size_t > set_bytes(sets[1].size() * sizeof(uint32_t));
+        std::atomic< size_t > closures(1), hash_probes(0);
+        std::atomic< bool > over_limit(false);
+
+        //Gives a new set a number. The number is left unused if
+        //another thread published the same set first.
+        auto add_set = [&](std::vector< uint32_t > & set, size_t hash) -> uint32_t
+        {
+            uint32_t id = found.fetch_add(1, std::memory_order_acq_rel);
+            size_t bytes = set.size() * sizeof(uint32_t);
+            sets.at(id) = std::move(set);
+            uint32_t winner = ids.insert(hash, id, [&](uint32_t other)
+                                         { return sets[other] == sets[id]; });
+            if (winner != id)
+            {
+                status.at(id).store(UNUSED, std::memory_order_release);
+                return winner;
+            }
+
+            pending.fetch_add(1, std::memory_order_acq_rel);
+            status.at(id).store(FOUND, std::memory_order_release);
+            bytes += set_bytes.fetch_add(bytes, std::memory_order_relaxed);
+            if (memory_limit != 0 &&
+                working_bytes(id + 1, bytes, num_classes) > memory_limit)
+            {
+                over_limit.store(true, std::memory_order_relaxed);
+            }
+            return id;
+        };
+
+        auto expand = [&]()
+        {
+            std::vector< uint32_t > marks(size(), 0);
+            uint32_t mark = 0;
+            std::vector< std::vector< uint32_t > > buckets(num_classes);
+            size_t thread_closures = 0, thread_probes = 0;
+
+            while (!over_limit.load(std::memory_order_relaxed))
+            {
+                //Wait for state i to be decided, or for no state to be
+                //left, in which case state i will never be found.
+                uint32_t i = next.fetch_add(1, std::memory_order_relaxed);
+                uint8_t decided = 0;
+                while (!over_limit.load(std::memory_order_relaxed))
+                {
+                    if (i < found.load(std::memory_order_acquire))
+                    {
+                        decided = status.at(i).load(std::memory_order_acquire);
+                        if (decided != 0)
+                            break;
+                    }
+                    else if (pending.load(std::memory_order_acquire) == 0)
+                        break;
+                    std::this_thread::yield();
+                }
+                if (decided == 0)
+                    break;
+                if (decided == UNUSED)
+                    continue;
+
+                bool accepting = false;
+                for (auto & b : buckets)
+                    b.clear();
+                for (const uint32_t & q : sets[i])
+                {
+                    accepting = accepting || states_[q].accepting;
+
+                    const std::vector< Edge > & edges = states_[q].edges;
+                    for (int e = 0, n = edges.size(); e < n; ++e)
+                        for (const uint8_t & k : edge_classes[q][e])
+                            buckets[k].push_back(edges[e].to);
+                }
+                accept.at(i) = accepting;
+
+                for (int k = 0; k < num_classes; ++k)
+                {
+                    uint32_t id = 0;
+                    if (!buckets[k].empty())
+                    {
+                        std::vector< uint32_t > next_set;
+                        ++mark;
+                        for (const uint32_t & q : buckets[k])
+                            closure(q, next_set, marks, mark);
+                        std::sort(next_set.begin(), next_set.end());
+                        thread_closures += buckets[k].size();
+                        ++thread_probes;
+
+                        size_t hash = set_hash(next_set);
+                        id = ids.find(hash, [&](uint32_t other)
+                                      { return sets[other] == next_set; });
+                        if (id == helper::Concurrent_Id_Table::none)
+                            id = add_set(next_set, hash);
+                    }
+                    table.at(size_t(i) * num_classes + k) = id;
+                }
+
+                pending.fetch_sub(1, std::memory_order_acq_rel);
+            }
+
+            closures.fetch_add(thread_closures, std::memory_order_relaxed);
+            hash_probes.fetch_add(thread_probes, std::memory_order_relaxed);
+        };
+
+        //An exception in a thread, such as bad_alloc, is rethrown once
+        //all have stopped.
+        std::vector< std::exception_ptr > errors(threads);
+        std::vector< std::thread > workers;
+        for (int t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t]()
+            {
+                try
+                {
+                    expand();
+                }
+                catch (...)
+                {
+                    errors[t] = std::current_exception();
+                    over_limit.store(true, std::memory_order_relaxed);
+                }
+            });
+        }
+        for (std::thread & w : workers)
+            w.join();
+        for (const std::exception_ptr & e : errors)
+            if (e)
+                std::rethrow_exception(e);
+        if (over_limit.load())
+            throw NFA_To_DFA_Memory_Limit_Error();
+
+        //Each state is mapped to the number the table gives its set,
+        //and those numbers are packed.
+        uint32_t n = found.load();
+        std::vector< uint32_t > canonical(n, 0), number(n, 0);
+        uint32_t states = 0;
+        for (uint32_t q = 0; q < n; ++q)
+        {
+            if (status[q].load() != FOUND)
+                continue;
+            canonical[q] = ids.find(set_hash(sets[q]), [&](uint32_t other)
+                                    { return sets[other] == sets[q]; });
+            if (canonical[q] == q)
+                number[q] = states++;
+        }
+
+        std::vector< uint32_t > packed(size_t(states) * num_classes);
+        std::vector< uint8_t > packed_accept(states);
+        for (uint32_t q = 0; q < n; ++q)
+        {
+            if (status[q].load() != FOUND || canonical[q] != q)
+                continue;
+            for (int k = 0; k < num_classes; ++k)
+            {
+                uint32_t r = table[size_t(q) * num_classes + k];
+                packed[size_t(number[q]) * num_classes + k] = number[canonical[r]];
+            }
+            packed_accept[number[q]] = accept[q];
+        }
+
+        if (stats != nullptr)
+        {
+            stats->nfa_states = size();
+            stats->dfa_states = states;
+            stats->closures += closures.load();
+            stats->hash_probes += hash_probes.load();
+
+            stats->add_bytes(memory_bytes() +
+                             working_bytes(n, set_bytes.load(), num_classes) +
+                             ids.memory_bytes());
+        }
+
+        return DFA< uint8_t, uint32_t >(classes,
+                                        packed,
+                                        packed_accept,
+                                        number[canonical[1]]);
+    }
+
+    /*
+      Bytes taken by subset construction once it has found states
+      sets, holding set_bytes of NFA states in all. Every set is held
+      twice, as a key of ids and in sets, the table of ids has a node
+      and a bucket per set, and each state has a row of the table.
+    */
+    static size_t working_bytes(size_t states, size_t set_bytes, int num_classes)
+    {
+        return 2 * set_bytes +
+            states * (2 * sizeof(std::vector< uint32_t >) + 4 * sizeof(void *) +
+                      num_classes * sizeof(uint32_t) + sizeof(uint8_t));
+    }
+
+    size_t accepted_prefix(const uint8_t * str, size_t n, bool longest) const
+    {
+        size_t ret = npos;
+        Simulation s(*this);
+        for (size_t i = 0; ; ++i)
+        {
+            if (s.accepting())
+            {
+                ret = i;
+                if (!longest)
+                    break;
+            }
+            if (i == n || !s.step(str[i]))
+                break;
+        }
+        return ret;
+    }
+
+    // Set of active states of a run of this NFA, as a bit vector.
+    struct Simulation
+    {
+        Simulation(const NFA & N)
+            : N(N), current((N.size() + 63) / 64, 0), next(current.size(), 0)
+        { N.add_closure(N.initial_state_, current, check_stack); }
+
+        // Moves on c. Returns false if no state is left.
+        bool step(uint8_t c)
+        {
+            std::fill(next.begin(), next.end(), 0);
+            bool any = false;
+
+            for (size_t w = 0; w < current.size(); ++w)
+            {
+                uint64_t bits = current[w];
+                while (bits != 0)
+                {
+                    uint32_t q = w * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+
+                    for (const Edge & e : N.states_[q].edges)
+                    {
+                        if (e.symbols.contains(c))
+                        {
+                            N.add_closure(e.to, next, check_stack);
+                            any = true;
+                        }
+                    }
+                }
+            }
+
+            current.swap(next);
+            return any;
+        }
+
+        bool accepting() const
+        {
+            for (size_t w = 0; w < current.size(); ++w)
+            {
+                uint64_t bits = current[w];
+                while (bits != 0)
+                {
+                    uint32_t q = w * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+                    if (N.states_[q].accepting)
+                        return true;
+                }
+            }
+            return false;
+        }
+
+        const NFA & N;
+        std::vector< uint64_t > current, next;
+        std::vector< uint32_t > check_stack;
+    };
+
+    /*
+      Appends q and every state reachable from it by epsilon edges to
+      ret, skipping states whose mark already equals mark.
+    */
+    void closure(uint32_t q,
+                 std::vector< uint32_t > & ret,
+                 std::vector< uint32_t > & marks,
+                 uint32_t mark) const
+    {
+        if (marks[q] == mark)
+            return;
+
+        std::vector< uint32_t > check_stack = { q };
+        marks[q] = mark;
+        ret.push_back(q);
+
+        while (!check_stack.empty())
+        {
+            uint32_t check = check_stack.back();
+            check_stack.pop_back();
+
+            for (const uint32_t & r : states_[check].epsilon)
+            {
+                if (marks[r] != mark)
+                {
+                    marks[r] = mark;
+                    ret.push_back(r);
+                    check_stack.push_back(r);
+                }
+            }
+        }
+
+        return;
+    }
+
+    // Adds q and its epsilon closure to a bit vector set of states.
+    void add_closure(uint32_t q,
+                     std::vector< uint64_t > & set,
+                     std::vector< uint32_t > & check_stack) const
+    {
+        if ((set[q / 64] >> (q % 64)) & 1)
+            return;
+
+        set[q / 64] |= uint64_t(1) << (q % 64);
+        check_stack.push_back(q);
+
+        while (!check_stack.empty())
+        {
+            uint32_t check = check_stack.back();
+            check_stack.pop_back();
+
+            for (const uint32_t & r : states_[check].epsilon)
+            {
+                if (((set[r / 64] >> (r % 64)) & 1) == 0)
+                {
+                    set[r / 64] |= uint64_t(1) << (r % 64);
+                    check_stack.push_back(r);
+                }
+            }
+        }
+
+        return;
+    }
+
+    std::vector< State > states_;
+    uint32_t initial_state_;
+};
+
+/*
+  States keep their numbers, and the transitions on every class
+  between two states become one edge. Transitions to and from the dead
+  state are left out.
+*/
+inline NFA< uint8_t, uint32_t > DFA< uint8_t, uint32_t >::reverse() const
+{
+    NFA< uint8_t, uint32_t > ret;
+    for (uint32_t q = 0; q < size(); ++q)
+        ret.add_state();
+
+    std::vector< Byte_Set > members(num_classes_);
+    for (int k = 0; k < num_classes_; ++k)
+        members[k] = classes_.members(k);
+    
+    for (uint32_t q = 1; q < size(); ++q)
+    {
+        std::map< uint32_t, Byte_Set > edges;
+        for (int k = 0; k < num_classes_; ++k)
+        {
+            uint32_t r = target(q, k);
+            if (r != dead_state)
+                edges[r] |= members[k];
+        }
+        for (const std::pair< const uint32_t, Byte_Set > & e : edges)
+            ret.add_transition(e.first, e.second, q);
+    }
+    ret.set_accepting(initial_state_);
+
+    uint32_t initial = ret.add_state();
+    for (uint32_t q = 1; q < size(); ++q)
+        if (accept_[q])
+            ret.add_epsilon(initial, q);
+    ret.set_initial_state(initial);
+
+    return ret;
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef BYTE_SET_H
+#define BYTE_SET_H
+
+#include "Common.h"
+
+// A set of byte values stored as a 256 bit mask.
+class Byte_Set
+{
+public:
+    Byte_Set()
+    { bits_[0] = bits_[1] = bits_[2] = bits_[3] = 0; }
+
+    // Returns the set of all 256 byte values.
+    static Byte_Set all()
+    { return Byte_Set().complement(); }
+
+    void insert(uint8_t c)
+    { bits_[c >> 6] |= uint64_t(1) << (c & 63); }
+
+    // Inserts every byte value from lo to hi, including both.
+    void insert(uint8_t lo, uint8_t hi)
+    {
+        for (int c = lo; c <= hi; ++c)
+            insert(uint8_t(c));
+    }
+
+    void erase(uint8_t c)
+    { bits_[c >> 6] &= ~(uint64_t(1) << (c & 63)); }
+
+    bool contains(uint8_t c) const
+    { return (bits_[c >> 6] >> (c & 63)) & 1; }
+
+    bool empty() const
+    { return (bits_[0] | bits_[1] | bits_[2] | bits_[3]) == 0; }
+
+    int size() const
+    {
+        return __builtin_popcountll(bits_[0]) + __builtin_popcountll(bits_[1]) +
+            __builtin_popcountll(bits_[2]) + __builtin_popcountll(bits_[3]);
+    }
+
+    Byte_Set complement() const
+    {
+        Byte_Set ret;
+        for (int i = 0; i < 4; ++i)
+            ret.bits_[i] = ~bits_[i];
+        return ret;
+    }
+
+    Byte_Set & operator|=(const Byte_Set & s)
+    {
+        for (int i = 0; i < 4; ++i)
+            bits_[i] |= s.bits_[i];
+        return *this;
+    }
+
+    Byte_Set & operator&=(const Byte_Set & s)
+    {
+        for (int i = 0; i < 4; ++i)
+            bits_[i] &= s.bits_[i];
+        return *this;
+    }
+
+    Byte_Set operator|(const Byte_Set & s) const
+    { Byte_Set ret = *this; return ret |= s; }
+
+    Byte_Set operator&(const Byte_Set & s) const
+    { Byte_Set ret = *this; return ret &= s; }
+
+    bool operator==(const Byte_Set & s) const
+    {
+        return bits_[0] == s.bits_[0] && bits_[1] == s.bits_[1] &&
+            bits_[2] == s.bits_[2] && bits_[3] == s.bits_[3];
+    }
+
+    bool operator!=(const Byte_Set & s) const
+    { return !(*this == s); }
+
+    uint64_t word(int i) const
+    { return bits_[i]; }
+
+private:
+    uint64_t bits_[4];
+};
+
+namespace std
+{
+    template <>
+    struct hash< Byte_Set >
+    {
+        size_t operator()(const Byte_Set & x) const
+        {
+            size_t h = 0;
+            for (int i = 0; i < 4; ++i)
+                h = h * 1000003 ^ std::hash< uint64_t >()(x.word(i));
+            return h;
+        }
+    };
+}
+
+/*
+  Partition of the 256 byte values into equivalence classes. Two bytes
+  are in the same class when every set passed to refine() contains
+  either both of them or neither of them. An automaton whose
+  transitions are all on refined sets behaves the same on every byte
+  of a class, so its transition table only needs one column per
+  class instead of one per byte.
+*/
+class Byte_Classes
+{
+public:
+    Byte_Classes() : size_(1)
+    {
+        for (int c = 0; c < 256; ++c)
+            classes_[c] = 0;
+    }
+
+    // Splits every class that s only partially covers.
+    void refine(const Byte_Set & s)
+    {
+        int new_class[512];
+        for (int k = 0; k < 512; ++k)
+            new_class[k] = -1;
+
+        int n = 0;
+        for (int c = 0; c < 256; ++c)
+        {
+            int key = classes_[c] * 2 + s.contains(uint8_t(c));
+            if (new_class[key] < 0)
+                new_class[key] = n++;
+            classes_[c] = uint8_t(new_class[key]);
+        }
+        size_ = n;
+
+        return;
+    }
+
+    uint8_t operator[](uint8_t c) const
+    { return classes_[c]; }
+
+    // Number of classes, between 1 and 256.
+    int size() const
+    { return size_; }
+
+    // Returns the smallest byte value in class k.
+    uint8_t representative(int k) const
+    {
+        for (int c = 0; c < 256; ++c)
+            if (classes_[c] == k)
+                return uint8_t(c);
+        return 0;
+    }
+
+    // Returns all byte values in class k.
+    Byte_Set members(int k) const
+    {
+        Byte_Set ret;
+        for (int c = 0; c < 256; ++c)
+            if (classes_[c] == k)
+                ret.insert(uint8_t(c));
+        return ret;
+    }
+
+private:
+    uint8_t classes_[256];
+    int size_;
+};
+
+#endif
@@ -8,8 +8,11 @@
 #include <stack>
 #include <unordered_set>
 #include <unordered_map>
+#include <set>
 #include <cctype>
 #include <utility>
+#include <cstdint>
+#include <algorithm>
 
 #include "STL_Helper.h"
 
@@ -24,6 +27,8 @@ class DFA;
 
 class DFA_Invalid_Sigma_Character_Error{};
 class DFA_To_NFA_Invalid_Epsilon_Error{};
+class DFA_Incomplete_Error{};
+class DFA_Reverse_Invalid_Initial_State_Error{};
 
 
 //NFA
@@ -34,9 +39,28 @@ class NFA_Epsilon_Not_In_Sigma_Error{};
 class NFA_Invalid_Sigma_Character_Error{};
 class NFA_Invalid_State_Error{};
 class NFA_Invalid_Kleene_Star_Initial_State_Error{};
+class NFA_To_DFA_Memory_Limit_Error{};
+class NFA_Reverse_Invalid_Initial_State_Error{};
+
+
+//Byte automata, specializations used by Regex (Byte_DFA.h, Byte_NFA.h).
+template <>
+class DFA< uint8_t, uint32_t >;
+
+template <>
+class NFA< uint8_t, uint32_t >;
 
 
 //Regex
 class Regex;
+class Aho_Corasick;
+class Lazy_DFA;
+class Derivative_DFA;
+class Pike_VM;
+
+namespace helper
+{
+    class Derivative_Terms;
+}
 
 #endif
@@ -0,0 +1,275 @@
+#ifndef CONCURRENT_H
+#define CONCURRENT_H
+
+#include "Common.h"
+
+#include <atomic>
+
+/*
+  Containers that many threads can read and grow at the same time
+  without locks, used by the lazily built automata (see Lazy_DFA.h).
+  Nothing is ever removed from them, which is what keeps them simple:
+  an element, once published, stays where it is for the lifetime of
+  the container.
+*/
+namespace helper
+{
+    /*
+      Array that grows by segments. The first segment holds block
+      elements and every next one twice as many as the one before, so
+      element i is found in constant time and elements never move.
+
+      Segments are allocated on first use by whichever thread needs
+      them first, and published with a compare-and-swap. Elements are
+      value initialized, so atomics start at 0, but any other element
+      must be written before the index that refers to it is published
+      to other threads.
+    */
+    template< typename T >
+    class Segmented_Array
+    {
+    public:
+        static constexpr int max_segments = 40;
+
+        // block must be a power of two.
+        Segmented_Array(size_t block = 64)
+            : shift_(__builtin_ctzll(block))
+        {
+            for (std::atomic< T * > & s : segments_)
+                s.store(nullptr, std::memory_order_relaxed);
+        }
+
+        Segmented_Array(const Segmented_Array &) = delete;
+        Segmented_Array & operator=(const Segmented_Array &) = delete;
+
+        ~Segmented_Array()
+        {
+            for (std::atomic< T * > & s : segments_)
+                delete [] s.load(std::memory_order_relaxed);
+        }
+
+        // Element i, whose segment must already exist.
+        T & operator[](size_t i) const
+        {
+            int s;
+            size_t offset;
+            locate(i, s, offset);
+            return segments_[s].load(std::memory_order_acquire)[offset];
+        }
+
+        // Element i, allocating its segment if needed.
+        T & at(size_t i)
+        {
+            int s;
+            size_t offset;
+            locate(i, s, offset);
+
+            T * segment = segments_[s].load(std::memory_order_acquire);
+            if (segment == nullptr)
+            {
+                T * created = new T[size_t(1) << (shift_ + s)]();
+                if (segments_[s].compare_exchange_strong(segment, created,
+                                                         std::memory_order_acq_rel))
+                    segment = created;
+                else
+                    delete [] created;
+            }
+            return segment[offset];
+        }
+
+        // Bytes held by the segments allocated so far.
+        size_t memory_bytes() const
+        {
+            size_t ret = 0;
+            for (int s = 0; s < max_segments; ++s)
+                if (segments_[s].load(std::memory_order_relaxed) != nullptr)
+                    ret += (size_t(1) << (shift_ + s)) * sizeof(T);
+            return ret;
+        }
+
+        // Bytes held by the segments of elements 0 to n - 1.
+        size_t memory_bytes(size_t n) const
+        {
+            if (n == 0)
+                return 0;
+            int s;
+            size_t offset;
+            locate(n - 1, s, offset);
+            return (((size_t(1) << (s + 1)) - 1) << shift_) * sizeof(T);
+        }
+
+    private:
+        void locate(size_t i, int & s, size_t & offset) const
+        {
+            size_t x = (i >> shift_) + 1;
+            s = 63 - __builtin_clzll(x);
+            offset = i - (((size_t(1) << s) - 1) << shift_);
+        }
+
+        int shift_;
+        mutable std::atomic< T * > segments_[max_segments];
+    };
+
+    /*
+      Hash table of integer ids, each standing for a key stored
+      elsewhere (such as the set of NFA states of a DFA state), that
+      threads can look up and insert into at the same time.
+
+      The table is a list of open addressing tables, newest first.
+      Inserts go to the newest one, and when it is half full a table
+      twice as large is put in front with a compare-and-swap. Nothing
+      is rehashed, so lookups probe every table, which is cheap since
+      there are only logarithmically many. A slot is claimed with a
+      compare-and-swap on the hash and the id together, and a thread
+      that loses the race to an equal key gets the winner's id.
+
+      Two threads inserting equal keys while a new table is put in
+      front can, rarely, both succeed. Users must tolerate that, for
+      a cache it only means a redundant state.
+    */
+    class Concurrent_Id_Table
+    {
+    public:
+        static constexpr uint32_t none = uint32_t(-1);
+
+        Concurrent_Id_Table(size_t capacity = 64)
+        { newest_.store(new Table(capacity, nullptr), std::memory_order_relaxed); }
+
+        Concurrent_Id_Table(const Concurrent_Id_Table &) = delete;
+        Concurrent_Id_Table & operator=(const Concurrent_Id_Table &) = delete;
+
+        ~Concurrent_Id_Table()
+        {
+            Table * t = newest_.load(std::memory_order_relaxed);
+            while (t != nullptr)
+            {
+                Table * older = t->older;
+                delete t;
+                t = older;
+            }
+        }
+
+        /*
+          Returns the id whose key equals the one looked up, or none.
+          equal(id) must compare the key of id with it.
+        */
+        template< typename Equal >
+        uint32_t find(size_t hash, Equal equal) const
+        {
+            for (Table * t = newest_.load(std::memory_order_acquire);
+                 t != nullptr; t = t->older)
+            {
+                uint32_t id = t->find(hash, equal);
+                if (id != none)
+                    return id;
+            }
+            return none;
+        }
+
+        /*
+          Inserts id, whose key must already be readable by equal().
+          Returns id, or the id of an equal key inserted first.
+        */
+        template< typename Equal >
+        uint32_t insert(size_t hash, uint32_t id, Equal equal)
+        {
+            while (true)
+            {
+                Table * t = newest_.load(std::memory_order_acquire);
+                if (2 * (t->used.load(std::memory_order_relaxed) + 1) > t->capacity)
+                {
+                    Table * larger = new Table(2 * t->capacity, t);
+                    if (!newest_.compare_exchange_strong(t, larger,
+                                                         std::memory_order_acq_rel))
+                    {
+                        larger->older = nullptr;
+                        delete larger;
+                    }
+                    continue;
+                }
+
+                uint32_t ret = t->insert(hash, id, equal);
+                if (ret != none)
+                    return ret;
+            }
+        }
+
+        // Bytes held by the tables.
+        size_t memory_bytes() const
+        {
+            size_t ret = 0;
+            for (Table * t = newest_.load(std::memory_order_acquire);
+                 t != nullptr; t = t->older)
+                ret += sizeof(Table) + t->capacity * sizeof(uint64_t);
+            return ret;
+        }
+
+    private:
+        static constexpr uint64_t empty = uint64_t(-1);
+
+        struct Table
+        {
+            Table(size_t c, Table * o)
+                : capacity(c), slots(new std::atomic< uint64_t >[c]), older(o)
+            {
+                used.store(0, std::memory_order_relaxed);
+                for (size_t i = 0; i < capacity; ++i)
+                    slots[i].store(empty, std::memory_order_relaxed);
+            }
+
+            ~Table()
+            { delete [] slots; }
+
+            template< typename Equal >
+            uint32_t find(size_t hash, Equal equal) const
+            {
+                uint32_t tag = uint32_t(hash >> 32);
+                for (size_t i = hash & (capacity - 1), probes = 0;
+                     probes < capacity; i = (i + 1) & (capacity - 1), ++probes)
+                {
+                    uint64_t slot = slots[i].load(std::memory_order_acquire);
+                    if (slot == empty)
+                        return none;
+                    if (uint32_t(slot >> 32) == tag && equal(uint32_t(slot)))
+                        return uint32_t(slot);
+                }
+                return none;
+            }
+
+            // Returns none if the table is full.
+            template< typename Equal >
+            uint32_t insert(size_t hash, uint32_t id, Equal equal)
+            {
+                uint32_t tag = uint32_t(hash >> 32);
+                uint64_t claim = (uint64_t(tag) << 32) | id;
+                for (size_t i = hash & (capacity - 1), probes = 0;
+                     probes < capacity; i = (i + 1) & (capacity - 1), ++probes)
+                {
+                    uint64_t slot = slots[i].load(std::memory_order_acquire);
+                    if (slot == empty)
+                    {
+                        if (slots[i].compare_exchange_strong(slot, claim,
+                                                             std::memory_order_acq_rel))
+                        {
+                            used.fetch_add(1, std::memory_order_relaxed);
+                            return id;
+                        }
+                        //slot now holds the id that won the race.
+                    }
+                    if (uint32_t(slot >> 32) == tag && equal(uint32_t(slot)))
+                        return uint32_t(slot);
+                }
+                return none;
+            }
+
+            size_t capacity;
+            std::atomic< size_t > used;
+            std::atomic< uint64_t > * slots;
+            Table * older;
+        };
+
+        std::atomic< Table * > newest_;
+    };
+}
+
+#endif
@@ -2,6 +2,8 @@
 #define DFA_H
 
 #include "Common.h"
+#include "Language.h"
+#include "Stats.h"
 #include "NFA.h"
 
 // S_t = Type of values in Sigma (Alphabet).
@@ -22,42 +24,116 @@ public:
           states_(states),
           initial_state_(initial_state),
           accept_states_(accept_states),
-          delta_(delta)
+          delta_(delta),
+          table_(nullptr),
+          stats_(nullptr)
     {}
 
-    DFA(const DFA< S_t, Q_t > & M)
+    DFA(const DFA< S_t, Q_t > & M) : table_(nullptr), stats_(nullptr)
     { *this = M; }
 
     DFA< S_t, Q_t > & operator=(const DFA< S_t, Q_t > & M)
     {
+        if (this == &M)
+            return *this;
+        
         sigma_ = M.sigma_;
         states_ = M.states_;
         initial_state_ = M.initial_state_;
         accept_states_ = M.accept_states_;
         delta_ = M.delta_;
 
+        //The table is rebuilt on demand.
+        if (table_ != nullptr)
+            delete table_;
+        table_ = nullptr;
+
         return *this;
     }
 
-    ~DFA(){}
+    ~DFA()
+    {
+        if (table_ != nullptr)
+            delete table_;
+    }
 
-    // Returns true if this DFA accepts a given string of characters
-    // in sigma, false otherwise.
+    /*
+      Records the building of the table used for matching and of
+      minimal DFAs in stats from now on (see Stats.h), or stops
+      recording if stats is null. The stats object is not owned and is
+      not copied along with this DFA.
+    */
+    void set_stats(Automaton_Stats * stats)
+    { stats_ = stats; }
+
+    /*
+      Returns true if this DFA accepts a given string of characters
+      in sigma, false otherwise. The answer is returned as soon as it
+      is decided: on a missing transition, in a state that can no
+      longer accept or no longer reject, or before reading anything
+      when no string of that length is accepted.
+    */
     bool operator()(const std::vector< S_t > & str) const
     {
-        Q_t state = initial_state_;
+        const Table & t = table();
+        if (!t.analysis.length_possible(str.size()))
+            return false;
+        
+        int state = t.initial_state;
 
         for (const S_t & c : str)
         {
+            if (t.analysis.status[state] != helper::DFA_Analysis::UNDECIDED)
+                return t.analysis.status[state] == helper::DFA_Analysis::ACCEPTS;
+            
             //Make sure this character is in sigma.
-            validate(c);
+            int symbol = t.symbol_index.find(c);
+            if (symbol < 0)
+                throw DFA_Invalid_Sigma_Character_Error();
 
-            state = delta_.find({state, c})->second;
+            state = t.next(state, symbol);
+            if (state < 0)
+                return false;
         }
         
-        return is_accepting(state);
+        return t.accept[state];
     }
 
+    /*
+      Returns true if some string starting with prefix is accepted,
+      for instance to check input while it is being typed.
+    */
+    bool can_still_match(const std::vector< S_t > & prefix) const
+    {
+        const Table & t = table();
+        int state = t.initial_state;
+
+        for (const S_t & c : prefix)
+        {
+            if (t.analysis.status[state] == helper::DFA_Analysis::REJECTS)
+                return false;
+            
+            int symbol = t.symbol_index.find(c);
+            if (symbol < 0)
+                throw DFA_Invalid_Sigma_Character_Error();
+
+            state = t.next(state, symbol);
+            if (state < 0)
+                return false;
+        }
+
+        return t.analysis.status[state] != helper::DFA_Analysis::REJECTS;
+    }
+
+    // Length of the shortest accepted string, unbounded if none.
+    size_t min_length() const
+    { return table().analysis.min_length; }
+
+    // Length of the longest accepted string, unbounded if there is no
+    // longest one.
+    size_t max_length() const
+    { return table().analysis.max_length; }
+
     /*
       Return a vector of strings that each hold a different
       instantaneous descrition of each step in the string
@@ -82,9 +158,18 @@ public:
             ret[i++] = "(" + std::to_string(state) + ", " +
                 std::to_string(str) + ")";
             c = str[0];
-            str.erase(str.begin());
             validate(c);
-            state = delta_.find({state, c})->second;
+
+            //No transition, the computation halts and rejects.
+            typename D_t::const_iterator it = delta_.find({state, c});
+            if (it == delta_.end())
+            {
+                ret.resize(i);
+                return ret;
+            }
+            
+            str.erase(str.begin());
+            state = it->second;
         }
 
         ret[i] = "(" + std::to_string(state) + ", [])";
@@ -96,9 +181,68 @@ public:
         return ret;
     }
 
-    // Return a DFA that is the compliment of the original.
+    // Return the set of states reachable from the initial state.
+    std::unordered_set< Q_t > reachable_states() const
+    {
+        std::unordered_set< Q_t > ret = { initial_state_ };
+        std::stack< Q_t > to_eval; to_eval.push(initial_state_);
+        
+        while (!to_eval.empty())
+        {
+            Q_t q = to_eval.top();
+            to_eval.pop();
+            
+            for (const S_t & c : sigma_)
+            {
+                typename D_t::const_iterator it = delta_.find({q, c});
+                if (it != delta_.end() && ret.insert(it->second).second)
+                    to_eval.push(it->second);
+            }
+        }
+
+        return ret;
+    }
+
+    // Return the set of states from which an accepting state can be
+    // reached, leaving out the dead states.
+    std::unordered_set< Q_t > live_states() const
+    {
+        std::unordered_map< Q_t, std::vector< Q_t > > in;
+        for (const std::pair< const Q_t_S_t, Q_t > & p : delta_)
+            in[p.second].push_back(p.first.first);
+
+        std::unordered_set< Q_t > ret = accept_states_;
+        std::stack< Q_t > to_eval;
+        for (const Q_t & q : accept_states_)
+            to_eval.push(q);
+
+        while (!to_eval.empty())
+        {
+            Q_t q = to_eval.top();
+            to_eval.pop();
+
+            typename std::unordered_map< Q_t, std::vector< Q_t > >::const_iterator it =
+                in.find(q);
+            if (it == in.end())
+                continue;
+            for (const Q_t & p : it->second)
+                if (ret.insert(p).second)
+                    to_eval.push(p);
+        }
+
+        return ret;
+    }
+
+    /*
+      Return a DFA that is the compliment of the original.
+      The DFA must be complete, since the strings rejected through a
+      missing transition would need a new accepting state.
+    */
     DFA< S_t, Q_t > compliment() const
     {
+        if (!complete())
+            throw DFA_Incomplete_Error();
+
         DFA< S_t, Q_t > ret = *this;
 
         std::unordered_set< Q_t > new_accept_states;
@@ -112,28 +256,12 @@ public:
     }
 
     // Return a DFA that is the minimal DFA of the original.
-    DFA< Q_t, S_t > minimal() const
+    DFA< S_t, Q_t > minimal() const
     {
-        std::unordered_set< Q_t > reachable_states;
-        reachable_states.insert(initial_state_);
-
+        Stats_Timer timer(stats_, "minimize");
+        
         //Find all reachable states.
-        for (const Q_t & q : states_)
-        {
-            for (const S_t & c : sigma_)
-            {
-                Q_t next_state = delta_.find({q, c})->second;
-
-                if (reachable_states.find(next_state) == reachable_states.end())
-                    reachable_states.insert(next_state);
-            }
-        }
-
-        //Remove any states that are not reachable.
-        std::unordered_set< Q_t > new_states = states_;
-        for (const Q_t & q : new_states)
-            if (reachable_states.find(q) == reachable_states.end())
-                new_states.erase(q);
+        std::unordered_set< Q_t > new_states = reachable_states();
 
         //Old and new partitions.
         std::vector < std::unordered_set < Q_t > > * old_p, *new_p;
@@ -141,10 +269,10 @@ public:
         old_p = new std::vector< std::unordered_set < Q_t > >;
         new_p = new std::vector< std::unordered_set < Q_t > >;
 
-        //Divide up the states into 2 partitions,
+        //Divide up the reachable states into 2 partitions,
         //accepting and non-accepting.
         old_p->resize(2);
-        for (const Q_t & q : states_)
+        for (const Q_t & q : new_states)
         {
             if (accept_states_.find(q) != accept_states_.end())
                 old_p->at(0).insert(q);
@@ -155,21 +283,22 @@ public:
         std::unordered_set< Q_t > new_accept_states;
         D_t new_delta;
         Q_t new_initial_state;
+        new_states.clear();
 
-        //Always accepts.
+        //Never accepts.
         if (old_p->at(0).size() == 0)
         {
             new_states.insert(initial_state_);
-            new_accept_states.insert(initial_state_);
             for (const S_t & c : sigma_)
                 new_delta[{initial_state_, c}] = initial_state_;
             new_initial_state = initial_state_;
         }
 
-        //Never accepts.
-        else if (old_p->at(1).size() == 0)
+        //Always accepts, unless a missing transition rejects.
+        else if (old_p->at(1).size() == 0 && complete())
         {
             new_states.insert(initial_state_);
+            new_accept_states.insert(initial_state_);
             for (const S_t & c : sigma_)
                 new_delta[{initial_state_, c}] = initial_state_;
             new_initial_state = initial_state_;
@@ -178,6 +307,9 @@ public:
         //Minimize
         else
         {
+            if (old_p->at(1).size() == 0)
+                old_p->pop_back();
+            
             std::unordered_map< Q_t, std::unordered_set< Q_t >* > locations;
             while (true)
             {
@@ -207,8 +339,8 @@ public:
                         bool equivalent = true;
                         for (const S_t & c : sigma_)
                         {
-                            if (locations[delta_.find({q, c})->second] !=
-                                locations[delta_.find({first, c})->second])
+                            if (location(locations, q, c) !=
+                                location(locations, first, c))
                             {
                                 equivalent = false;
                                 break;
@@ -275,11 +407,13 @@ public:
                 //Capture first element in set.
                 Q_t first = *(set.begin());
 
-                //Adjust delta for all c in sigma.
+                //Adjust delta for all c in sigma, missing transitions
+                //stay missing.
                 for (const S_t & c : sigma_)
                 {
-                    Q_t new_q = delta_.find({first, c})->second;
-                    new_delta[{first, c}] = *(locations[new_q]->begin());
+                    typename D_t::const_iterator it = delta_.find({first, c});
+                    if (it != delta_.end())
+                        new_delta[{first, c}] = *(locations[it->second]->begin());
                 }
             }
         }
@@ -296,6 +430,40 @@ public:
     }
 
 
+    /*
+      Returns an NFA of the reverse language, accepting the strings this
+      DFA accepts read backwards. Every transition is turned around, the
+      initial state becomes the only accepting state, and a new initial
+      state has epsilon transitions to the old accepting states. The
+      reverse is not determinized here: the NFA matches by simulation,
+      and builds its DFA the first time to_dfa() is called.
+    */
+    NFA< S_t, Q_t > reverse(const Q_t & new_initial_state,
+                            const S_t & epsilon) const
+    {
+        if (states_.find(new_initial_state) != states_.end())
+            throw DFA_Reverse_Invalid_Initial_State_Error();
+        if (sigma_.find(epsilon) != sigma_.end())
+            throw DFA_To_NFA_Invalid_Epsilon_Error();
+
+        std::unordered_set< S_t > new_sigma = sigma_;
+        new_sigma.insert(epsilon);
+        std::unordered_set< Q_t > new_states = states_;
+        new_states.insert(new_initial_state);
+
+        typename NFA< S_t, Q_t >::D_t new_delta;
+        for (const std::pair< const Q_t_S_t, Q_t > & pair : delta_)
+            new_delta[{pair.second, pair.first.second}].insert(pair.first.first);
+        new_delta[{new_initial_state, epsilon}] = accept_states_;
+
+        return NFA< S_t, Q_t >(new_sigma,
+                               new_states,
+                               new_initial_state,
+                               {initial_state_},
+                               new_delta,
+                               epsilon);
+    }
+
     // Returns this DFA as an NFA. Must provide an epsilon character.
     NFA< S_t, Q_t > to_nfa(const S_t & epsilon) const
     {
@@ -329,7 +497,11 @@ public:
                                epsilon);
     }
 
-    // Return true if this is a valid DFA.
+    /*
+      Return true if this is a valid DFA. States may be missing
+      transitions on some symbols (a partial DFA), those strings are
+      rejected.
+    */
     bool valid() const
     {
         // Validate size of states.
@@ -346,7 +518,6 @@ public:
             return false;
 
         // Validate all values of delta
-        std::unordered_map< Q_t, std::unordered_set< S_t > > state_checks;
         for (const std::pair< Q_t_S_t, Q_t > & p : delta_)
         {
             //Check if the state is valid.
@@ -357,30 +528,21 @@ public:
             if (sigma_.find(p.first.second) == sigma_.end())
                 return false;
 
-            //Check to make sure that state does not already have a
-            //transition with that same alphabet character.
-            if (state_checks[p.first.first].find(p.first.second) != state_checks[p.first.first].end())
-                return false;
-            
-            //Put that alphabet character into the checking map's
-            //set for that specific state.
-            state_checks[p.first.first].insert(p.first.second);
-
             //Make sure the state that it travels to exists.
             if (states_.find(p.second) == states_.end())
                 return false;
         }
 
-        //Validate that the correct amount of states are present.
-        if (state_checks.size() != states_.size())
-            return false;
+        return true;
+    }
 
-        //Validate that each state has the correct amount of transitions.
-        for (const std::pair< Q_t, std::unordered_set< S_t > > & p : state_checks)
-        {
-            if (p.second.size() != sigma_.size())
-                return false;
-        }
+    // Return true if every state has a transition on every symbol.
+    bool complete() const
+    {
+        for (const Q_t & q : states_)
+            for (const S_t & c : sigma_)
+                if (delta_.find({q, c}) == delta_.end())
+                    return false;
 
         return true;
     }
@@ -405,8 +567,180 @@ public:
     {
         return accept_states_.find(q) != accept_states_.end();
     }
+
+    class Explorer;
 private:
 
+    // Consecutive symbols lo to hi, all going to state to.
+    struct Range
+    {
+        int lo;
+        int hi;
+        int to;
+    };
+
+    /*
+      Integer indexed copy of delta used by operator(), in compressed
+      sparse row form. States and symbols are numbered (symbols in
+      increasing order for arithmetic types), and the transitions of
+      state q are ranges[offsets[q]] to ranges[offsets[q + 1] - 1],
+      sorted by symbol. Missing transitions take no space, so a
+      partial DFA over a large alphabet costs the transitions it has.
+    */
+    struct Table
+    {
+        // Returns the state q goes to on symbol c, or -1 if none.
+        int next(int q, int c) const
+        {
+            int lo = offsets[q], hi = offsets[q + 1];
+
+            //Short rows are scanned, long ones binary searched.
+            if (hi - lo <= 8)
+            {
+                for (; lo < hi; ++lo)
+                    if (ranges[lo].hi >= c)
+                        return ranges[lo].lo <= c ? ranges[lo].to : -1;
+                return -1;
+            }
+            
+            while (lo < hi)
+            {
+                int mid = (lo + hi) / 2;
+                if (ranges[mid].hi < c)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            if (lo < offsets[q + 1] && ranges[lo].lo <= c)
+                return ranges[lo].to;
+            return -1;
+        }
+
+        helper::Symbol_Index< S_t > symbol_index;
+        std::vector< int > offsets;
+        std::vector< Range > ranges;
+        std::vector< uint8_t > accept;
+        int num_symbols;
+        int initial_state;
+        helper::DFA_Analysis analysis;
+    };
+
+    // Builds the table the first time it is needed.
+    const Table & table() const
+    {
+        if (table_ != nullptr)
+            return *table_;
+
+        Stats_Timer timer(stats_, "table");
+        size_t hash_probes = 0;
+        
+        Table * t = new Table;
+        for (const S_t & c : helper::ordered(sigma_))
+            t->symbol_index.insert(c);
+        t->num_symbols = t->symbol_index.size();
+
+        std::unordered_map< Q_t, int > state_index;
+        std::vector< Q_t > index_state;
+        for (const Q_t & q : states_)
+        {
+            state_index[q] = index_state.size();
+            index_state.push_back(q);
+        }
+
+        // Look up a state by hash, falling back to comparing with
+        // every state for state types (such as sets) whose hash can
+        // differ between equal values.
+        auto index_of = [&](const Q_t & q) -> int
+        {
+            ++hash_probes;
+            typename std::unordered_map< Q_t, int >::const_iterator it =
+                state_index.find(q);
+            if (it != state_index.end())
+                return it->second;
+            for (int k = 0, n = index_state.size(); k < n; ++k)
+                if (index_state[k] == q)
+                    return k;
+            return 0;
+        };
+
+        //Bucket the transitions by state, then sort them by symbol
+        //and merge runs of consecutive symbols with the same target.
+        std::vector< std::vector< std::pair< int, int > > > out(index_state.size());
+        for (const std::pair< const Q_t_S_t, Q_t > & p : delta_)
+        {
+            out[index_of(p.first.first)].push_back(
+                {t->symbol_index.find(p.first.second), index_of(p.second)});
+        }
+
+        t->offsets.push_back(0);
+        for (std::vector< std::pair< int, int > > & edges : out)
+        {
+            std::sort(edges.begin(), edges.end());
+            for (const std::pair< int, int > & e : edges)
+            {
+                if (t->ranges.size() > t->offsets.back() &&
+                    t->ranges.back().hi + 1 == e.first &&
+                    t->ranges.back().to == e.second)
+                {
+                    ++t->ranges.back().hi;
+                }
+                else
+                    t->ranges.push_back({e.first, e.first, e.second});
+            }
+            t->offsets.push_back(t->ranges.size());
+        }
+
+        t->accept.assign(index_state.size(), 0);
+        for (const Q_t & q : accept_states_)
+            t->accept[index_of(q)] = 1;
+        t->initial_state = index_of(initial_state_);
+
+        t->analysis = helper::analyze_dfa(
+            index_state.size(), t->initial_state, t->accept,
+            [&](int q, std::vector< int > & out)
+            {
+                int covered = 0;
+                for (int r = t->offsets[q]; r < t->offsets[q + 1]; ++r)
+                {
+                    out.push_back(t->ranges[r].to);
+                    covered += t->ranges[r].hi - t->ranges[r].lo + 1;
+                }
+                if (covered < t->num_symbols)
+                    out.push_back(-1);
+            });
+
+        if (stats_ != nullptr)
+        {
+            stats_->dfa_states = index_state.size();
+            stats_->hash_probes += hash_probes;
+            stats_->resident_bytes = helper::vector_bytes(t->offsets) +
+                helper::vector_bytes(t->ranges) +
+                helper::vector_bytes(t->accept) +
+                helper::vector_bytes(t->analysis.status);
+            stats_->add_bytes(stats_->resident_bytes +
+                              index_state.size() * (sizeof(Q_t) + sizeof(int)));
+        }
+
+        table_ = t;
+        return *table_;
+    }
+
+    /*
+      Helper function for minimal(): the partition set holding the
+      state q goes to on c, or nullptr if q has no transition on c.
+    */
+    const std::unordered_set< Q_t > * location(
+        std::unordered_map< Q_t, std::unordered_set< Q_t >* > & locations,
+        const Q_t & q, const S_t & c
+        ) const
+    {
+        typename D_t::const_iterator it = delta_.find({q, c});
+        if (it == delta_.end())
+            return nullptr;
+        return locations[it->second];
+    }
+
     // Validates characters in operator() string.
     inline void validate(const S_t & s) const
     {
@@ -421,71 +755,171 @@ private:
     Q_t initial_state_;
     std::unordered_set< Q_t > accept_states_;
     D_t delta_;
+
+    //Table used by operator(), built lazily.
+    mutable Table * table_;
+
+    //Not owned, null unless set_stats() was called.
+    Automaton_Stats * stats_;
+};
+
+/*
+  Explorer over this DFA for the language checks (see Language.h).
+  State k + 1 of the explorer is state k of the table, and state 0
+  stands for a missing transition or a symbol outside of sigma.
+*/
+template< typename S_t, typename Q_t >
+class DFA< S_t, Q_t >::Explorer
+{
+public:
+    Explorer(const DFA< S_t, Q_t > & M) : t_(M.table())
+    {}
+
+    int initial_state() const
+    { return t_.initial_state + 1; }
+
+    int next_state(int q, const S_t & c) const
+    {
+        int symbol = t_.symbol_index.find(c);
+        if (q == 0 || symbol < 0)
+            return 0;
+        return t_.next(q - 1, symbol) + 1;
+    }
+
+    bool is_accepting(int q) const
+    { return q != 0 && t_.accept[q - 1]; }
+
+private:
+    const Table & t_;
 };
 
 
 ///// NON-MEMBER FUNCTIONS \\\\\
 
 
+class DFA_Sigma_Mismatch_Error{};
 class DFA_Sigma_Mismatch_Intersection_Error{};
 
+// Boolean operations that dfa_product can compute.
+enum DFA_Product_Operation
+{
+    DFA_INTERSECTION,         // Accepted by both M0 and M1.
+    DFA_UNION,                // Accepted by M0 or M1.
+    DFA_DIFFERENCE,           // Accepted by M0 but not M1.
+    DFA_SYMMETRIC_DIFFERENCE  // Accepted by exactly one of M0 and M1.
+};
+
+// Returns true if a product state is accepting under an operation.
+inline bool dfa_product_accepts(DFA_Product_Operation op,
+                                bool accept0, bool accept1)
+{
+    switch (op)
+    {
+    case DFA_INTERSECTION:
+        return accept0 && accept1;
+    case DFA_UNION:
+        return accept0 || accept1;
+    case DFA_DIFFERENCE:
+        return accept0 && !accept1;
+    case DFA_SYMMETRIC_DIFFERENCE:
+    default:
+        return accept0 != accept1;
+    }
+}
+
 /*
-  Returns a DFA that is the interseciton of DFA M0 and M1.
+  Returns the product DFA of M0 and M1 under a boolean operation.
   DFA M0 and M1 MUST have exactly the same sigma.
-  The returned DFA does not have unreachable states removed.
+
+  The product is built on the fly by a search from the pair of initial
+  states, so only reachable pairs of states are ever created: the cost
+  is the size of the reachable product, not |Q0| * |Q1|. The result
+  can be given straight to minimal().
+
+  Partial DFAs are fine for an intersection, and for a difference
+  where M0 is missing the transition. Otherwise a missing transition
+  is left out when the state the other DFA goes to is dead, so that
+  the pair cannot accept, and throws DFA_Incomplete_Error when that
+  state can still accept.
 */
 template< typename S_t, typename Q_t0, typename Q_t1 >
-DFA< S_t, std::pair< Q_t0, Q_t1 > > dfa_intersection(
+DFA< S_t, std::pair< Q_t0, Q_t1 > > dfa_product(
     const DFA< S_t, Q_t0 > & M0,
-    const DFA< S_t, Q_t1 > & M1
+    const DFA< S_t, Q_t1 > & M1,
+    DFA_Product_Operation op
     )
 {
     //Sigma must be the same for both DFA.
     if (M0.sigma() != M1.sigma())
-        throw DFA_Sigma_Mismatch_Intersection_Error();
+        throw DFA_Sigma_Mismatch_Error();
     
     typedef std::pair< Q_t0, Q_t1 > New_Q_t;
     typedef std::pair< New_Q_t, S_t > New_Q_t_S_t;
     typedef std::unordered_map< New_Q_t_S_t, New_Q_t > New_D_t;
 
-    // Get new set of states.
-    std::unordered_set< New_Q_t > new_states;
-    for (const Q_t0 & q0 : M0.states())
-        for (const Q_t1 & q1 : M1.states())
-            new_states.insert({q0, q1});
-
     //Get new initial state.
     New_Q_t new_initial_state = { M0.initial_state(),
                                   M1.initial_state() };
 
-    //Get new delta.
+    std::unordered_set< New_Q_t > new_states = { new_initial_state };
+    std::unordered_set< New_Q_t > new_accept_states;
     New_D_t new_delta;
-    for (const New_Q_t & q : new_states)
-    {
-        Q_t0 old_q0 = q.first, next_q0;
-        Q_t1 old_q1 = q.second, next_q1;
-        for (const S_t & c : M0.sigma())
-        {
-            next_q0 = M0.delta().find({old_q0, c})->second;
-            next_q1 = M1.delta().find({old_q1, c})->second;
 
-            new_delta[{q, c}] = {next_q0, next_q1};
-        }
+    //States that can still accept, for the missing transitions.
+    std::unordered_set< Q_t0 > live0;
+    std::unordered_set< Q_t1 > live1;
+    if (op != DFA_INTERSECTION)
+    {
+        live0 = M0.live_states();
+        live1 = M1.live_states();
     }
 
-    std::unordered_set< New_Q_t > new_accept_states;
-    for (const New_Q_t & q : new_states)
+    std::stack< New_Q_t > to_eval; to_eval.push(new_initial_state);
+    while (!to_eval.empty())
     {
-        Q_t0 q0 = q.first;
-        if (M0.is_accepting(q0))
+        New_Q_t q = to_eval.top();
+        to_eval.pop();
+
+        if (dfa_product_accepts(op,
+                                M0.is_accepting(q.first),
+                                M1.is_accepting(q.second)))
         {
             new_accept_states.insert(q);
-            continue;
         }
+        
+        for (const S_t & c : M0.sigma())
+        {
+            typename DFA< S_t, Q_t0 >::D_t::const_iterator it0 =
+                M0.delta().find({q.first, c});
+            typename DFA< S_t, Q_t1 >::D_t::const_iterator it1 =
+                M1.delta().find({q.second, c});
+            bool missing0 = it0 == M0.delta().end(),
+                missing1 = it1 == M1.delta().end();
+
+            //A missing transition goes to an implicit dead state. If
+            //the pair is dead too it is left out, otherwise the pair
+            //would need a dead state of the missing type. Once one
+            //side rejects everything, a union, a symmetric difference
+            //or a difference from the other side is dead with it.
+            if (missing0 || missing1)
+            {
+                bool other_dead = missing0 ?
+                    missing1 || live1.find(it1->second) == live1.end() :
+                    live0.find(it0->second) == live0.end();
+                if (op == DFA_INTERSECTION || other_dead ||
+                    (op == DFA_DIFFERENCE && missing0))
+                {
+                    continue;
+                }
+                throw DFA_Incomplete_Error();
+            }
+            
+            New_Q_t next = { it0->second, it1->second };
+            new_delta[{q, c}] = next;
 
-        Q_t1 q1 = q.second;
-        if (M1.is_accepting(q1))
-            new_accept_states.insert(q);
+            if (new_states.insert(next).second)
+                to_eval.push(next);
+        }
     }
 
     return DFA< S_t, New_Q_t >(M0.sigma(),
@@ -495,4 +929,96 @@ DFA< S_t, std::pair< Q_t0, Q_t1 > > dfa_intersection(
                                new_delta);
 }
 
+/*
+  Returns a DFA that is the interseciton of DFA M0 and M1.
+  DFA M0 and M1 MUST have exactly the same sigma.
+  Only the reachable pairs of states are constructed.
+*/
+template< typename S_t, typename Q_t0, typename Q_t1 >
+DFA< S_t, std::pair< Q_t0, Q_t1 > > dfa_intersection(
+    const DFA< S_t, Q_t0 > & M0,
+    const DFA< S_t, Q_t1 > & M1
+    )
+{
+    //Sigma must be the same for both DFA.
+    if (M0.sigma() != M1.sigma())
+        throw DFA_Sigma_Mismatch_Intersection_Error();
+
+    return dfa_product(M0, M1, DFA_INTERSECTION);
+}
+
+// Returns a DFA that is the union of DFA M0 and M1.
+template< typename S_t, typename Q_t0, typename Q_t1 >
+DFA< S_t, std::pair< Q_t0, Q_t1 > > dfa_union(
+    const DFA< S_t, Q_t0 > & M0,
+    const DFA< S_t, Q_t1 > & M1
+    )
+{ return dfa_product(M0, M1, DFA_UNION); }
+
+// Returns a DFA accepting what DFA M0 accepts and M1 does not.
+template< typename S_t, typename Q_t0, typename Q_t1 >
+DFA< S_t, std::pair< Q_t0, Q_t1 > > dfa_difference(
+    const DFA< S_t, Q_t0 > & M0,
+    const DFA< S_t, Q_t1 > & M1
+    )
+{ return dfa_product(M0, M1, DFA_DIFFERENCE); }
+
+// Returns a DFA accepting what exactly one of DFA M0 and M1 accepts.
+template< typename S_t, typename Q_t0, typename Q_t1 >
+DFA< S_t, std::pair< Q_t0, Q_t1 > > dfa_symmetric_difference(
+    const DFA< S_t, Q_t0 > & M0,
+    const DFA< S_t, Q_t1 > & M1
+    )
+{ return dfa_product(M0, M1, DFA_SYMMETRIC_DIFFERENCE); }
+
+/*
+  Returns true if DFA M0 and M1 accept the same language. Otherwise,
+  if counterexample is not null, it is set to a string accepted by
+  exactly one of them. Symbols missing from the sigma of one DFA are
+  rejected by it.
+*/
+template< typename S_t, typename Q_t0, typename Q_t1 >
+bool equivalent(const DFA< S_t, Q_t0 > & M0,
+                const DFA< S_t, Q_t1 > & M1,
+                std::vector< S_t > * counterexample = nullptr)
+{
+    typename DFA< S_t, Q_t0 >::Explorer E0(M0);
+    typename DFA< S_t, Q_t1 >::Explorer E1(M1);
+    return helper::explore_equivalent(E0, E1,
+                                      helper::symbol_union(M0.sigma(),
+                                                           M1.sigma()),
+                                      counterexample);
+}
+
+/*
+  Returns true if every string accepted by DFA M1 is accepted by M0.
+  Otherwise, if counterexample is not null, it is set to a shortest
+  string accepted by M1 but not by M0.
+*/
+template< typename S_t, typename Q_t0, typename Q_t1 >
+bool includes(const DFA< S_t, Q_t0 > & M0,
+              const DFA< S_t, Q_t1 > & M1,
+              std::vector< S_t > * counterexample = nullptr)
+{
+    typename DFA< S_t, Q_t0 >::Explorer E0(M0);
+    typename DFA< S_t, Q_t1 >::Explorer E1(M1);
+    return helper::explore_includes(E0, E1,
+                                    helper::symbol_union(M0.sigma(),
+                                                         M1.sigma()),
+                                    counterexample);
+}
+
+/*
+  Returns true if DFA M accepts no string at all. Otherwise, if
+  witness is not null, it is set to a shortest accepted string.
+*/
+template< typename S_t, typename Q_t >
+bool is_empty(const DFA< S_t, Q_t > & M,
+              std::vector< S_t > * witness = nullptr)
+{
+    typename DFA< S_t, Q_t >::Explorer E(M);
+    std::vector< S_t > sigma(M.sigma().begin(), M.sigma().end());
+    return helper::explore_is_empty(E, sigma, witness);
+}
+
 #endif
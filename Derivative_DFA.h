@@ -0,0 +1,1011 @@
+#ifndef DERIVATIVE_DFA_H
+#define DERIVATIVE_DFA_H
+
+#include "Common.h"
+#include "Byte_Set.h"
+#include "Byte_DFA.h"
+#include "Byte_NFA.h"
+#include "Concurrent.h"
+#include "Stats.h"
+
+#include <map>
+#include <mutex>
+
+namespace helper
+{
+    /*
+      Hash-consed regular expressions over bytes, with intersection and
+      complement, and their Brzozowski derivatives. The derivative of a
+      term by a byte matches the rest of every string the term matches
+      that starts with that byte:
+
+        d(class)     = epsilon if the class holds the byte, else emptyset
+        d(x y)       = d(x) y, or d(x) y | d(y) if x matches epsilon
+        d(x | y)     = d(x) | d(y)
+        d(x & y)     = d(x) & d(y)
+        d(~x)        = ~d(x)
+        d(x{m,n})    = d(x) x{m-1,n-1}
+
+      so terms are the states of a DFA, derivatives its transitions, and
+      a term accepts if it matches epsilon.
+
+      Every term is stored once and referred to by its id, so equal
+      terms have the same id. The constructors keep terms in a
+      canonical form, which is what bounds the number of distinct
+      derivatives of a term:
+
+        concatenation  is nested to the right, drops epsilon, is the
+                       emptyset if a part is, and (x | y) z is x z | y z,
+                       so that union sees alternatives with equal tails
+        union          is flattened, sorted, has no duplicates, merges
+                       its classes into one, drops the emptyset, and is
+                       everything if a part is
+        intersection   likewise, with everything and the emptyset
+                       swapped and classes merged by intersection
+        complement     of a complement is the term itself
+        repetition     x{m,n} is x{0,n} if x matches epsilon, x{1,1} is
+                       x, (x*){m,n} is x*, and at most 0 times is
+                       epsilon
+
+      Languages that are equal because of these rules get one term, so
+      the DFA of the derivatives is often close to minimal.
+    */
+    class Derivative_Terms
+    {
+    public:
+        enum Type
+        {
+            EMPTY,
+            EPSILON,
+            CLASS,
+            CONCATENATION,
+            UNION,
+            INTERSECTION,
+            COMPLEMENT,
+            REPETITION
+        };
+
+        struct Term
+        {
+            Type type;
+            Byte_Set symbols;            // CLASS
+            std::vector< int > children; // CONCATENATION (head, tail), UNION,
+                                         // INTERSECTION, COMPLEMENT, REPETITION
+            int min;                     // REPETITION
+            int max;                     // REPETITION, -1 when unbounded
+            bool nullable;               // Matches epsilon
+        };
+
+        static constexpr int empty = 0;
+        static constexpr int epsilon = 1;
+        static constexpr int everything = 2;
+
+        Derivative_Terms()
+            : bytes_(0)
+        {
+            intern(blank(EMPTY));
+            intern(blank(EPSILON));
+            Term all = blank(COMPLEMENT);
+            all.children.push_back(empty);
+            intern(all);
+        }
+
+        const Term & operator[](int t) const
+        { return terms_[t]; }
+
+        int size() const
+        { return terms_.size(); }
+
+        bool nullable(int t) const
+        { return terms_[t].nullable; }
+
+        // The strings of one byte of a set.
+        int symbols(const Byte_Set & set)
+        {
+            if (set.empty())
+                return empty;
+            Term t = blank(CLASS);
+            t.symbols = set;
+            return intern(t);
+        }
+
+        int concatenation(int a, int b)
+        {
+            if (a == empty || b == empty)
+                return empty;
+            if (a == epsilon)
+                return b;
+            if (b == epsilon)
+                return a;
+            if (terms_[a].type == UNION)
+            {
+                //Copied, terms_ grows while concatenating.
+                std::vector< int > parts = terms_[a].children;
+                for (int & part : parts)
+                    part = concatenation(part, b);
+                return alternation(parts);
+            }
+            if (terms_[a].type == CONCATENATION)
+            {
+                int head = terms_[a].children[0], tail = terms_[a].children[1];
+                return concatenation(head, concatenation(tail, b));
+            }
+
+            Term t = blank(CONCATENATION);
+            t.children = { a, b };
+            return intern(t);
+        }
+
+        int alternation(int a, int b)
+        { return alternation(std::vector< int >{ a, b }); }
+
+        int alternation(const std::vector< int > & parts)
+        { return combine(UNION, parts); }
+
+        int intersection(int a, int b)
+        { return intersection(std::vector< int >{ a, b }); }
+
+        int intersection(const std::vector< int > & parts)
+        { return combine(INTERSECTION, parts); }
+
+        int complement(int a)
+        {
+            if (terms_[a].type == COMPLEMENT)
+                return terms_[a].children[0];
+
+            Term t = blank(COMPLEMENT);
+            t.children.push_back(a);
+            return intern(t);
+        }
+
+        // a repeated from min to max times, max -1 for no bound.
+        int repetition(int a, int min, int max)
+        {
+            if (max == 0 || a == epsilon)
+                return epsilon;
+            if (a == empty)
+                return min == 0 ? epsilon : empty;
+            if (terms_[a].nullable)
+                min = 0;
+            if (min == 1 && max == 1)
+                return a;
+            const Term & x = terms_[a];
+            if (x.type == REPETITION && x.min == 0 && x.max == -1)
+                return a;
+
+            Term t = blank(REPETITION);
+            t.children.push_back(a);
+            t.min = min;
+            t.max = max;
+            return intern(t);
+        }
+
+        int star(int a)
+        { return repetition(a, 0, -1); }
+
+        // The derivative of a term by a byte.
+        int derivative(int t, uint8_t c)
+        {
+            uint64_t key = (uint64_t(t) << 8) | c;
+            std::unordered_map< uint64_t, int >::iterator it = derivatives_.find(key);
+            if (it != derivatives_.end())
+                return it->second;
+
+            //terms_ grows while deriving, so do not hold a reference.
+            Term term = terms_[t];
+            int ret = empty;
+            switch (term.type)
+            {
+            case EMPTY:
+            case EPSILON:
+                break;
+
+            case CLASS:
+                ret = term.symbols.contains(c) ? epsilon : empty;
+                break;
+
+            case CONCATENATION:
+            {
+                int head = term.children[0], tail = term.children[1];
+                ret = concatenation(derivative(head, c), tail);
+                if (terms_[head].nullable)
+                    ret = alternation(ret, derivative(tail, c));
+                break;
+            }
+
+            case UNION:
+            case INTERSECTION:
+            {
+                std::vector< int > parts;
+                for (const int & child : term.children)
+                    parts.push_back(derivative(child, c));
+                ret = combine(term.type, parts);
+                break;
+            }
+
+            case COMPLEMENT:
+                ret = complement(derivative(term.children[0], c));
+                break;
+
+            case REPETITION:
+            {
+                int x = term.children[0];
+                int rest = repetition(x, std::max(term.min - 1, 0),
+                                      term.max < 0 ? -1 : term.max - 1);
+                ret = concatenation(derivative(x, c), rest);
+                break;
+            }
+            }
+
+            derivatives_[key] = ret;
+            bytes_ += 4 * sizeof(uint64_t);
+            return ret;
+        }
+
+        /*
+          Adds term t of another store, and the terms under it, to this
+          one and returns its id here.
+        */
+        int import(const Derivative_Terms & from, int t)
+        {
+            std::unordered_map< int, int > imported = {
+                {empty, empty}, {epsilon, epsilon}, {everything, everything} };
+            std::vector< int > check_stack(1, t);
+            while (!check_stack.empty())
+            {
+                int u = check_stack.back();
+                if (imported.count(u))
+                {
+                    check_stack.pop_back();
+                    continue;
+                }
+
+                //Children first, then the term with their new ids.
+                Term term = from[u];
+                bool ready = true;
+                for (int & child : term.children)
+                {
+                    std::unordered_map< int, int >::iterator it = imported.find(child);
+                    if (it == imported.end())
+                    {
+                        check_stack.push_back(child);
+                        ready = false;
+                    }
+                    else if (ready)
+                        child = it->second;
+                }
+                if (ready)
+                {
+                    imported[u] = intern(term);
+                    check_stack.pop_back();
+                }
+            }
+            return imported[t];
+        }
+
+        /*
+          Builds into N the states matching what term t matches, and
+          returns whether it could: intersections and complements have
+          no NFA. The NFA shares the states of a term followed by the
+          same rest, so it stays about as small as the terms.
+        */
+        bool to_nfa(int t, NFA< uint8_t, uint32_t > & N) const
+        {
+            std::vector< int > check_stack(1, t);
+            std::vector< uint8_t > seen(terms_.size(), 0);
+            while (!check_stack.empty())
+            {
+                const Term & term = terms_[check_stack.back()];
+                check_stack.pop_back();
+                if (term.type == INTERSECTION || term.type == COMPLEMENT)
+                    return false;
+                for (const int & child : term.children)
+                {
+                    if (!seen[child])
+                    {
+                        seen[child] = 1;
+                        check_stack.push_back(child);
+                    }
+                }
+            }
+
+            std::map< std::pair< int, uint32_t >, uint32_t > built;
+            uint32_t accept = N.add_state();
+            N.set_initial_state(nfa_state(t, accept, N, built));
+            N.set_accepting(accept);
+            return true;
+        }
+
+        /*
+          Byte classes of a term: bytes no class of the term tells apart.
+          Derivatives only combine the classes of the term, so the
+          classes hold for every derivative too.
+        */
+        Byte_Classes classes(int t) const
+        {
+            Byte_Classes ret;
+            std::vector< uint8_t > seen(terms_.size(), 0);
+            std::vector< int > check_stack(1, t);
+            seen[t] = 1;
+            while (!check_stack.empty())
+            {
+                const Term & term = terms_[check_stack.back()];
+                check_stack.pop_back();
+                if (term.type == CLASS)
+                    ret.refine(term.symbols);
+                for (const int & child : term.children)
+                {
+                    if (!seen[child])
+                    {
+                        seen[child] = 1;
+                        check_stack.push_back(child);
+                    }
+                }
+            }
+            return ret;
+        }
+
+        /*
+          Lengths of the shortest and longest strings term t matches,
+          unbounded as in DFA_Analysis when there is none. Exact for
+          terms with no intersection or complement, bounds otherwise:
+          the shortest is at least min and the longest at most max.
+        */
+        void lengths(int t, size_t & min, size_t & max) const
+        {
+            std::vector< std::pair< size_t, size_t > > found(terms_.size());
+            std::vector< uint8_t > done(terms_.size(), 0);
+            std::pair< size_t, size_t > ret = lengths(t, found, done);
+            min = ret.first;
+            max = ret.second;
+            return;
+        }
+
+        // Bytes held by the terms and the derivatives found so far.
+        size_t memory_bytes() const
+        { return bytes_; }
+
+    private:
+        static Term blank(Type type)
+        {
+            Term t;
+            t.type = type;
+            t.min = 0;
+            t.max = 0;
+            t.nullable = false;
+            return t;
+        }
+
+        // Sum, and product, of lengths that may be unbounded.
+        static size_t add(size_t a, size_t b)
+        {
+            const size_t unbounded = DFA_Analysis::unbounded;
+            return a == unbounded || b == unbounded ? unbounded : a + b;
+        }
+        static size_t times(size_t a, int m)
+        {
+            const size_t unbounded = DFA_Analysis::unbounded;
+            return a == unbounded ? (m == 0 ? 0 : unbounded) : a * m;
+        }
+
+        std::pair< size_t, size_t > lengths(
+            int t, std::vector< std::pair< size_t, size_t > > & found,
+            std::vector< uint8_t > & done) const
+        {
+            const size_t unbounded = DFA_Analysis::unbounded;
+            if (done[t])
+                return found[t];
+
+            const Term & term = terms_[t];
+            std::vector< std::pair< size_t, size_t > > parts;
+            for (const int & child : term.children)
+                parts.push_back(lengths(child, found, done));
+
+            std::pair< size_t, size_t > ret = {unbounded, unbounded};
+            switch (term.type)
+            {
+            case EMPTY:
+                break;
+
+            case EPSILON:
+                ret = {0, 0};
+                break;
+
+            case CLASS:
+                ret = {1, 1};
+                break;
+
+            case CONCATENATION:
+                ret = {add(parts[0].first, parts[1].first),
+                       add(parts[0].second, parts[1].second)};
+                break;
+
+            case UNION:
+                ret = {unbounded, 0};
+                for (const std::pair< size_t, size_t > & p : parts)
+                {
+                    ret.first = std::min(ret.first, p.first);
+                    ret.second = std::max(ret.second, p.second);
+                }
+                break;
+
+            case INTERSECTION:
+                ret = {0, unbounded};
+                for (const std::pair< size_t, size_t > & p : parts)
+                {
+                    ret.first = std::max(ret.first, p.first);
+                    ret.second = std::min(ret.second, p.second);
+                }
+                break;
+
+            case COMPLEMENT:
+                ret = {term.nullable ? 0 : 1, unbounded};
+                break;
+
+            case REPETITION:
+                ret = {times(parts[0].first, term.min),
+                       term.max < 0 ? unbounded : times(parts[0].second, term.max)};
+                break;
+            }
+
+            done[t] = 1;
+            found[t] = ret;
+            return ret;
+        }
+
+        /*
+          Returns the first state of the states matching term t and
+          then going to state next, adding them to N unless built
+          already has them.
+        */
+        uint32_t nfa_state(int t, uint32_t next, NFA< uint8_t, uint32_t > & N,
+                           std::map< std::pair< int, uint32_t >, uint32_t > & built) const
+        {
+            std::map< std::pair< int, uint32_t >, uint32_t >::iterator it =
+                built.find({t, next});
+            if (it != built.end())
+                return it->second;
+
+            const Term & term = terms_[t];
+            uint32_t q = next;
+            switch (term.type)
+            {
+            case EMPTY:
+                q = N.add_state();
+                break;
+
+            case EPSILON:
+                break;
+
+            case CLASS:
+                q = N.add_state();
+                N.add_transition(q, term.symbols, next);
+                break;
+
+            case CONCATENATION:
+                q = nfa_state(term.children[1], next, N, built);
+                q = nfa_state(term.children[0], q, N, built);
+                break;
+
+            case UNION:
+                q = N.add_state();
+                for (const int & child : term.children)
+                    N.add_epsilon(q, nfa_state(child, next, N, built));
+                break;
+
+            case REPETITION:
+            {
+                //x{m,n} is x m times, then n - m optional x or a loop.
+                int x = term.children[0];
+                if (term.max < 0)
+                {
+                    q = N.add_state();
+                    N.add_epsilon(q, next);
+                    N.add_epsilon(q, nfa_state(x, q, N, built));
+                }
+                for (int i = term.min; i < term.max; ++i)
+                {
+                    uint32_t optional = N.add_state();
+                    N.add_epsilon(optional, next);
+                    N.add_epsilon(optional, nfa_state(x, q, N, built));
+                    q = optional;
+                }
+                for (int i = 0; i < term.min; ++i)
+                    q = nfa_state(x, q, N, built);
+                break;
+            }
+
+            case INTERSECTION:
+            case COMPLEMENT:
+                break;
+            }
+
+            built[{t, next}] = q;
+            return q;
+        }
+
+        // Union or intersection of terms, in canonical form.
+        int combine(Type type, const std::vector< int > & parts)
+        {
+            //The term that absorbs the others, and the one that
+            //disappears among them.
+            int absorbing = type == UNION ? everything : empty;
+            int neutral = type == UNION ? empty : everything;
+
+            std::vector< int > children;
+            Byte_Set set;
+            bool classes = false;
+            for (const int & part : parts)
+            {
+                std::vector< int > flat(1, part);
+                if (terms_[part].type == type)
+                    flat = terms_[part].children;
+                for (const int & child : flat)
+                {
+                    if (child == absorbing)
+                        return absorbing;
+                    if (child == neutral)
+                        continue;
+                    if (terms_[child].type != CLASS)
+                    {
+                        children.push_back(child);
+                        continue;
+                    }
+                    if (!classes)
+                        set = terms_[child].symbols;
+                    else if (type == UNION)
+                        set |= terms_[child].symbols;
+                    else
+                        set &= terms_[child].symbols;
+                    classes = true;
+                }
+            }
+            if (classes)
+            {
+                int merged = symbols(set);
+                if (merged == absorbing)
+                    return absorbing;
+                children.push_back(merged);
+            }
+
+            std::sort(children.begin(), children.end());
+            children.erase(std::unique(children.begin(), children.end()),
+                           children.end());
+            if (children.empty())
+                return neutral;
+            if (children.size() == 1)
+                return children[0];
+
+            //epsilon & x is epsilon if x matches epsilon, else emptyset.
+            if (type == INTERSECTION &&
+                std::binary_search(children.begin(), children.end(), int(epsilon)))
+            {
+                for (const int & child : children)
+                    if (!terms_[child].nullable)
+                        return empty;
+                return epsilon;
+            }
+
+            Term t = blank(type);
+            t.children = children;
+            return intern(t);
+        }
+
+        int intern(Term term)
+        {
+            switch (term.type)
+            {
+            case EMPTY:
+            case CLASS:
+                term.nullable = false;
+                break;
+            case EPSILON:
+                term.nullable = true;
+                break;
+            case CONCATENATION:
+            case INTERSECTION:
+                term.nullable = true;
+                for (const int & child : term.children)
+                    term.nullable = term.nullable && terms_[child].nullable;
+                break;
+            case UNION:
+                term.nullable = false;
+                for (const int & child : term.children)
+                    term.nullable = term.nullable || terms_[child].nullable;
+                break;
+            case COMPLEMENT:
+                term.nullable = !terms_[term.children[0]].nullable;
+                break;
+            case REPETITION:
+                term.nullable = term.min == 0 || terms_[term.children[0]].nullable;
+                break;
+            }
+
+            uint64_t h = term.type;
+            auto mix = [&](uint64_t x) { h = (h ^ x) * 0x9e3779b97f4a7c15ULL; };
+            for (int i = 0; i < 4; ++i)
+                mix(term.symbols.word(i));
+            mix((uint64_t(uint32_t(term.min)) << 32) | uint32_t(term.max));
+            for (const int & child : term.children)
+                mix(child);
+
+            auto range = ids_.equal_range(h);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                const Term & other = terms_[it->second];
+                if (other.type == term.type && other.symbols == term.symbols &&
+                    other.min == term.min && other.max == term.max &&
+                    other.children == term.children)
+                    return it->second;
+            }
+
+            terms_.push_back(term);
+            ids_.insert({h, int(terms_.size()) - 1});
+            bytes_ += sizeof(Term) + term.children.size() * sizeof(int) +
+                4 * sizeof(uint64_t);
+            return terms_.size() - 1;
+        }
+
+        std::vector< Term > terms_;
+        std::unordered_multimap< uint64_t, int > ids_;
+        std::unordered_map< uint64_t, int > derivatives_;
+
+        //Running total of memory_bytes().
+        size_t bytes_;
+    };
+}
+
+/*
+  DFA whose states are the derivatives of a term (see Derivative_Terms
+  above), built lazily as matching first needs them, with no NFA and no
+  subset construction. The state of a term goes on a byte class to the
+  state of its derivative by any byte of the class. Intersections and
+  complements are states like any other, so this is also the engine
+  for expressions that use them:
+
+    helper::Derivative_Terms T;
+    int t = T.intersection(a.derivative_term(T),
+                           T.complement(b.derivative_term(T)));
+    Derivative_DFA D(T, t);
+
+  matches what Regex a matches and Regex b does not. Complements are
+  taken over strings of bytes.
+
+  States are reached through handles, as in Lazy_DFA: the address of
+  the row of transitions of the state, with the lowest bit set if the
+  state is accepting, so a built transition is one atomic load and
+  threads can match at the same time. A missing transition is built
+  under a lock, since taking a derivative adds to the store of terms,
+  so threads only wait on each other while states are discovered.
+
+  The memory of the states and terms can be bounded, and is checked
+  before each derivative is taken. Past the limit no more states or
+  terms are built, the store of terms no longer changes and matching
+  takes no lock. Like Lazy_DFA, it runs an NFA instead, built from the
+  term the first time it is needed. Terms with intersections or
+  complements have no NFA; their matches take the derivatives of the
+  rest of the string in a store of their own, dropped afterwards. Every
+  match that falls back is counted by fallbacks().
+*/
+class Derivative_DFA
+{
+public:
+    static constexpr uint32_t dead_state = 0;
+
+    typedef uintptr_t State;
+
+    // Returned by next_state() when the memory limit is reached.
+    static constexpr State over_limit = 0;
+
+    /*
+      The DFA of term t of a store of terms, which is copied. The dead
+      and initial states are always built.
+    */
+    Derivative_DFA(const helper::Derivative_Terms & terms, int t,
+                   size_t memory_limit = 0)
+        : terms_(terms),
+          classes_(terms_.classes(t)),
+          num_classes_(classes_.size()),
+          shift_(row_shift(num_classes_ + 1)),
+          rows_(size_t(64) << shift_),
+          accept_(64),
+          full_(false),
+          N_(nullptr),
+          memory_limit_(0)
+    {
+        for (int k = 0; k < num_classes_; ++k)
+            representatives_.push_back(classes_.representative(k));
+
+        size_ = 0;
+        dead_ = handle(intern(helper::Derivative_Terms::empty));
+        for (int k = 0; k < num_classes_; ++k)
+            row(dead_)[k].store(dead_, std::memory_order_relaxed);
+        initial_state_ = handle(intern(t));
+        terms_.lengths(t, min_length_, max_length_);
+        fallbacks_ = 0;
+        memory_limit_ = memory_limit;
+
+        return;
+    }
+
+    Derivative_DFA(const Derivative_DFA &) = delete;
+    Derivative_DFA & operator=(const Derivative_DFA &) = delete;
+
+    ~Derivative_DFA()
+    {
+        delete N_.load();
+        return;
+    }
+
+    State initial_state() const
+    { return initial_state_; }
+
+    static bool is_accepting(State q)
+    { return q & 1; }
+
+    bool is_dead(State q) const
+    { return q == dead_; }
+
+    // Number of the state of a handle.
+    static uint32_t id(State q)
+    { return uint32_t(row(q)[-1].load(std::memory_order_relaxed) >> 32); }
+
+    // Term of the state of a handle.
+    static int term(State q)
+    { return int(uint32_t(row(q)[-1].load(std::memory_order_relaxed))); }
+
+    /*
+      Returns the state q goes to on c, building it if needed, or
+      over_limit if it would take the memory past the limit.
+    */
+    State next_state(State q, uint8_t c) const
+    {
+        uint32_t k = classes_[c];
+        State r = row(q)[k].load(std::memory_order_acquire);
+        if (r == 0)
+            r = full_.load(std::memory_order_acquire) ? over_limit : build(q, k);
+        return r;
+    }
+
+    // Returns true if this DFA accepts the given string of bytes.
+    bool operator()(const uint8_t * str, size_t n) const
+    {
+        State state = initial_state_;
+        for (size_t i = 0; i < n && state != dead_; ++i)
+        {
+            State next = next_state(state, str[i]);
+            if (next == over_limit)
+            {
+                fallbacks_.fetch_add(1, std::memory_order_relaxed);
+                const NFA< uint8_t, uint32_t > * N = nfa();
+                if (N != nullptr)
+                    return (*N)(str, n);
+                return derive(term(state), str + i, n - i);
+            }
+            state = next;
+        }
+        return is_accepting(state);
+    }
+
+    bool operator()(const std::string & str) const
+    { return operator()((const uint8_t *)str.data(), str.size()); }
+
+    /*
+      Returns the whole DFA as a byte DFA, building every state that
+      can be reached. Throws NFA_To_DFA_Memory_Limit_Error if that
+      would go over the memory limit.
+    */
+    DFA< uint8_t, uint32_t > to_dfa() const
+    {
+        std::vector< State > states(1, dead_);
+        std::unordered_map< State, uint32_t > index = { {dead_, dead_state} };
+        std::vector< uint32_t > table(num_classes_, dead_state);
+        std::vector< uint8_t > accept(1, 0);
+
+        index[initial_state_] = states.size();
+        states.push_back(initial_state_);
+        for (size_t i = 1; i < states.size(); ++i)
+        {
+            State q = states[i];
+            accept.push_back(is_accepting(q));
+            table.resize(table.size() + num_classes_, dead_state);
+            for (int k = 0; k < num_classes_; ++k)
+            {
+                State r = next_state(q, representatives_[k]);
+                if (r == over_limit)
+                    throw NFA_To_DFA_Memory_Limit_Error();
+
+                std::unordered_map< State, uint32_t >::iterator it = index.find(r);
+                if (it == index.end())
+                {
+                    it = index.insert({r, uint32_t(states.size())}).first;
+                    states.push_back(r);
+                }
+                table[i * num_classes_ + k] = it->second;
+            }
+        }
+
+        return DFA< uint8_t, uint32_t >(classes_, table, accept,
+                                        index[initial_state_]);
+    }
+
+    // Number of matches that took derivatives because of the memory limit.
+    size_t fallbacks() const
+    { return fallbacks_.load(std::memory_order_relaxed); }
+
+    size_t memory_limit() const
+    { return memory_limit_; }
+
+    // Number of states built so far, including the dead state.
+    uint32_t size() const
+    { return size_.load(std::memory_order_acquire); }
+
+    const Byte_Classes & classes() const
+    { return classes_; }
+
+    // Lengths of the shortest and longest accepted strings, as found
+    // by Derivative_Terms::lengths().
+    size_t min_length() const
+    { return min_length_; }
+    size_t max_length() const
+    { return max_length_; }
+
+    // Bytes held by the states built so far and their terms.
+    size_t memory_bytes() const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        return bytes();
+    }
+
+private:
+    // Rows hold 2^shift entries: one transition per class, then the
+    // number and term of the state. A handle points just past them.
+    static int row_shift(int entries)
+    {
+        int ret = 0;
+        while ((1 << ret) < entries)
+            ++ret;
+        return ret;
+    }
+
+    static std::atomic< State > * row(State q)
+    { return (std::atomic< State > *)(q & ~State(1)); }
+
+    State handle(uint32_t q) const
+    {
+        std::atomic< State > & first = rows_[(size_t(q) << shift_) + 1];
+        return State(&first) | accept_[q];
+    }
+
+    // Bytes held by the states and terms. The lock must be held.
+    size_t bytes() const
+    {
+        return rows_.memory_bytes() + accept_.memory_bytes() +
+            terms_.memory_bytes() + ids_.size() * 4 * sizeof(uint64_t);
+    }
+
+    /*
+      Builds and stores the transition of q on class k, or returns
+      over_limit, for good, once the memory is past the limit. The
+      store of terms only changes below this, under the lock, before
+      full_ is set.
+    */
+    State build(State from, uint32_t k) const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        State r = row(from)[k].load(std::memory_order_relaxed);
+        if (r != 0)
+            return r;
+        if (full_.load(std::memory_order_relaxed))
+            return over_limit;
+        if (memory_limit_ != 0 && bytes() > memory_limit_)
+        {
+            full_.store(true, std::memory_order_release);
+            return over_limit;
+        }
+
+        uint32_t q = intern(terms_.derivative(term(from), representatives_[k]));
+        if (q == helper::Concurrent_Id_Table::none)
+        {
+            full_.store(true, std::memory_order_release);
+            return over_limit;
+        }
+        r = handle(q);
+        row(from)[k].store(r, std::memory_order_release);
+        return r;
+    }
+
+    /*
+      Returns the state of a term, creating it if needed, or none if
+      creating it would go over the memory limit. The lock must be
+      held, except while constructing.
+    */
+    uint32_t intern(int t) const
+    {
+        std::unordered_map< int, uint32_t >::iterator it = ids_.find(t);
+        if (it != ids_.end())
+            return it->second;
+
+        if (memory_limit_ != 0 && bytes() > memory_limit_)
+            return helper::Concurrent_Id_Table::none;
+
+        //Fill in the state before anyone can see its number.
+        uint32_t id = size_.load(std::memory_order_relaxed);
+        accept_.at(id) = terms_.nullable(t);
+        size_t first = size_t(id) << shift_;
+        rows_.at(first).store((State(id) << 32) | uint32_t(t),
+                              std::memory_order_relaxed);
+        for (int k = 1; k < (1 << shift_); ++k)
+            rows_.at(first + k).store(0, std::memory_order_relaxed);
+        ids_[t] = id;
+        size_.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    /*
+      Returns the NFA of the initial term, building it the first time,
+      or nullptr if the term has none. Only called past the limit, when
+      the store of terms no longer changes.
+    */
+    const NFA< uint8_t, uint32_t > * nfa() const
+    {
+        NFA< uint8_t, uint32_t > * N = N_.load(std::memory_order_acquire);
+        if (N != nullptr)
+            return N->size() != 0 ? N : nullptr;
+
+        //An NFA with no states stands for a term with no NFA.
+        NFA< uint8_t, uint32_t > * created = new NFA< uint8_t, uint32_t >;
+        if (!terms_.to_nfa(term(initial_state_), *created))
+            *created = NFA< uint8_t, uint32_t >();
+
+        //Threads racing to create it keep the first one published.
+        if (!N_.compare_exchange_strong(N, created, std::memory_order_acq_rel))
+        {
+            delete created;
+            created = N;
+        }
+        return created->size() != 0 ? created : nullptr;
+    }
+
+    /*
+      Matches the rest of a string on the derivatives of a term, taken
+      in a store of this match's own so the shared one stays as it is
+      and no lock is needed.
+    */
+    bool derive(int t, const uint8_t * str, size_t n) const
+    {
+        helper::Derivative_Terms own;
+        t = own.import(terms_, t);
+        for (size_t i = 0; i < n && t != helper::Derivative_Terms::empty; ++i)
+            t = own.derivative(t, str[i]);
+        return own.nullable(t);
+    }
+
+    mutable helper::Derivative_Terms terms_;
+    Byte_Classes classes_;
+    int num_classes_;
+    int shift_;
+    State initial_state_;
+    State dead_;
+    std::vector< uint8_t > representatives_;
+
+    mutable helper::Segmented_Array< std::atomic< State > > rows_;
+    mutable helper::Segmented_Array< uint8_t > accept_;
+    mutable std::atomic< uint32_t > size_;
+
+    //State of each term, and the lock that guards building states.
+    mutable std::unordered_map< int, uint32_t > ids_;
+    mutable std::mutex mutex_;
+
+    //Set once the memory is past the limit, after which no state is
+    //built, and the NFA matches fall back to.
+    mutable std::atomic< bool > full_;
+    mutable std::atomic< NFA< uint8_t, uint32_t > * > N_;
+
+    size_t min_length_;
+    size_t max_length_;
+    size_t memory_limit_;
+    mutable std::atomic< size_t > fallbacks_;
+};
+
+#endif
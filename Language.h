@@ -0,0 +1,418 @@
+#ifndef LANGUAGE_H
+#define LANGUAGE_H
+
+#include "Common.h"
+
+/*
+  Language checks shared by the automata: static analysis of a DFA,
+  equivalence, inclusion and emptiness.
+
+  The checks work on explorers rather than on automata. An explorer
+  numbers the states of a deterministic automaton as they are reached
+  and provides
+
+    initial_state()
+    next_state(q, c)
+    is_accepting(q)
+
+  where state 0 is a sink that accepts nothing. A DFA explorer indexes
+  its table, while an NFA explorer builds its subsets one at a time, so
+  only the part of the subset construction a check visits is built.
+  Every check stops as soon as its answer is known.
+*/
+namespace helper
+{
+    /*
+      What is known about the states of a deterministic automaton
+      before reading any input:
+
+        REJECTS  no accepting state can be reached (dead states).
+        ACCEPTS  every state that can be reached accepts and has every
+                 transition, so every continuation is accepted.
+
+      and the lengths of the shortest and longest accepted strings.
+      Matching can stop in a decided state, and reject a string whose
+      length is out of bounds without reading it.
+    */
+    struct DFA_Analysis
+    {
+        enum Status { UNDECIDED = 0, REJECTS = 1, ACCEPTS = 2 };
+
+        static constexpr size_t unbounded = size_t(-1);
+
+        // Returns true if a string of length n could be accepted.
+        bool length_possible(size_t n) const
+        { return n >= min_length && (max_length == unbounded || n <= max_length); }
+
+        std::vector< uint8_t > status;
+
+        // Unbounded when nothing is accepted.
+        size_t min_length;
+
+        // Unbounded when the accepted strings can be arbitrarily long.
+        size_t max_length;
+    };
+
+    /*
+      Analyzes a deterministic automaton with states 0 to n - 1.
+      successors(q, out) must append the state q goes to on each symbol
+      to out, or -1 for each missing transition.
+
+      Dead states and always accepting states are found by searching
+      backwards from the accepting states and from the states that can
+      reject. The minimum length is a search from the initial state,
+      and the maximum length the longest path through the states that
+      are both reachable and not dead, unbounded if they hold a cycle.
+    */
+    template< typename Successors >
+    DFA_Analysis analyze_dfa(int n, int initial_state,
+                             const std::vector< uint8_t > & accept,
+                             Successors successors)
+    {
+        DFA_Analysis ret;
+
+        //Forward and reverse edges. A state with a missing transition
+        //can reject.
+        std::vector< std::vector< int > > out(n), in(n);
+        std::vector< uint8_t > can_reject(n, 0), live(n, 0);
+        std::vector< int > check_stack, next;
+        for (int q = 0; q < n; ++q)
+        {
+            next.clear();
+            successors(q, next);
+            for (const int & r : next)
+            {
+                if (r < 0)
+                    can_reject[q] = 1;
+                else
+                {
+                    out[q].push_back(r);
+                    in[r].push_back(q);
+                }
+            }
+        }
+
+        //Search backwards, marking every state that can reach a
+        //marked state.
+        auto mark_backwards = [&](std::vector< uint8_t > & marks)
+        {
+            for (int q = 0; q < n; ++q)
+                if (marks[q])
+                    check_stack.push_back(q);
+            while (!check_stack.empty())
+            {
+                int q = check_stack.back();
+                check_stack.pop_back();
+                for (const int & r : in[q])
+                {
+                    if (!marks[r])
+                    {
+                        marks[r] = 1;
+                        check_stack.push_back(r);
+                    }
+                }
+            }
+        };
+
+        for (int q = 0; q < n; ++q)
+        {
+            live[q] = accept[q];
+            can_reject[q] = can_reject[q] || !accept[q];
+        }
+        mark_backwards(live);
+        mark_backwards(can_reject);
+
+        ret.status.assign(n, DFA_Analysis::UNDECIDED);
+        for (int q = 0; q < n; ++q)
+        {
+            if (!live[q])
+                ret.status[q] = DFA_Analysis::REJECTS;
+            else if (!can_reject[q])
+                ret.status[q] = DFA_Analysis::ACCEPTS;
+        }
+
+        ret.min_length = ret.max_length = DFA_Analysis::unbounded;
+        if (!live[initial_state])
+            return ret;
+
+        //Shortest accepted string, by a breadth first search.
+        std::vector< size_t > distance(n, DFA_Analysis::unbounded);
+        std::vector< int > queue = { initial_state };
+        distance[initial_state] = 0;
+        for (size_t i = 0; i < queue.size(); ++i)
+        {
+            int q = queue[i];
+            if (accept[q])
+            {
+                ret.min_length = distance[q];
+                break;
+            }
+            for (const int & r : out[q])
+            {
+                if (distance[r] == DFA_Analysis::unbounded)
+                {
+                    distance[r] = distance[q] + 1;
+                    queue.push_back(r);
+                }
+            }
+        }
+
+        //Longest accepted string, by a depth first search over the live
+        //states that computes the longest path from each state once all
+        //of its successors are done. Meeting a state still on the stack
+        //means a cycle.
+        std::vector< uint8_t > color(n, 0);
+        std::vector< size_t > longest(n, 0);
+        std::vector< std::pair< int, size_t > > stack = { {initial_state, 0} };
+        color[initial_state] = 1;
+        while (!stack.empty())
+        {
+            int q = stack.back().first;
+            size_t & e = stack.back().second;
+            if (e < out[q].size())
+            {
+                int r = out[q][e++];
+                if (!live[r])
+                    continue;
+                if (color[r] == 1)
+                    return ret;
+                if (color[r] == 0)
+                {
+                    color[r] = 1;
+                    stack.push_back({r, 0});
+                }
+                continue;
+            }
+
+            //Every successor is done. Live states with no live
+            //successor are accepting, so 0 is a valid length for them.
+            size_t length = 0;
+            for (const int & r : out[q])
+                if (live[r])
+                    length = std::max(length, longest[r] + 1);
+            longest[q] = length;
+            color[q] = 2;
+            stack.pop_back();
+        }
+        ret.max_length = longest[initial_state];
+
+        return ret;
+    }
+
+    // Union-find over the integers, growing as larger ones are used.
+    class Disjoint_Sets
+    {
+    public:
+        int find(int x)
+        {
+            grow(x);
+            while (parent_[x] != x)
+            {
+                parent_[x] = parent_[parent_[x]];
+                x = parent_[x];
+            }
+            return x;
+        }
+
+        // Merges the sets of x and y. Returns false if they already
+        // were the same set.
+        bool unite(int x, int y)
+        {
+            x = find(x);
+            y = find(y);
+            if (x == y)
+                return false;
+
+            if (rank_[x] < rank_[y])
+                std::swap(x, y);
+            parent_[y] = x;
+            if (rank_[x] == rank_[y])
+                ++rank_[x];
+
+            return true;
+        }
+
+    private:
+        void grow(int x)
+        {
+            while ((int)parent_.size() <= x)
+            {
+                parent_.push_back(parent_.size());
+                rank_.push_back(0);
+            }
+        }
+
+        std::vector< int > parent_;
+        std::vector< uint8_t > rank_;
+    };
+
+    /*
+      A step of a search over pairs of states. Each step records the
+      step it was reached from and the symbol taken, so the string
+      leading to it can be rebuilt.
+    */
+    struct Pair_Step
+    {
+        int q0;
+        int q1;
+        int parent;
+        int symbol;
+    };
+
+    // Writes the string leading to steps[i] to ret, if ret is not null.
+    template< typename S_t >
+    void rebuild_string(const std::vector< Pair_Step > & steps, int i,
+                        const std::vector< S_t > & sigma,
+                        std::vector< S_t > * ret)
+    {
+        if (ret == nullptr)
+            return;
+
+        ret->clear();
+        for (; steps[i].parent >= 0; i = steps[i].parent)
+            ret->push_back(sigma[steps[i].symbol]);
+        std::reverse(ret->begin(), ret->end());
+
+        return;
+    }
+
+    // Returns the symbols of two alphabets, each symbol once.
+    template< typename S_t >
+    std::vector< S_t > symbol_union(const std::unordered_set< S_t > & a,
+                                    const std::unordered_set< S_t > & b)
+    {
+        std::vector< S_t > ret(a.begin(), a.end());
+        for (const S_t & c : b)
+            if (a.find(c) == a.end())
+                ret.push_back(c);
+        return ret;
+    }
+
+    /*
+      Hopcroft-Karp equivalence check. The pair of initial states is
+      put in one class of a union-find, then every pair reached from a
+      pair is merged too. A pair whose states already are in the same
+      class is not explored again, so at most |Q0| + |Q1| pairs are
+      visited instead of |Q0| * |Q1|.
+
+      Returns false at the first pair where one state accepts and the
+      other does not, writing a string accepted by exactly one of the
+      two automata to counterexample.
+    */
+    template< typename S_t, typename E0, typename E1 >
+    bool explore_equivalent(E0 & M0, E1 & M1,
+                            const std::vector< S_t > & sigma,
+                            std::vector< S_t > * counterexample)
+    {
+        //States of M0 are the even numbers, states of M1 the odd ones.
+        Disjoint_Sets sets;
+        std::vector< Pair_Step > steps;
+        steps.push_back({ (int)M0.initial_state(), (int)M1.initial_state(),
+                          -1, -1 });
+        sets.unite(2 * steps[0].q0, 2 * steps[0].q1 + 1);
+
+        for (int i = 0; i < (int)steps.size(); ++i)
+        {
+            Pair_Step s = steps[i];
+            if (M0.is_accepting(s.q0) != M1.is_accepting(s.q1))
+            {
+                rebuild_string(steps, i, sigma, counterexample);
+                return false;
+            }
+
+            for (int k = 0, n = sigma.size(); k < n; ++k)
+            {
+                int next0 = M0.next_state(s.q0, sigma[k]),
+                    next1 = M1.next_state(s.q1, sigma[k]);
+                if (sets.unite(2 * next0, 2 * next1 + 1))
+                    steps.push_back({ next0, next1, i, k });
+            }
+        }
+
+        return true;
+    }
+
+    /*
+      Inclusion check: searches the pairs of states reachable in the
+      product of M0 and M1 for a pair where M1 accepts and M0 does not.
+      Pairs where M1 is in its sink are not explored, since M1 accepts
+      nothing from there.
+
+      Returns true if every string M1 accepts is accepted by M0.
+      Otherwise writes a shortest string accepted by M1 but not by M0
+      to counterexample.
+    */
+    template< typename S_t, typename E0, typename E1 >
+    bool explore_includes(E0 & M0, E1 & M1,
+                          const std::vector< S_t > & sigma,
+                          std::vector< S_t > * counterexample)
+    {
+        std::unordered_set< uint64_t > seen;
+        std::vector< Pair_Step > steps;
+        steps.push_back({ (int)M0.initial_state(), (int)M1.initial_state(),
+                          -1, -1 });
+        seen.insert((uint64_t(steps[0].q0) << 32) | uint32_t(steps[0].q1));
+
+        for (int i = 0; i < (int)steps.size(); ++i)
+        {
+            Pair_Step s = steps[i];
+            if (s.q1 == 0)
+                continue;
+
+            if (M1.is_accepting(s.q1) && !M0.is_accepting(s.q0))
+            {
+                rebuild_string(steps, i, sigma, counterexample);
+                return false;
+            }
+
+            for (int k = 0, n = sigma.size(); k < n; ++k)
+            {
+                int next0 = M0.next_state(s.q0, sigma[k]),
+                    next1 = M1.next_state(s.q1, sigma[k]);
+                if (seen.insert((uint64_t(next0) << 32) | uint32_t(next1)).second)
+                    steps.push_back({ next0, next1, i, k });
+            }
+        }
+
+        return true;
+    }
+
+    /*
+      Emptiness check: searches the states reachable from the initial
+      state for an accepting one. Returns true if there is none.
+      Otherwise writes a shortest accepted string to witness.
+    */
+    template< typename S_t, typename E >
+    bool explore_is_empty(E & M,
+                          const std::vector< S_t > & sigma,
+                          std::vector< S_t > * witness)
+    {
+        std::unordered_set< int > seen = { (int)M.initial_state() };
+        std::vector< Pair_Step > steps;
+        steps.push_back({ (int)M.initial_state(), 0, -1, -1 });
+
+        for (int i = 0; i < (int)steps.size(); ++i)
+        {
+            Pair_Step s = steps[i];
+            if (s.q0 == 0)
+                continue;
+
+            if (M.is_accepting(s.q0))
+            {
+                rebuild_string(steps, i, sigma, witness);
+                return false;
+            }
+
+            for (int k = 0, n = sigma.size(); k < n; ++k)
+            {
+                int next = M.next_state(s.q0, sigma[k]);
+                if (seen.insert(next).second)
+                    steps.push_back({ next, 0, i, k });
+            }
+        }
+
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,342 @@
+#ifndef LAZY_DFA_H
+#define LAZY_DFA_H
+
+#include "Common.h"
+#include "Byte_Set.h"
+#include "Byte_NFA.h"
+#include "Concurrent.h"
+
+/*
+  DFA of a byte NFA whose states and transitions are only built when
+  matching first needs them, so patterns whose full DFA would be huge
+  only pay for the part the input visits.
+
+  One Lazy_DFA can be shared by any number of threads matching at the
+  same time:
+
+    - a transition that is already built is a single atomic load, with
+      no lock and no write, so warm matching scales with the threads;
+    - a missing transition is built by the thread that needs it. The
+      new state is written to a segmented store (elements never move)
+      and published through a concurrent intern table with a
+      compare-and-swap, then the transition itself is stored. Threads
+      racing to build the same transition store the same state.
+
+  Bytes are mapped to the byte classes of the NFA. States are numbered
+  from 0, the dead state, but matching goes through State handles: a
+  handle is the address of the row of transitions of its state, with
+  the lowest bit set if the state is accepting. A transition holds the
+  handle of its target, or 0 until it is built, so each byte costs one
+  load, and checking for acceptance is a bit test.
+
+  The memory of the states can be bounded. Once a new state would take
+  it past the limit, no more states are built: next_state() returns
+  over_limit for transitions that are still missing, and matching runs
+  the NFA instead, which only needs a set of its states at a time.
+  The states built so far stay in use, they are not cleared, since
+  other threads may be running through them. Every match that falls
+  back to the NFA is counted by fallbacks().
+*/
+class Lazy_DFA
+{
+public:
+    static constexpr uint32_t dead_state = 0;
+
+    typedef uintptr_t State;
+
+    // Returned by next_state() when the memory limit is reached.
+    static constexpr State over_limit = 0;
+
+    /*
+      memory_limit bounds the bytes held by the states, 0 for no
+      limit. The dead and initial states are always built. The NFA is
+      moved in when the caller has no more use for its own copy.
+    */
+    Lazy_DFA(NFA< uint8_t, uint32_t > N, size_t memory_limit = 0)
+        : N_(std::move(N)),
+          classes_(N_.byte_classes()),
+          num_classes_(classes_.size()),
+          shift_(row_shift(num_classes_ + 1)),
+          words_((N_.size() + 63) / 64),
+          rows_(size_t(64) << shift_),
+          sets_(64),
+          accept_(64),
+          ids_(64),
+          memory_limit_(0)
+    {
+        for (int k = 0; k < num_classes_; ++k)
+            representatives_.push_back(classes_.representative(k));
+
+        //Dead state, whose transitions all lead back to it.
+        size_ = 1;
+        bytes_ = 0;
+        accept_.at(0) = 0;
+        sets_.at(0).clear();
+        for (int k = 0; k < (1 << shift_); ++k)
+            rows_.at(k).store(0, std::memory_order_relaxed);
+        dead_ = handle(dead_state);
+        for (int k = 0; k < num_classes_; ++k)
+            row(dead_)[k].store(dead_, std::memory_order_relaxed);
+
+        std::vector< uint64_t > set(words_, 0);
+        std::vector< uint32_t > check_stack;
+        add_closure(N_.initial_state(), set, check_stack);
+        initial_state_ = handle(intern(set));
+        fallbacks_ = 0;
+        memory_limit_ = memory_limit;
+
+        return;
+    }
+
+    Lazy_DFA(const Lazy_DFA &) = delete;
+    Lazy_DFA & operator=(const Lazy_DFA &) = delete;
+
+    State initial_state() const
+    { return initial_state_; }
+
+    static bool is_accepting(State q)
+    { return q & 1; }
+
+    bool is_dead(State q) const
+    { return q == dead_; }
+
+    // Number of the state of a handle.
+    static uint32_t id(State q)
+    { return row(q)[-1].load(std::memory_order_relaxed); }
+
+    /*
+      Returns the state q goes to on c, building it if needed, or
+      over_limit if it would take the memory past the limit.
+    */
+    State next_state(State q, uint8_t c) const
+    {
+        uint32_t k = classes_[c];
+        State r = row(q)[k].load(std::memory_order_acquire);
+        if (r == 0)
+            r = build(q, k);
+        return r;
+    }
+
+    // Returns true if this DFA accepts the given string of bytes.
+    bool operator()(const uint8_t * str, size_t n) const
+    {
+        State state = initial_state_;
+        for (size_t i = 0; i < n && state != dead_; ++i)
+        {
+            state = next_state(state, str[i]);
+            if (state == over_limit)
+            {
+                fallbacks_.fetch_add(1, std::memory_order_relaxed);
+                return N_(str, n);
+            }
+        }
+        return is_accepting(state);
+    }
+
+    bool operator()(const std::string & str) const
+    { return operator()((const uint8_t *)str.data(), str.size()); }
+
+    /*
+      Length of the shortest, or longest, prefix of the string the NFA
+      accepts, or NFA::npos, for searches that reached over_limit.
+      Counted as a fallback.
+    */
+    size_t nfa_prefix(const uint8_t * str, size_t n, bool longest) const
+    {
+        fallbacks_.fetch_add(1, std::memory_order_relaxed);
+        return longest ? N_.longest_prefix(str, n) : N_.shortest_prefix(str, n);
+    }
+
+    // Number of matches that ran the NFA because of the memory limit.
+    size_t fallbacks() const
+    { return fallbacks_.load(std::memory_order_relaxed); }
+
+    size_t memory_limit() const
+    { return memory_limit_; }
+
+    // Number of states built so far, including the dead state.
+    uint32_t size() const
+    { return size_.load(std::memory_order_acquire); }
+
+    const Byte_Classes & classes() const
+    { return classes_; }
+
+    // The NFA the states are sets of.
+    const NFA< uint8_t, uint32_t > & nfa() const
+    { return N_; }
+
+    // Bytes held by the states built so far and their tables.
+    size_t memory_bytes() const
+    {
+        return rows_.memory_bytes() + sets_.memory_bytes() +
+            accept_.memory_bytes() + ids_.memory_bytes() +
+            bytes_.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Rows hold 2^shift entries: one transition per class, then the
+    // number of the state. A handle points just past the number.
+    static int row_shift(int entries)
+    {
+        int ret = 0;
+        while ((1 << ret) < entries)
+            ++ret;
+        return ret;
+    }
+
+    static std::atomic< State > * row(State q)
+    { return (std::atomic< State > *)(q & ~State(1)); }
+
+    State handle(uint32_t q) const
+    {
+        std::atomic< State > & first = rows_[(size_t(q) << shift_) + 1];
+        return State(&first) | accept_[q];
+    }
+
+    struct Set_Hash
+    {
+        size_t operator()(const std::vector< uint32_t > & x) const
+        {
+            uint64_t h = x.size();
+            for (const uint32_t & q : x)
+                h = (h ^ q) * 0x9e3779b97f4a7c15ULL;
+            return h ^ (h >> 29);
+        }
+    };
+
+    // Adds q and its epsilon closure to a bit vector set of states.
+    void add_closure(uint32_t q, std::vector< uint64_t > & set,
+                     std::vector< uint32_t > & check_stack) const
+    {
+        if ((set[q / 64] >> (q % 64)) & 1)
+            return;
+
+        set[q / 64] |= uint64_t(1) << (q % 64);
+        check_stack.push_back(q);
+        while (!check_stack.empty())
+        {
+            uint32_t check = check_stack.back();
+            check_stack.pop_back();
+            for (const uint32_t & r : N_.epsilon_transitions(check))
+            {
+                if (((set[r / 64] >> (r % 64)) & 1) == 0)
+                {
+                    set[r / 64] |= uint64_t(1) << (r % 64);
+                    check_stack.push_back(r);
+                }
+            }
+        }
+
+        return;
+    }
+
+    // Builds and stores the transition of q on class k.
+    State build(State from, uint32_t k) const
+    {
+        uint32_t q = id(from);
+        std::vector< uint64_t > set(words_, 0);
+        std::vector< uint32_t > check_stack;
+        bool any = false;
+        uint8_t c = representatives_[k];
+        for (const uint32_t & s : sets_[q])
+        {
+            for (const NFA< uint8_t, uint32_t >::Edge & e : N_.transitions(s))
+            {
+                if (e.symbols.contains(c))
+                {
+                    add_closure(e.to, set, check_stack);
+                    any = true;
+                }
+            }
+        }
+
+        State r = dead_;
+        if (any)
+        {
+            uint32_t id = intern(set);
+            if (id == helper::Concurrent_Id_Table::none)
+                return over_limit;
+            r = handle(id);
+        }
+        row(from)[k].store(r, std::memory_order_release);
+        return r;
+    }
+
+    /*
+      Returns the state of a set of NFA states, creating it if needed,
+      or none if creating it would go over the memory limit.
+    */
+    uint32_t intern(const std::vector< uint64_t > & bits) const
+    {
+        std::vector< uint32_t > set;
+        for (int w = 0; w < words_; ++w)
+        {
+            uint64_t b = bits[w];
+            while (b != 0)
+            {
+                set.push_back(w * 64 + __builtin_ctzll(b));
+                b &= b - 1;
+            }
+        }
+
+        size_t hash = Set_Hash()(set);
+        auto equal = [&](uint32_t id) { return sets_[id] == set; };
+        uint32_t id = ids_.find(hash, equal);
+        if (id != helper::Concurrent_Id_Table::none)
+            return id;
+
+        if (memory_limit_ != 0 && bytes_with(set.size()) > memory_limit_)
+            return helper::Concurrent_Id_Table::none;
+
+        //Fill in the state before anyone can see its id.
+        id = size_.fetch_add(1, std::memory_order_acq_rel);
+        bool accepting = false;
+        for (const uint32_t & s : set)
+            accepting = accepting || N_.is_accepting(s);
+        accept_.at(id) = accepting;
+        size_t first = size_t(id) << shift_;
+        rows_.at(first).store(id, std::memory_order_relaxed);
+        for (int k = 1; k < (1 << shift_); ++k)
+            rows_.at(first + k).store(0, std::memory_order_relaxed);
+        bytes_.fetch_add(set.size() * sizeof(uint32_t), std::memory_order_relaxed);
+        sets_.at(id) = std::move(set);
+
+        //A thread that lost the race leaves its state unused.
+        return ids_.insert(hash, id, [&](uint32_t other)
+                           { return sets_[other] == sets_[id]; });
+    }
+
+    // Bytes held once one more state, of a set of n NFA states, exists.
+    size_t bytes_with(size_t n) const
+    {
+        size_t states = size() + 1;
+        return std::max(rows_.memory_bytes(), rows_.memory_bytes(states << shift_)) +
+            std::max(sets_.memory_bytes(), sets_.memory_bytes(states)) +
+            std::max(accept_.memory_bytes(), accept_.memory_bytes(states)) +
+            ids_.memory_bytes() +
+            bytes_.load(std::memory_order_relaxed) + n * sizeof(uint32_t);
+    }
+
+    const NFA< uint8_t, uint32_t > N_;
+    Byte_Classes classes_;
+    int num_classes_;
+    int shift_;
+    int words_;
+    State initial_state_;
+    State dead_;
+    std::vector< uint8_t > representatives_;
+
+    mutable helper::Segmented_Array< std::atomic< State > > rows_;
+    mutable helper::Segmented_Array< std::vector< uint32_t > > sets_;
+    mutable helper::Segmented_Array< uint8_t > accept_;
+    mutable helper::Concurrent_Id_Table ids_;
+    mutable std::atomic< uint32_t > size_;
+
+    //Bytes held by the sets of NFA states.
+    mutable std::atomic< size_t > bytes_;
+
+    size_t memory_limit_;
+    mutable std::atomic< size_t > fallbacks_;
+};
+
+#endif
@@ -3,6 +3,9 @@
 
 #include "Common.h"
 
+#include "Language.h"
+#include "Regex_Terms.h"
+#include "Stats.h"
 #include "DFA.h"
 #include "Regex.h"
 
@@ -25,22 +28,28 @@ public:
           accept_states_(accept_states),
           delta_(delta),
           epsilon_(epsilon),
-          M_(nullptr)
+          M_(nullptr),
+          table_(nullptr),
+          stats_(nullptr)
     {
         if (sigma_.find(epsilon_) == sigma_.end())
             throw NFA_Epsilon_Not_In_Sigma_Error();
 
-        //M_ is now no longer nullptr after calling this function.
-        construct_dfa();
-
+        // The DFA is not built here. Subset construction can be
+        // exponential, and NFAs built as intermediate steps (union,
+        // concatenation, kleene star) never need it. See to_dfa().
         return;
     }
 
-    NFA(const NFA< S_t, Q_t > & N) : epsilon_(N.epsilon_), M_(nullptr)
+    NFA(const NFA< S_t, Q_t > & N)
+        : epsilon_(N.epsilon_), M_(nullptr), table_(nullptr), stats_(nullptr)
     { *this = N; }
 
     NFA< S_t, Q_t > & operator=(const NFA< S_t, Q_t > & N)
     {
+        if (this == &N)
+            return *this;
+
         //Assign values.
         sigma_ = N.sigma_;
         states_ = N.states_;
@@ -48,11 +57,17 @@ public:
         accept_states_ = N.accept_states_;
         delta_ = N.delta_;
 
-        //Assign DFA.
-        if (M_ == nullptr)
+        //Assign DFA, only if the other NFA has already built one.
+        if (M_ != nullptr)
+            delete M_;
+        M_ = nullptr;
+        if (N.M_ != nullptr)
             M_ = new DFA< S_t, std::unordered_set< Q_t > >(*N.M_);
-        else
-            *M_ = *N.M_;
+
+        //The simulation table is rebuilt on demand.
+        if (table_ != nullptr)
+            delete table_;
+        table_ = nullptr;
 
         return *this;
     }
@@ -61,11 +76,28 @@ public:
     {
         if (M_ != nullptr)
             delete M_;
+        if (table_ != nullptr)
+            delete table_;
     }
 
-    // Returns the DFA of this NFA.
+    /*
+      Records the building of the DFA and of the simulation table in
+      stats from now on (see Stats.h), or stops recording if stats is
+      null. The stats object is not owned and is not copied along with
+      this NFA.
+    */
+    void set_stats(Automaton_Stats * stats)
+    { stats_ = stats; }
+
+    // Returns the DFA of this NFA. The DFA is constructed the first
+    // time this is called.
     DFA< S_t, std::unordered_set< Q_t > > to_dfa() const
-    { return *M_; }
+    {
+        if (M_ == nullptr)
+            construct_dfa();
+
+        return *M_;
+    }
 
 
     class NFA_To_Regex_Invalid_qi_Error{};
@@ -86,163 +118,122 @@ public:
         if (states_.find(qa) != states_.end())
             throw NFA_To_Regex_Invalid_qa_Error();
 
-        // Temporary states
-        std::unordered_set< Q_t > t_states = states_;
-        t_states.insert(qi);
-        t_states.insert(qa);
-
-        // Temporary delta
-        D_t new_delta = delta_;
-        new_delta[{qi, epsilon_}] = {initial_state_};
+        /*
+          State elimination. qi is numbered 0 and qa 1, and the edges
+          are kept as adjacency maps of regex terms in both directions,
+          so removing a state only touches its own neighbours. The
+          state removed next is the one with the fewest (in * out)
+          edges to other states, which keeps the terms small.
+        */
+        helper::Regex_Terms terms;
+        std::unordered_map< Q_t, int > ids;
+        ids[qi] = 0;
+        ids[qa] = 1;
+        for (const Q_t & q : states_)
+            ids.insert({q, int(ids.size())});
+        int n = ids.size();
+
+        std::vector< std::unordered_map< int, int > > out(n), in(n);
+        auto add_edge = [&](int p, int r, int t)
+        {
+            std::unordered_map< int, int >::iterator it = out[p].find(r);
+            if (it != out[p].end())
+                t = terms.alternation(it->second, t);
+            out[p][r] = t;
+            in[r][p] = t;
+        };
+
+        add_edge(0, ids[initial_state_], helper::Regex_Terms::epsilon);
         for (const Q_t & q : accept_states_)
-            new_delta[{q, epsilon_}] = {qa};
-
-        //Map of a set of all transitions between two states.
-        std::unordered_map< std::pair< Q_t, Q_t >,
-                            std::unordered_set< std::string > > transitions;
+            add_edge(ids[q], 1, helper::Regex_Terms::epsilon);
         
-        for (const std::pair< Q_t_S_t, std::unordered_set< Q_t > > & pair : new_delta)
+        for (const std::pair< const Q_t_S_t, std::unordered_set< Q_t > > & pair : delta_)
         {
-            for (const Q_t & q : pair.second)
+            int t = helper::Regex_Terms::epsilon;
+            if (pair.first.second != epsilon_)
             {
-                std::pair< Q_t, Q_t > from_to = { pair.first.first, q };
+                std::string symbol = std::to_string(pair.first.second);
 
-                // If a set for this transitioning state pair does not already
-                // exist, create one.
-                if (transitions.find(from_to) == transitions.end())
-                    transitions[from_to] = {};
-                
-                std::string insertion = std::to_string(pair.first.second);
-                // If this transition string is not already in the set for the
-                // transitioning state pair, insert it.
-                if (transitions[from_to].find(insertion) == transitions[from_to].end())
+                // Add the '/' delimiter before symbols used by regex operations.
+                for (int i = 0; i < int(symbol.size()); ++i)
                 {
-                    std::string insert_str = std::to_string(pair.first.second);
-
-                    // Add the '/' delimiter before symbols used by regex operations.
-                    for (int i = 0; i < insert_str.size(); ++i)
+                    if (Regex::symbols.find(symbol[i]) != Regex::symbols.end())
                     {
-                        if (Regex::symbols.find(insert_str[i]) != Regex::symbols.end())
-                        {
-                            insert_str.insert(i, 1, '/');
-                            ++i;
-                        }
+                        symbol.insert(i, 1, '/');
+                        ++i;
                     }
-                    
-                    transitions[from_to].insert(insert_str);
                 }
+                
+                t = terms.symbol(symbol);
             }
+
+            for (const Q_t & q : pair.second)
+                add_edge(ids[pair.first.first], ids[q], t);
         }
 
+        //Edges to other states, not counting a loop.
+        auto degree = [&](const std::unordered_map< int, int > & edges, int q)
+        { return edges.size() - edges.count(q); };
+        auto cost = [&](int q)
+        { return uint64_t(degree(in[q], q)) * degree(out[q], q); };
 
-        //Map of a transition between two states as a string.
-        std::unordered_map< std::pair< Q_t, Q_t >, std::string > old_trans,
-                                                                 new_trans;
-        
-        // adjust old transitions to combine transitions that
-        // lead to the same state into a single transition using
-        // the '|' OR operator for regex.
-        for (const std::pair< std::pair< Q_t, Q_t >,
-                 std::unordered_set< std::string > > pair :
-                 transitions)
+        std::set< std::pair< uint64_t, int > > order;
+        std::vector< uint64_t > costs(n, 0);
+        for (int q = 2; q < n; ++q)
         {
-            std::string transition = "", delim = "";
-            int num_transitions = 0;
-            for (const std::string & s : pair.second)
-            {
-                transition += delim + s;
-                delim = "|";
-                ++num_transitions;
-            }
-
-            if (num_transitions > 1)
-                transition = "(" + transition + ")";
-
-            old_trans[pair.first] = transition;
+            costs[q] = cost(q);
+            order.insert({costs[q], q});
         }
 
-        // Keep adjusting the transition maps by removing states from t_states
-        // until only qi and qa remain.
-        while (t_states.size() > 2)
+        while (!order.empty())
         {
-            // Find state to remove from states that is not qi or qa.
-            typename std::unordered_set< Q_t >::const_iterator it  = t_states.begin();
-            while (*it == qi || *it == qa)
-                ++it;
-
-            //Grab state and remove it from t_states.
-            Q_t q = *it;
-            t_states.erase(it);
-
-            //Create cross product of the remaining t_states.
-            std::vector< std::pair< Q_t, Q_t > >
-                cross_prod(t_states.size() * t_states.size());
-            int n = 0;
-            for (const Q_t & q0 : t_states)
-                for (const Q_t & q1 : t_states)
-                    cross_prod[n++] = {q0, q1};
-
-            //Go through cross product and adjust the new transitions.
-            for (const std::pair< Q_t, Q_t > & pair : cross_prod)
-            {
-                std::string trans1, trans2, transition;
-                bool q_path_exists = false,
-                     straight_path_exists = false;
-
-                std::pair< Q_t, Q_t >
-                    first_to_q = {pair.first, q},
-                    q_to_q = {q, q},
-                    q_to_second = {q, pair.second},
-                    first_to_second = {pair.first, pair.second};
-                
-                if (old_trans.find(first_to_q) != old_trans.end() &&
-                    old_trans[first_to_q] != emptyset &&
-                    old_trans.find(q_to_second) != old_trans.end() &&
-                    old_trans[q_to_second] != emptyset)
-                {
-                    q_path_exists = true;
-
-                    trans1 = old_trans[first_to_q];
+            int q = order.begin()->second;
+            order.erase(order.begin());
 
-                    if (old_trans.find(q_to_q) != old_trans.end() &&
-                        old_trans[q_to_q] != emptyset &&
-                        old_trans[q_to_q] != epsilon_)
-                    {
-                        trans1 += "(" + old_trans[q_to_q] + ")*";
-                    }
+            int loop = helper::Regex_Terms::epsilon;
+            if (out[q].find(q) != out[q].end())
+                loop = terms.star(out[q][q]);
+            out[q].erase(q);
+            in[q].erase(q);
 
-                    
-                    trans1 += old_trans[q_to_second];
-                }
-
-                if (old_trans.find(first_to_second) != old_trans.end() &&
-                    old_trans[first_to_second] != emptyset)
-                {
-                    straight_path_exists = true;
-
-                    trans2 = old_trans[first_to_second];
-                }
-
-                if (q_path_exists && straight_path_exists)
-                    transition = "(" + trans1 + "|" + trans2 + ")";
-                else if (q_path_exists)
-                    transition = trans1;
-                else if (straight_path_exists)
-                    transition = trans2;
-
-                if (q_path_exists || straight_path_exists)
-                    new_trans[first_to_second] = transition;
-                else
-                    new_trans[first_to_second] = emptyset;
+            //Every path p -> q -> r becomes an edge p -> r.
+            for (const std::pair< const int, int > & from : in[q])
+            {
+                out[from.first].erase(q);
+                int prefix = terms.concatenation(from.second, loop);
+                for (const std::pair< const int, int > & to : out[q])
+                    add_edge(from.first, to.first,
+                             terms.concatenation(prefix, to.second));
+            }
+            for (const std::pair< const int, int > & to : out[q])
+                in[to.first].erase(q);
+
+            //Only the neighbours of q changed cost.
+            std::unordered_set< int > neighbours;
+            for (const std::pair< const int, int > & from : in[q])
+                neighbours.insert(from.first);
+            for (const std::pair< const int, int > & to : out[q])
+                neighbours.insert(to.first);
+            for (const int & p : neighbours)
+            {
+                if (p < 2)
+                    continue;
+                order.erase({costs[p], p});
+                costs[p] = cost(p);
+                order.insert({costs[p], p});
             }
 
-            old_trans = new_trans;
-            new_trans.clear();
+            out[q].clear();
+            in[q].clear();
         }
-        
-        std::string regex_str = old_trans[{qi, qa}];
 
-        return Regex(regex_str, epsilon_, emptyset);
+        int t = helper::Regex_Terms::empty;
+        if (out[0].find(1) != out[0].end())
+            t = out[0][1];
+
+        return Regex(terms.to_string(t, std::to_string(emptyset)),
+                     std::to_string(epsilon_),
+                     std::to_string(emptyset));
     }
 
     // Returns the epsilon closure of a given state.
@@ -279,27 +270,66 @@ public:
         return ret;
     }
 
-    // Returns true if this NFA accepts a given string of characters
-    // in sigma, false otherwise.
+    /*
+      Returns true if this NFA accepts a given string of characters
+      in sigma, false otherwise.
+
+      The NFA is simulated directly: the set of active states is kept
+      as a bit vector over an integer numbering of the states, so each
+      step costs time proportional to the active states and their
+      edges rather than requiring the (possibly exponential) DFA.
+    */
     bool operator()(const std::vector< S_t > & str) const
     {
-        //DFA cannot work with epsilon characters.
-        std::vector< S_t > new_str;
+        const Simulation_Table & t = simulation_table();
+
+        std::vector< uint64_t > current(t.words, 0), next(t.words, 0);
+        std::vector< int > check_stack;
+        add_closure(t, t.initial_state, current, check_stack);
+
         for (const S_t & c : str)
-            if (c != epsilon_)
-                new_str.push_back(c);
-        
-        try
         {
-            return M_->operator()(new_str);
-        }
+            //Epsilon characters are ignored.
+            if (c == epsilon_)
+                continue;
 
-        // This will ensure the error will throw from inside of the NFA
-        // class and not the DFA class to avoid error origin confusion.
-        catch (const DFA_Invalid_Sigma_Character_Error & e)
-        {
-            throw NFA_Invalid_Sigma_Character_Error();
+            int symbol = t.symbol_index.find(c);
+            if (symbol < 0)
+                throw NFA_Invalid_Sigma_Character_Error();
+
+            std::fill(next.begin(), next.end(), 0);
+            bool any = false;
+            for (int w = 0; w < t.words; ++w)
+            {
+                uint64_t bits = current[w];
+                while (bits != 0)
+                {
+                    int q = w * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+
+                    for (int e = t.offsets[q]; e < t.offsets[q + 1]; ++e)
+                    {
+                        if (t.edges[e].first == symbol)
+                        {
+                            add_closure(t, t.edges[e].second, next, check_stack);
+                            any = true;
+                        }
+                    }
+                }
+            }
+
+            //No active states left, this string can never be accepted.
+            if (!any)
+                return false;
+
+            current.swap(next);
         }
+
+        for (int w = 0; w < t.words; ++w)
+            if ((current[w] & t.accept[w]) != 0)
+                return true;
+
+        return false;
     }
 
 
@@ -328,6 +358,35 @@ public:
                                epsilon_);
     }
 
+    /*
+      Returns the NFA of the reverse language, accepting the strings
+      this NFA accepts read backwards, with a new given initial state.
+      Every transition is turned around, the initial state becomes the
+      only accepting state, and the new initial state has epsilon
+      transitions to the old accepting states.
+    */
+    NFA< S_t, Q_t > reverse(const Q_t & new_initial_state) const
+    {
+        if (states_.find(new_initial_state) != states_.end())
+            throw NFA_Reverse_Invalid_Initial_State_Error();
+
+        std::unordered_set< Q_t > new_states = states_;
+        new_states.insert(new_initial_state);
+
+        D_t new_delta;
+        for (const std::pair< const Q_t_S_t, std::unordered_set< Q_t > > & pair : delta_)
+            for (const Q_t & q : pair.second)
+                new_delta[{q, pair.first.second}].insert(pair.first.first);
+        new_delta[{new_initial_state, epsilon_}] = accept_states_;
+
+        return NFA< S_t, Q_t >(sigma_,
+                               new_states,
+                               new_initial_state,
+                               {initial_state_},
+                               new_delta,
+                               epsilon_);
+    }
+
     // Return true if this is a valid NFA.
     bool valid() const
     {
@@ -386,16 +445,148 @@ public:
         return accept_states_.find(q) != accept_states_.end();
     }
 
+    class Explorer;
+
 private:
 
+    /*
+      Integer indexed copy of delta used by operator(). States and
+      symbols are numbered, the edges of each state are stored
+      contiguously (offsets[q] to offsets[q + 1]) and sets of states
+      are bit vectors of length words * 64.
+    */
+    struct Simulation_Table
+    {
+        helper::Symbol_Index< S_t > symbol_index;
+        std::vector< int > offsets;
+        std::vector< std::pair< int, int > > edges;
+        std::vector< int > epsilon_offsets;
+        std::vector< int > epsilon_edges;
+        std::vector< uint64_t > accept;
+        int initial_state;
+        int words;
+    };
+
+    // Builds the simulation table the first time it is needed.
+    const Simulation_Table & simulation_table() const
+    {
+        if (table_ != nullptr)
+            return *table_;
+
+        Stats_Timer timer(stats_, "simulation table");
+        Simulation_Table * t = new Simulation_Table;
+
+        std::unordered_map< Q_t, int > state_index;
+        std::vector< Q_t > index_state;
+        for (const Q_t & q : states_)
+        {
+            state_index[q] = index_state.size();
+            index_state.push_back(q);
+        }
+        int n = index_state.size();
+        
+        for (const S_t & c : sigma_)
+            if (c != epsilon_)
+                t->symbol_index.insert(c);
+
+        //Bucket every edge by its source state.
+        std::vector< std::vector< std::pair< int, int > > > out(n);
+        std::vector< std::vector< int > > epsilon_out(n);
+        for (const std::pair< const Q_t_S_t, std::unordered_set< Q_t > > & pair : delta_)
+        {
+            int from = state_index[pair.first.first];
+            
+            for (const Q_t & q : pair.second)
+            {
+                if (pair.first.second == epsilon_)
+                    epsilon_out[from].push_back(state_index[q]);
+                else
+                    out[from].push_back({t->symbol_index.find(pair.first.second),
+                                         state_index[q]});
+            }
+        }
+
+        t->offsets.push_back(0);
+        t->epsilon_offsets.push_back(0);
+        for (int q = 0; q < n; ++q)
+        {
+            t->edges.insert(t->edges.end(), out[q].begin(), out[q].end());
+            t->offsets.push_back(t->edges.size());
+
+            t->epsilon_edges.insert(t->epsilon_edges.end(),
+                                    epsilon_out[q].begin(),
+                                    epsilon_out[q].end());
+            t->epsilon_offsets.push_back(t->epsilon_edges.size());
+        }
+
+        t->words = (n + 63) / 64;
+        t->accept.assign(t->words, 0);
+        for (const Q_t & q : accept_states_)
+        {
+            int i = state_index[q];
+            t->accept[i / 64] |= uint64_t(1) << (i % 64);
+        }
+        t->initial_state = state_index[initial_state_];
+
+        if (stats_ != nullptr)
+        {
+            stats_->nfa_states = n;
+            stats_->resident_bytes = helper::vector_bytes(t->offsets) +
+                helper::vector_bytes(t->edges) +
+                helper::vector_bytes(t->epsilon_offsets) +
+                helper::vector_bytes(t->epsilon_edges) +
+                helper::vector_bytes(t->accept);
+            stats_->add_bytes(stats_->resident_bytes +
+                              n * (sizeof(Q_t) + sizeof(int)));
+        }
+
+        table_ = t;
+        return *table_;
+    }
+
+    // Adds state q and its epsilon closure to the bit vector set.
+    static void add_closure(const Simulation_Table & t, int q,
+                            std::vector< uint64_t > & set,
+                            std::vector< int > & check_stack)
+    {
+        uint64_t bit = uint64_t(1) << (q % 64);
+        if ((set[q / 64] & bit) != 0)
+            return;
+
+        set[q / 64] |= bit;
+        check_stack.push_back(q);
+
+        while (!check_stack.empty())
+        {
+            int check = check_stack.back();
+            check_stack.pop_back();
+            
+            for (int e = t.epsilon_offsets[check];
+                 e < t.epsilon_offsets[check + 1]; ++e)
+            {
+                int r = t.epsilon_edges[e];
+                uint64_t r_bit = uint64_t(1) << (r % 64);
+                if ((set[r / 64] & r_bit) == 0)
+                {
+                    set[r / 64] |= r_bit;
+                    check_stack.push_back(r);
+                }
+            }
+        }
+
+        return;
+    }
+
     // Helper function for construct_dfa().
     const std::unordered_set< Q_t > * get_ptr_to_member(
         const std::unordered_set< std::unordered_set< Q_t > > & set,
-        const std::unordered_set< Q_t > & state
-        )
+        const std::unordered_set< Q_t > & state,
+        size_t & probes
+        ) const
     {
         for (const std::unordered_set< Q_t > & set_state : set)
         {
+            ++probes;
             if (set_state.size() == state.size())
             {
                 bool equal = true;
@@ -416,9 +607,12 @@ private:
         return nullptr;
     }
 
-    //Construct DFA of the given NFA, only called in NFA constructor.
-    void construct_dfa()
+    //Construct DFA of the given NFA, only called from to_dfa().
+    void construct_dfa() const
     {
+        Stats_Timer timer(stats_, "determinize");
+        size_t closures = 1, hash_probes = 0, set_bytes = 0;
+        
         typedef std::unordered_set< Q_t > New_Q_t;
         typedef std::unordered_map< std::pair< New_Q_t, S_t >, New_Q_t > New_D_t;
 
@@ -447,7 +641,10 @@ private:
                     {
                         //Get all epsilon closures of new states.
                         for (const Q_t & new_q : delta_.find({q, c})->second)
+                        {
                             helper::merge(new_state, epsilon_closure(new_q));
+                            ++closures;
+                        }
                     }
                 }
 
@@ -458,9 +655,11 @@ private:
                   sets not the same in the eyes of a dictionary index, so, I
                   will instead use the element already in the set if it exists.
                 */
-                const New_Q_t * member_ptr = get_ptr_to_member(new_states, new_state);
+                const New_Q_t * member_ptr =
+                    get_ptr_to_member(new_states, new_state, hash_probes);
                 if (member_ptr == nullptr)
                 {
+                    set_bytes += new_state.size() * sizeof(Q_t);
                     new_states.insert(new_state);
                     to_eval.push(new_state);
                     new_delta[{check_state, c}] = new_state;
@@ -486,6 +685,16 @@ private:
             }
         }
 
+        if (stats_ != nullptr)
+        {
+            stats_->nfa_states = states_.size();
+            stats_->dfa_states = new_states.size();
+            stats_->closures += closures;
+            stats_->hash_probes += hash_probes;
+            stats_->add_bytes(set_bytes + new_delta.size() *
+                              (2 * sizeof(New_Q_t) + sizeof(S_t)));
+        }
+
         //Create the DFA for the NFA to use.
         M_ = new DFA< S_t, std::unordered_set< Q_t > >(new_sigma,
                                                        new_states,
@@ -504,8 +713,113 @@ private:
     D_t delta_;
     const S_t epsilon_;
 
-    //Inner DFA.
-    DFA< S_t, std::unordered_set< Q_t > > * M_;
+    //Inner DFA, built lazily by to_dfa().
+    mutable DFA< S_t, std::unordered_set< Q_t > > * M_;
+
+    //Simulation table, built lazily by operator().
+    mutable Simulation_Table * table_;
+
+    //Not owned, null unless set_stats() was called.
+    Automaton_Stats * stats_;
+};
+
+/*
+  Lazy determinization of an NFA for the language checks (see
+  Language.h). Each state of the explorer is a set of NFA states, kept
+  as a bit vector, and is only built when a check first reaches it.
+  State 0 is the empty set.
+*/
+template< typename S_t, typename Q_t >
+class NFA< S_t, Q_t >::Explorer
+{
+public:
+    Explorer(const NFA< S_t, Q_t > & N) : t_(N.simulation_table())
+    {
+        std::vector< uint64_t > set(t_.words, 0);
+        intern(set);
+
+        add_closure(t_, t_.initial_state, set, check_stack_);
+        initial_state_ = intern(set);
+    }
+
+    int initial_state() const
+    { return initial_state_; }
+
+    int next_state(int q, const S_t & c)
+    {
+        int symbol = t_.symbol_index.find(c);
+        if (q == 0 || symbol < 0)
+            return 0;
+
+        //Transitions are computed once.
+        uint64_t key = (uint64_t(q) << 32) | uint32_t(symbol);
+        std::unordered_map< uint64_t, int >::const_iterator it = next_.find(key);
+        if (it != next_.end())
+            return it->second;
+
+        std::vector< uint64_t > set(t_.words, 0);
+        for (int w = 0; w < t_.words; ++w)
+        {
+            uint64_t bits = sets_[q][w];
+            while (bits != 0)
+            {
+                int r = w * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+
+                for (int e = t_.offsets[r]; e < t_.offsets[r + 1]; ++e)
+                    if (t_.edges[e].first == symbol)
+                        add_closure(t_, t_.edges[e].second, set, check_stack_);
+            }
+        }
+
+        int id = intern(set);
+        next_[key] = id;
+        return id;
+    }
+
+    bool is_accepting(int q) const
+    { return accept_[q]; }
+
+private:
+    struct Set_Hash
+    {
+        size_t operator()(const std::vector< uint64_t > & x) const
+        {
+            size_t h = 0;
+            for (const uint64_t & w : x)
+                h = h * 0x9e3779b97f4a7c15ULL ^ w;
+            return h;
+        }
+    };
+
+    // Returns the number of a set of NFA states, adding it if new.
+    int intern(const std::vector< uint64_t > & set)
+    {
+        typename std::unordered_map< std::vector< uint64_t >, int,
+                                     Set_Hash >::const_iterator it =
+            ids_.find(set);
+        if (it != ids_.end())
+            return it->second;
+
+        int id = sets_.size();
+        ids_[set] = id;
+        sets_.push_back(set);
+
+        bool accepting = false;
+        for (int w = 0; w < t_.words; ++w)
+            accepting = accepting || (set[w] & t_.accept[w]) != 0;
+        accept_.push_back(accepting);
+
+        return id;
+    }
+
+    const Simulation_Table & t_;
+    std::unordered_map< std::vector< uint64_t >, int, Set_Hash > ids_;
+    std::vector< std::vector< uint64_t > > sets_;
+    std::vector< uint8_t > accept_;
+    std::unordered_map< uint64_t, int > next_;
+    std::vector< int > check_stack_;
+    int initial_state_;
 };
 
 
@@ -624,4 +938,66 @@ NFA< S_t, Q_t > nfa_concat(const NFA< S_t, Q_t > & N0,
                            N0.epsilon());
 }
 
+// Returns the sigma of an NFA without its epsilon character.
+template< typename S_t, typename Q_t >
+std::unordered_set< S_t > nfa_symbols(const NFA< S_t, Q_t > & N)
+{
+    std::unordered_set< S_t > ret = N.sigma();
+    ret.erase(N.epsilon());
+    return ret;
+}
+
+/*
+  Returns true if NFA N0 and N1 accept the same language. Otherwise,
+  if counterexample is not null, it is set to a string accepted by
+  exactly one of them.
+
+  Neither DFA is built: the subsets of both NFAs are constructed as
+  the check reaches them, and the check stops at the first difference.
+*/
+template< typename S_t, typename Q_t0, typename Q_t1 >
+bool equivalent(const NFA< S_t, Q_t0 > & N0,
+                const NFA< S_t, Q_t1 > & N1,
+                std::vector< S_t > * counterexample = nullptr)
+{
+    typename NFA< S_t, Q_t0 >::Explorer E0(N0);
+    typename NFA< S_t, Q_t1 >::Explorer E1(N1);
+    return helper::explore_equivalent(E0, E1,
+                                      helper::symbol_union(nfa_symbols(N0),
+                                                           nfa_symbols(N1)),
+                                      counterexample);
+}
+
+/*
+  Returns true if every string accepted by NFA N1 is accepted by N0.
+  Otherwise, if counterexample is not null, it is set to a shortest
+  string accepted by N1 but not by N0.
+*/
+template< typename S_t, typename Q_t0, typename Q_t1 >
+bool includes(const NFA< S_t, Q_t0 > & N0,
+              const NFA< S_t, Q_t1 > & N1,
+              std::vector< S_t > * counterexample = nullptr)
+{
+    typename NFA< S_t, Q_t0 >::Explorer E0(N0);
+    typename NFA< S_t, Q_t1 >::Explorer E1(N1);
+    return helper::explore_includes(E0, E1,
+                                    helper::symbol_union(nfa_symbols(N0),
+                                                         nfa_symbols(N1)),
+                                    counterexample);
+}
+
+/*
+  Returns true if NFA N accepts no string at all. Otherwise, if
+  witness is not null, it is set to a shortest accepted string.
+*/
+template< typename S_t, typename Q_t >
+bool is_empty(const NFA< S_t, Q_t > & N,
+              std::vector< S_t > * witness = nullptr)
+{
+    typename NFA< S_t, Q_t >::Explorer E(N);
+    std::unordered_set< S_t > symbols = nfa_symbols(N);
+    std::vector< S_t > sigma(symbols.begin(), symbols.end());
+    return helper::explore_is_empty(E, sigma, witness);
+}
+
 #endif
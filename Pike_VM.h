@@ -0,0 +1,152 @@
+#ifndef PIKE_VM_H
+#define PIKE_VM_H
+
+#include "Common.h"
+#include "Byte_NFA.h"
+
+/*
+  Runs a byte NFA whose states may save the current position into a
+  slot, and gives the slots of an accepting run. Regex uses it to
+  find the capture groups of a match, with a slot at the start and at
+  the end of each group, once its DFAs have found where the match is.
+
+  Every active NFA state is a thread carrying its own copy of the
+  slots, and threads are kept in order of priority, so when several
+  runs accept, the slots are those a backtracking matcher would find:
+  epsilon edges are followed in the order they were added, which for
+  a Regex means earlier alternatives and more repetitions first. The
+  time is proportional to the length of the string times the size of
+  the NFA, and only the slots of two steps are kept.
+*/
+class Pike_VM
+{
+public:
+    static constexpr size_t npos = size_t(-1);
+
+    // saves[q] is the slot state q saves the position into, or -1.
+    Pike_VM(const NFA< uint8_t, uint32_t > & N,
+            const std::vector< int > & saves, int slots)
+        : N_(N), saves_(saves), slots_(slots)
+    {
+        saves_.resize(N_.size(), -1);
+        return;
+    }
+
+    int slots() const
+    { return slots_; }
+
+    /*
+      If the NFA accepts the whole string, sets slots[0] to
+      slots[slots() - 1] to the positions saved by the accepting run
+      of highest priority, npos for those it never reached, and
+      returns true.
+    */
+    bool match(const uint8_t * str, size_t n, size_t * slots) const
+    {
+        Thread_List current(N_.size(), slots_), next(N_.size(), slots_);
+        std::vector< Entry > stack;
+        std::vector< size_t > unset(slots_, npos), saved(slots_);
+        uint32_t generation = 1;
+
+        add_thread(current, generation, N_.initial_state(), unset.data(), 0,
+                   stack, saved);
+        for (size_t i = 0; i < n && !current.states.empty(); ++i)
+        {
+            next.states.clear();
+            ++generation;
+            for (const uint32_t & q : current.states)
+                for (const NFA< uint8_t, uint32_t >::Edge & e : N_.transitions(q))
+                    if (e.symbols.contains(str[i]))
+                        add_thread(next, generation, e.to, current.slots_of(q),
+                                   i + 1, stack, saved);
+            std::swap(current, next);
+        }
+
+        for (const uint32_t & q : current.states)
+        {
+            if (N_.is_accepting(q))
+            {
+                std::copy(current.slots_of(q), current.slots_of(q) + slots_, slots);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    // Active states in order of priority, and the slots of each.
+    struct Thread_List
+    {
+        Thread_List(size_t states, int slots)
+            : marks(states, 0), slots(states * slots), width(slots)
+        {}
+
+        size_t * slots_of(uint32_t q)
+        { return &slots[size_t(q) * width]; }
+
+        std::vector< uint32_t > states;
+        std::vector< uint32_t > marks;
+        std::vector< size_t > slots;
+        int width;
+    };
+
+    // A state to add, or when slot is not -1, a slot to restore.
+    struct Entry
+    {
+        uint32_t state;
+        int slot;
+        size_t position;
+    };
+
+    /*
+      Adds q and the states reachable from it by epsilon edges to list,
+      depth first so that the order of the list is the priority of the
+      threads. from holds the slots of the thread that reached q.
+    */
+    void add_thread(Thread_List & list, uint32_t generation, uint32_t q,
+                    const size_t * from, size_t position,
+                    std::vector< Entry > & stack,
+                    std::vector< size_t > & saved) const
+    {
+        std::copy(from, from + slots_, saved.begin());
+        stack.push_back({q, -1, 0});
+        while (!stack.empty())
+        {
+            Entry e = stack.back();
+            stack.pop_back();
+            if (e.slot >= 0)
+            {
+                saved[e.slot] = e.position;
+                continue;
+            }
+
+            uint32_t check = e.state;
+            if (list.marks[check] == generation)
+                continue;
+            list.marks[check] = generation;
+            list.states.push_back(check);
+
+            //The slot is restored once everything after check is added.
+            int slot = saves_[check];
+            if (slot >= 0)
+            {
+                stack.push_back({0, slot, saved[slot]});
+                saved[slot] = position;
+            }
+            std::copy(saved.begin(), saved.end(), list.slots_of(check));
+
+            const std::vector< uint32_t > & epsilon = N_.epsilon_transitions(check);
+            for (size_t k = epsilon.size(); k > 0; --k)
+                stack.push_back({epsilon[k - 1], -1, 0});
+        }
+
+        return;
+    }
+
+    NFA< uint8_t, uint32_t > N_;
+    std::vector< int > saves_;
+    int slots_;
+};
+
+#endif
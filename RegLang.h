@@ -1,8 +1,18 @@
 #ifndef REGLANG_H
 #define REGLANG_H
 
+#include "Language.h"
+#include "Regex_Terms.h"
 #include "DFA.h"
+#include "Byte_DFA.h"
+#include "Byte_NFA.h"
 #include "NFA.h"
+#include "Concurrent.h"
+#include "Lazy_DFA.h"
+#include "Derivative_DFA.h"
+#include "Pike_VM.h"
 #include "Regex.h"
+#include "Aho_Corasick.h"
+#include "RegexSet.h"
 
 #endif
@@ -1,44 +1,113 @@
 #include "Regex.h"
 #include "NFA.h"
+#include "Byte_NFA.h"
+#include "UTF8.h"
+#include "Aho_Corasick.h"
+#include "Lazy_DFA.h"
+#include "Derivative_DFA.h"
+#include "Pike_VM.h"
+
+#include <map>
+#include <cstring>
+#include <memory>
 
 const std::unordered_set< char > Regex::regular_symbols(
-    {'(', ')', '|', '*', '/'}
+    {'(', ')', '|', '*', '/', '.'}
 );
 
 const std::unordered_set< char > Regex::symbols(
-    {'(', ')', '|', '*', '/', '{', '}', '+', '?', '[', ']'}
+    {'(', ')', '|', '*', '/', '{', '}', '+', '?', '[', ']', '.'}
 );
 
+static Byte_Set make_dot()
+{
+    Byte_Set ret = Byte_Set::all();
+    ret.erase('\n');
+    return ret;
+}
+
+const Byte_Set Regex::dot = make_dot();
+
 //////////// CONSTRUCTORS AND DESTRUCTOR \\\\\\\\\\\\
 
 Regex::Regex(const std::string & expression,
              const std::string & epsilon,
-             const std::string & emptyset)
+             const std::string & emptyset,
+             const Regex_Options & options)
     : expression_(expression),
       epsilon_(epsilon),
       emptyset_(emptyset),
-      N_(nullptr)
+      options_(options),
+      N_(nullptr),
+      M_(nullptr),
+      L_(nullptr),
+      D_(nullptr),
+      S_(nullptr),
+      R_(nullptr),
+      P_(nullptr),
+      A_(nullptr)
 {
     format_expression();
     construct_nfa();
 }
 
+Regex::Regex(const std::string & expression,
+             const Regex_Options & options)
+    : Regex(expression, "", "\0", options)
+{}
+
 Regex::Regex(const Regex & r)
     : expression_(r.expression_),
       regular_expression_(r.regular_expression_),
       epsilon_(r.epsilon_),
       emptyset_(r.emptyset_),
-      N_(nullptr)
+      options_(r.options_),
+      nodes_(r.nodes_),
+      root_(r.root_),
+      dfa_root_(r.dfa_root_),
+      groups_(r.groups_),
+      literals_(r.literals_),
+      N_(nullptr),
+      M_(nullptr),
+      L_(nullptr),
+      D_(nullptr),
+      min_length_(r.min_length_),
+      max_length_(r.max_length_),
+      S_(nullptr),
+      R_(nullptr),
+      P_(nullptr),
+      A_(nullptr),
+      stats_(r.stats_)
 {
-    N_ = new NFA< std::string, std::string >(*r.N_);
+    NFA< uint8_t, uint32_t > * N = r.N_.load(std::memory_order_acquire);
+    if (N != nullptr)
+        N_.store(new NFA< uint8_t, uint32_t >(*N), std::memory_order_relaxed);
+    if (r.M_ != nullptr)
+        M_ = new DFA< uint8_t, uint32_t >(*r.M_);
+    else if (r.D_ != nullptr)
+        D_ = new_derivative_dfa();
+    else if (r.L_ != nullptr)
+        L_ = new Lazy_DFA(r.L_->nfa(), options_.dfa_memory_limit);
+    if (r.A_ != nullptr)
+        A_ = new Aho_Corasick(*r.A_);
     
     return;
 }
 
 Regex::~Regex()
 {
-    if (N_ != nullptr)
-        delete N_;
+    delete N_.load();
+    if (M_ != nullptr)
+        delete M_;
+    if (L_ != nullptr)
+        delete L_;
+    if (D_ != nullptr)
+        delete D_;
+    delete S_.load();
+    delete R_.load();
+    delete P_.load();
+    if (A_ != nullptr)
+        delete A_;
     return;
 }
 
@@ -47,14 +116,53 @@ Regex::~Regex()
 
 Regex & Regex::operator=(const Regex & r)
 {
+    if (this == &r)
+        return *this;
+    
     expression_ = r.expression_;
     regular_expression_ = r.regular_expression_;
     epsilon_ = r.epsilon_;
     emptyset_ = r.emptyset_;
-
-    if (N_ != nullptr)
-        delete N_;
-    N_ = new NFA< std::string, std::string>(*r.N_);
+    options_ = r.options_;
+    nodes_ = r.nodes_;
+    root_ = r.root_;
+    dfa_root_ = r.dfa_root_;
+    groups_ = r.groups_;
+    literals_ = r.literals_;
+    min_length_ = r.min_length_;
+    max_length_ = r.max_length_;
+    stats_ = r.stats_;
+
+    NFA< uint8_t, uint32_t > * N = r.N_.load(std::memory_order_acquire);
+    delete N_.exchange(N != nullptr ? new NFA< uint8_t, uint32_t >(*N) : nullptr);
+
+    if (M_ != nullptr)
+        delete M_;
+    if (L_ != nullptr)
+        delete L_;
+    if (D_ != nullptr)
+        delete D_;
+    M_ = nullptr;
+    L_ = nullptr;
+    D_ = nullptr;
+    if (r.M_ != nullptr)
+        M_ = new DFA< uint8_t, uint32_t >(*r.M_);
+    else if (r.D_ != nullptr)
+        D_ = new_derivative_dfa();
+    else if (r.L_ != nullptr)
+        L_ = new Lazy_DFA(r.L_->nfa(), options_.dfa_memory_limit);
+
+    //The search DFA and the automata of the groups are rebuilt on
+    //demand.
+    delete S_.exchange(nullptr);
+    delete R_.exchange(nullptr);
+    delete P_.exchange(nullptr);
+
+    if (A_ != nullptr)
+        delete A_;
+    A_ = nullptr;
+    if (r.A_ != nullptr)
+        A_ = new Aho_Corasick(*r.A_);
     
     return *this;
 }
@@ -62,613 +170,2005 @@ Regex & Regex::operator=(const Regex & r)
 Regex & Regex::operator=(const std::string & s)
 { return *this = Regex(s); }
 
-bool Regex::operator()(std::string str) const
+bool Regex::operator()(const std::string & str) const
 {
+    if (epsilon_ == "")
+        return operator()(str.data(), str.size());
+    
     //Remove Epsilons from the string.
-    if (epsilon_ != "")
+    std::string s = str;
+    int len = epsilon_.size();
+    for (int i = 0; i <= int(s.size()) - len; ++i)
+        if (s.compare(i, len, epsilon_) == 0)
+            s.erase(i--, len);
+
+    return operator()(s.data(), s.size());
+}
+
+bool Regex::operator()(const char * str, size_t n) const
+{
+    const Regex_Literals & l = literals_;
+    if (l.exact)
+        return n == l.prefix.size() && memcmp(str, l.prefix.data(), n) == 0;
+    if (!literals_possible(str, n))
+        return false;
+
+    if (A_ != nullptr)
+        return A_->matches((const uint8_t *)str, n);
+    if (D_ != nullptr)
+        return D_->operator()((const uint8_t *)str, n);
+    if (M_ == nullptr)
+        return L_->operator()((const uint8_t *)str, n);
+    return M_->operator()((const uint8_t *)str, n);
+}
+
+/*
+  Returns false if the string lacks the prefix, suffix or required
+  literal of every match. A mismatch costs a memcmp or a memmem
+  instead of a run of the DFA.
+*/
+bool Regex::literals_possible(const char * str, size_t n) const
+{
+    const Regex_Literals & l = literals_;
+    if (n < l.prefix.size() || n < l.suffix.size())
+        return false;
+    if (memcmp(str, l.prefix.data(), l.prefix.size()) != 0)
+        return false;
+    if (memcmp(str + n - l.suffix.size(), l.suffix.data(), l.suffix.size()) != 0)
+        return false;
+    if (l.required.size() > std::max(l.prefix.size(), l.suffix.size()) &&
+        memmem(str, n, l.required.data(), l.required.size()) == nullptr)
     {
-        int len = epsilon_.size();
-        for (int i = 0; i < int(str.size()) - len; ++i)
-            if (str.substr(1, len) == epsilon_)
-                str.erase(i--, len);
+        return false;
+    }
+    return true;
+}
+
+void Regex::match_batch(const std::vector< std::string > & strs,
+                        std::vector< bool > & results) const
+{
+    std::vector< const char * > pointers(strs.size());
+    std::vector< size_t > lengths(strs.size());
+    for (size_t i = 0; i < strs.size(); ++i)
+    {
+        pointers[i] = strs[i].data();
+        lengths[i] = strs[i].size();
     }
 
-    int n = str.size();
-    std::vector< std::string > str_v(n);
-    for (int i = 0; i < n; ++i)
-        str_v[i] = std::to_string(str[i]);
+    std::unique_ptr< bool[] > matched(new bool[strs.size()]);
+    if (epsilon_ == "")
+        match_batch(pointers.data(), lengths.data(), strs.size(), matched.get());
+    else
+        for (size_t i = 0; i < strs.size(); ++i)
+            matched[i] = operator()(strs[i]);
 
-    return operator()(str_v);
+    results.assign(matched.get(), matched.get() + strs.size());
+    return;
 }
 
-bool Regex::operator()(const std::vector< std::string > & str) const
+void Regex::match_batch(const char * const * strs, const size_t * lengths,
+                        size_t count, bool * results) const
 {
-    try
+    if (M_ == nullptr || literals_.exact)
     {
-        return N_->operator()(str);
+        for (size_t i = 0; i < count; ++i)
+            results[i] = operator()(strs[i], lengths[i]);
+        return;
     }
-    
-    // If an "invalid" string is given, obviously it is not
-    // in the language of this regex, return false.
-    catch (const NFA_Invalid_Sigma_Character_Error & e)
+
+    //The strings the literals do not rule out go to the DFA, a chunk
+    //at a time.
+    const size_t chunk = 1024;
+    const uint8_t * kept[chunk];
+    size_t kept_lengths[chunk], index[chunk];
+    bool matched[chunk];
+    for (size_t first = 0; first < count; first += chunk)
     {
-        return false;
+        size_t last = std::min(count, first + chunk), m = 0;
+        for (size_t i = first; i < last; ++i)
+        {
+            results[i] = false;
+            if (literals_possible(strs[i], lengths[i]))
+            {
+                kept[m] = (const uint8_t *)strs[i];
+                kept_lengths[m] = lengths[i];
+                index[m++] = i;
+            }
+        }
+
+        M_->match_batch(kept, kept_lengths, m, matched);
+        for (size_t k = 0; k < m; ++k)
+            results[index[k]] = matched[k];
     }
+    return;
 }
 
-NFA< std::string, std::string > Regex::to_nfa() const
-{ return NFA< std::string, std::string >(*N_); }
+void Regex::profile(const std::vector< std::string > & sample)
+{
+    if (M_ == nullptr)
+        return;
 
-//////////// PRIVATE FUNCTIONS \\\\\\\\\\\\
+    std::vector< size_t > visits;
+    for (const std::string & str : sample)
+        M_->count_visits((const uint8_t *)str.data(), str.size(), visits);
+    M_->renumber_by_visits(visits);
+    return;
+}
 
-char Regex::get_range_type(const char c) const
+bool Regex::search(const std::string & str) const
+{ return search(str.data(), str.size()); }
+
+bool Regex::search(const char * str, size_t n) const
 {
-    if (c >= 'a' && c <= 'z')
-        return 'a'; //Lowercase type
-    if (c >= 'A' && c <= 'Z')
-        return 'A'; //Uppercase type
-    if (c >= '0' && c <= '9')
-        return '0'; //Numerical type
+    if (A_ != nullptr)
+        return A_->search((const uint8_t *)str, n);
+    return search_end(str, n) != Regex_Span::npos;
+}
 
-    return 'i'; //Invalid type
+bool Regex::match(const std::string & str, std::vector< Regex_Span > & spans) const
+{ return match(str.data(), str.size(), spans); }
+
+bool Regex::match(const char * str, size_t n, std::vector< Regex_Span > & spans) const
+{
+    if (!operator()(str, n))
+        return false;
+    captures(str, 0, n, spans);
+    return true;
 }
 
-/*
-  "[1-4]" --> "(1|2|3|4)"
-  "[a-d]" --> "(a|b|c|d)"
-  "[1-4a-c]" --> "(1|2|a|b|c)"
-  "[a-dA-E1-3]" --> "(a|b|c|d|A|B|C|D|E|1|2|3)"
-*/
-std::string Regex::get_range_string(const std::string & s) const
+bool Regex::search(const std::string & str, std::vector< Regex_Span > & spans) const
+{ return search(str.data(), str.size(), spans); }
+
+bool Regex::search(const char * str, size_t n, std::vector< Regex_Span > & spans) const
 {
-    std::string ret = "(";
+    size_t end = search_end(str, n);
+    if (end == Regex_Span::npos)
+        return false;
+    captures(str, match_begin(str, end), end, spans);
+    return true;
+}
 
-    int i = 1, n = s.size();
-    while (i < n - 1)
+size_t Regex::count_matches(const std::string & str) const
+{ return count_matches(str.data(), str.size()); }
+
+size_t Regex::count_matches(const char * str, size_t n) const
+{
+    const Lazy_DFA & S = search_dfa();
+    const uint8_t * bytes = (const uint8_t *)str;
+    const std::string & literal = literals_.required;
+
+    Lazy_DFA::State initial = S.initial_state(), state = initial;
+    if (S.is_accepting(initial))
+        return options_.utf8 ? utf8::boundaries(bytes, n) : n + 1;
+    if (!literal.empty() &&
+        memmem(str, n, literal.data(), literal.size()) == nullptr)
     {
-        char val = s[i], type = get_range_type(s[i]);
-        if (type == 'i')
-            throw Regex_Invalid_Range_Error();
+        return 0;
+    }
 
-        //Dont put an "or" on the first guy in the range.
-        if (i != 1)
-            ret.append(1, '|');
-        ret.append(1, val);
-        
-        if (s[i + 1] == ']')
-            break;
-        if (isalnum(s[i + 1]))
-            ++i;
-        else if (s[i + 1] == '-')
+    //After a match, S starts over from the next byte.
+    size_t count = 0, start = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        state = S.next_state(state, bytes[i]);
+        if (S.is_accepting(state))
         {
-            i += 2;
-            
-            if (s[i] == ']')
-                throw Regex_Invalid_Range_Error();
-            
-            char upper_bound = s[i];
-            if (get_range_type(upper_bound) != type ||
-                val > upper_bound)
-            {
-                throw Regex_Invalid_Range_Error();
-            }
-            
-            //Start at val + 1 because we already put val into the
-            //return string.
-            for (int j = val + 1; j <= upper_bound; ++j)
+            ++count;
+            state = initial;
+            start = i + 1;
+        }
+        else if (state == Lazy_DFA::over_limit)
+        {
+            //The NFA finds the rest of the matches.
+            size_t end;
+            while ((end = S.nfa_prefix(bytes + start, n - start, false)) !=
+                   Regex_Span::npos)
             {
-                ret.append(1, '|');
-                ret.append(1, (char)j);
+                ++count;
+                start += end;
             }
-            
-            i += 1;
+            return count;
         }
-        else
-            throw Regex_Invalid_Range_Error();
     }
-    
-    ret.append(1, ')');
+
+    return count;
+}
+
+// Calls f(begin, end) for every line of the buffer that matches.
+template< typename F >
+void Regex::for_each_matching_line(const char * str, size_t n, F f) const
+{
+    const uint8_t * bytes = (const uint8_t *)str;
+    if (M_ != nullptr)
+        return M_->for_each_matching_line(bytes, n, f);
+
+    helper::Line_Splitter lines(bytes, n);
+    for (size_t begin = 0, end; begin < n; begin = end + 1)
+    {
+        end = lines.next(begin);
+        if (operator()(str + begin, end - begin))
+            f(begin, end);
+    }
+    return;
+}
+
+size_t Regex::count_matching_lines(const std::string & str) const
+{ return count_matching_lines(str.data(), str.size()); }
+
+size_t Regex::count_matching_lines(const char * str, size_t n) const
+{
+    size_t count = 0;
+    for_each_matching_line(str, n, [&](size_t, size_t) { ++count; });
+    return count;
+}
+
+std::vector< Regex_Span > Regex::matching_lines(const std::string & str) const
+{ return matching_lines(str.data(), str.size()); }
+
+std::vector< Regex_Span > Regex::matching_lines(const char * str, size_t n) const
+{
+    std::vector< Regex_Span > ret;
+    for_each_matching_line(str, n, [&](size_t begin, size_t end)
+                           { ret.push_back({begin, end}); });
     return ret;
 }
 
 /*
-  a{4} = (aaaa)
-  a{2-3} = (aa|aaa)
-  a{2,} = aa(a)*
+  Returns where the match that ends first ends, or npos if there is
+  none. The required literal is searched for first, and the search
+  DFA is only run around its occurrences when matches have a bounded
+  length.
 */
-std::string Regex::get_power_string(const std::string & s,
-                                    const std::string & p) const
+size_t Regex::search_end(const char * str, size_t n) const
 {
-    std::string ret = "";
-
-    int i = 1, lower_bound = 0;
-    while (p[i] != ',' and p[i] != '}')
+    const size_t npos = Regex_Span::npos;
+    const Lazy_DFA & S = search_dfa();
+    const uint8_t * bytes = (const uint8_t *)str;
+    const std::string & literal = literals_.required;
+    size_t max_length = max_length_;
+
+    if (n < min_length_)
+        return npos;
+
+    //Runs S from state over bytes[from] to bytes[to - 1], stopping as
+    //soon as a match has ended, where it returns the end, or S is over
+    //its memory limit.
+    auto scan = [&](Lazy_DFA::State & state, size_t from, size_t to) -> size_t
     {
-        if (!isdigit(p[i]))
-            throw Regex_Invalid_Power_Error();
-            
-        lower_bound *= 10;
-        lower_bound += p[i] - '0';
+        if (S.is_accepting(state))
+            return from;
+        for (size_t i = from; i < to; ++i)
+        {
+            state = S.next_state(state, bytes[i]);
+            if (S.is_accepting(state))
+                return i + 1;
+            if (state == Lazy_DFA::over_limit)
+                return i;
+        }
+        return npos;
+    };
 
-        ++i;
-    }
+    //Once S is over its limit, the whole string is searched by its NFA.
+    auto found = [&](Lazy_DFA::State state, size_t end) -> size_t
+    { return state != Lazy_DFA::over_limit ? end : S.nfa_prefix(bytes, n, false); };
 
-    //Only one power
-    if (p[i] == '}')
+    Lazy_DFA::State state = S.initial_state();
+    size_t end;
+    if (literal.empty() || max_length == helper::DFA_Analysis::unbounded)
     {
-        for (int j = 0; j < lower_bound; ++j)
-            ret += s;
-    }
+        if (!literal.empty() &&
+            memmem(str, n, literal.data(), literal.size()) == nullptr)
+        {
+            return npos;
+        }
 
-    //Must be at least that power.
-    else if (p[i + 1] == '}')
-    {
-        for (int j = 0; j < lower_bound; ++j)
-            ret += s;
-        ret += s + "*";
+        //Matches that end with a literal are found backwards from the
+        //occurrences of the literal.
+        if (!literals_.suffix.empty() && suffix_search_end(str, n, end))
+            return end;
+
+        end = scan(state, 0, n);
+        return end == npos ? npos : found(state, end);
     }
 
-    //Range of powers.
-    else
+    /*
+      A match holding the occurrence of the literal at p lies within
+      [p + |literal| - max_length, p + max_length), so only those
+      windows are scanned. When a window overlaps the part already
+      scanned, the scan carries on from where it stopped.
+    */
+    size_t scanned = 0;
+    const char * hit = str;
+    while ((hit = (const char *)memmem(hit, str + n - hit,
+                                       literal.data(), literal.size())) != nullptr)
     {
-        int upper_bound = 0;
-        ++i;
+        size_t p = hit - str;
+        size_t from = p + literal.size() > max_length ?
+            p + literal.size() - max_length : 0;
+        size_t to = std::min(n, p + max_length);
 
-        while (p[i] != '}')
+        if (from > scanned)
+        {
+            state = S.initial_state();
+            scanned = from;
+        }
+        if (scanned < to)
         {
-            if (!isdigit(p[i]))
-                throw Regex_Invalid_Power_Error();
+            end = scan(state, scanned, to);
+            if (end != npos)
+                return found(state, end);
+        }
+        scanned = std::max(scanned, to);
 
-            upper_bound *= 10;
-            upper_bound += p[i] - '0';
+        ++hit;
+    }
 
-            ++i;
-        }
+    return npos;
+}
 
-        ret.append(1, '(');
-        for (int j = lower_bound; j <= upper_bound; ++j)
+/*
+  Reverse suffix search. Every match ends with the suffix literal, so
+  a match ends at e only if the suffix occurs just before e. For each
+  occurrence in order, the reverse DFA is run backwards from e, and the
+  first one it accepts from is where the first match ends.
+
+  A backward run that reaches the end of the previous occurrence could
+  make the search quadratic, as could a reverse DFA over its memory
+  limit, so then false is returned and the caller searches forwards.
+  Otherwise end is set to the end of the first match, or npos.
+*/
+bool Regex::suffix_search_end(const char * str, size_t n, size_t & end) const
+{
+    const Lazy_DFA & R = reverse_dfa();
+    const uint8_t * bytes = (const uint8_t *)str;
+    const std::string & suffix = literals_.suffix;
+
+    size_t floor = 0;
+    const char * hit = str;
+    while ((hit = (const char *)memmem(hit, str + n - hit,
+                                       suffix.data(), suffix.size())) != nullptr)
+    {
+        end = hit - str + suffix.size();
+        Lazy_DFA::State state = R.initial_state();
+        size_t i = end;
+        while (!R.is_dead(state) && !R.is_accepting(state))
         {
-            if (j != lower_bound)
-                ret.append(1, '|');
-            
-            for (int k = 0; k < j; ++k)
-                ret += s;
+            if (i == floor && floor > 0)
+                return false;
+            if (i == 0)
+                break;
+            state = R.next_state(state, bytes[--i]);
+            if (state == Lazy_DFA::over_limit)
+                return false;
         }
-        ret.append(1, ')');
+        if (R.is_accepting(state))
+            return true;
+
+        floor = end;
+        ++hit;
     }
-    
-    return ret;
-}
 
+    end = Regex_Span::npos;
+    return true;
+}
 
-std::string Regex::pop_prev_expression(std::string & s,
-                                       int & str_begin,
-                                       int & str_end )
+bool Regex::literal_alternation(std::vector< std::string > & words) const
 {
-    if (s == "")
-        return "";
-    
-    int balance = 0;
-    do
+    int root = root_;
+    while (nodes_[root].type == Regex_Node::GROUP)
+        root = nodes_[root].children[0];
+    const Regex_Node & r = nodes_[root];
+    if (r.type != Regex_Node::UNION)
+        return false;
+
+    //Nested unions such as "(a|b)|c" are flattened.
+    words.clear();
+    std::vector< int > check_stack(r.children.rbegin(), r.children.rend());
+    while (!check_stack.empty())
     {
-        if (str_begin - 1 >= 0 &&
-            regular_symbols.find(s[str_begin]) != regular_symbols.end() &&
-            s[str_begin - 1] == '/')
+        int node = check_stack.back();
+        check_stack.pop_back();
+        if (nodes_[node].type == Regex_Node::GROUP)
         {
-            --str_begin;
+            check_stack.push_back(nodes_[node].children[0]);
+            continue;
         }
-
-        else
+        if (nodes_[node].type == Regex_Node::UNION)
         {
-            if (s[str_begin] == ')')
-                balance += 1;
-        
-            else if (s[str_begin] == '(')
-                balance -= 1;
-
-            if (balance < 0)
-                throw Regex_Unbalanced_Parenthesized_Expression_Error();
+            const std::vector< int > & children = nodes_[node].children;
+            check_stack.insert(check_stack.end(),
+                               children.rbegin(), children.rend());
+            continue;
         }
         
-        --str_begin;
-                
-    } while (balance > 0 && str_begin >= 0);
-    ++str_begin;
+        Regex_Literals l = node_literals(node);
+        if (!l.exact)
+            return false;
+        words.push_back(l.prefix);
+    }
 
-    if (balance != 0)
-        throw Regex_Unbalanced_Parenthesized_Expression_Error();
-    
-    std::string ret = s.substr(str_begin, str_end - str_begin);
+    return true;
+}
 
-    // pop string.
-    s = s.substr(0, s.size() - (str_end - str_begin));
+bool Regex::can_still_match(const std::string & prefix) const
+{
+    const uint8_t * bytes = (const uint8_t *)prefix.data();
+    if (A_ != nullptr)
+        return A_->can_still_match(bytes, prefix.size());
+    if (M_ == nullptr)
+        return nfa().can_still_match(bytes, prefix.size());
+    return M_->can_still_match(prefix);
+}
+
+size_t Regex::min_length() const
+{ return min_length_; }
+
+size_t Regex::max_length() const
+{ return max_length_; }
 
+size_t Regex::fallbacks() const
+{
+    size_t ret = 0;
+    if (L_ != nullptr)
+        ret += L_->fallbacks();
+    if (D_ != nullptr)
+        ret += D_->fallbacks();
+    Lazy_DFA * S = S_.load(std::memory_order_acquire);
+    if (S != nullptr)
+        ret += S->fallbacks();
     return ret;
 }
 
-void Regex::format_expression()
+bool Regex::operator()(const std::vector< std::string > & str) const
 {
-    // Formatted expression
-    std::string f_expression = expression_;
-
-    //Remove all epsilon
-    if (epsilon_ != "")
+    std::string bytes;
+    for (const std::string & c : str)
     {
-        int len = epsilon_.size();
-        for (int i = 0; i < int(f_expression.size()) - len; ++i)
-            if (f_expression.substr(i, len) == epsilon_)
-                f_expression.erase(i--, len);
+        // Epsilon is skipped, and anything that is not a single
+        // character is obviously not in the language of this regex.
+        if (c == "" || c == epsilon_)
+            continue;
+        if (c.size() != 1)
+            return false;
+        
+        bytes += c;
     }
     
-    regular_expression_ = "";
-    int global_balance = 0;
-    for (int i = 0, n = f_expression.size(); i < n; ++i)
-    { 
-        if (f_expression[i] == '[')
-        {
-            int start = i;
-            while (f_expression[i] != ']')
-            {    
-                ++i;
-                
-                if (i >= n)
-                    throw Regex_Invalid_Range_Error();
-                if (f_expression[i] == '/')
-                    throw Regex_Invalid_Escape_Character_Error();
-            }
+    return operator()(bytes.data(), bytes.size());
+}
 
-            regular_expression_.append(
-                get_range_string(f_expression.substr(start, i - (start - 1)))
-                );
-        }
+/*
+  Returns the computational NFA as an NFA< std::string, std::string >.
+  States are named "q0", "q1", ..., each symbol is a string of one
+  character, and epsilon is the empty string. A class transition
+  becomes one transition per character in the class.
+*/
+NFA< std::string, std::string > Regex::to_nfa() const
+{
+    typedef std::pair< std::string, std::string > Q_t_S_t;
+    typedef std::unordered_map< Q_t_S_t, std::unordered_set< std::string > > D_t;
+    
+    std::string epsilon = "";
+    std::unordered_set< std::string > sigma = { epsilon };
+    std::unordered_set< std::string > states, accept_states;
+    D_t delta;
+
+    const NFA< uint8_t, uint32_t > & N = nfa();
+    for (uint32_t q = 0; q < N.size(); ++q)
+    {
+        std::string from = "q" + std::to_string(q);
+        states.insert(from);
+        if (N.is_accepting(q))
+            accept_states.insert(from);
+
+        for (const uint32_t & r : N.epsilon_transitions(q))
+            delta[{from, epsilon}].insert("q" + std::to_string(r));
 
-        else if (f_expression[i] == '{')
+        for (const NFA< uint8_t, uint32_t >::Edge & e : N.transitions(q))
         {
-            int pow_start = i;
-            while (f_expression[i] != '}')
+            for (int c = 0; c < 256; ++c)
             {
-                ++i;
-                if (i >= n)
-                    throw Regex_Invalid_Power_Error();
-                if (f_expression[i] == '/')
-                    throw Regex_Invalid_Escape_Character_Error();
+                if (!e.symbols.contains(uint8_t(c)))
+                    continue;
+                
+                std::string symbol = std::to_string(char(c));
+                sigma.insert(symbol);
+                delta[{from, symbol}].insert("q" + std::to_string(e.to));
             }
+        }
+    }
 
-            std::string pow = f_expression.substr(pow_start, i - (pow_start - 1));
+    return NFA< std::string, std::string >(
+        sigma,
+        states,
+        "q" + std::to_string(N.initial_state()),
+        accept_states,
+        delta,
+        epsilon);
+}
 
-            int str_end = regular_expression_.size(),
-                str_begin = regular_expression_.size() - 1;
+DFA< uint8_t, uint32_t > Regex::to_dfa() const
+{
+    if (A_ != nullptr)
+        return A_->trie_dfa(options_.dfa_memory_limit);
+    if (D_ != nullptr)
+        return D_->to_dfa();
+    if (M_ == nullptr)
+        return nfa().to_dfa(nullptr, options_.dfa_memory_limit,
+                            options_.thread_count());
+    return *M_;
+}
 
-            //Pop old expression off of the string.
-            std::string target = pop_prev_expression(regular_expression_,
-                                                     str_begin,
-                                                     str_end);
+int Regex::derivative_term(helper::Derivative_Terms & terms) const
+{ return derivative_term(dfa_root_, terms); }
 
-            //Adjust regular_expression_ variable.
-            regular_expression_.append(get_power_string(target, pow));
-        }
+//////////// PRIVATE FUNCTIONS \\\\\\\\\\\\
 
-        else if(f_expression[i] == '+')
-        {   
-            int str_end = regular_expression_.size(),
-                str_begin = regular_expression_.size() - 1;
-                
+// A node of the given type with nothing else set.
+static Regex_Node blank_node(Regex_Node::Type type)
+{
+    Regex_Node node;
+    node.type = type;
+    node.symbol = '\0';
+    node.min = 0;
+    node.max = 0;
+    node.group = 0;
+    return node;
+}
 
-            std::string target = pop_prev_expression(regular_expression_,
-                                                     str_begin,
-                                                     str_end);
-            
-            regular_expression_.append(target + target + "*");
-        }
+int Regex::new_node(Regex_Node::Type type)
+{
+    nodes_.push_back(blank_node(type));
+    return nodes_.size() - 1;
+}
 
-        else if (f_expression[i] == '?')
-        {
-            int str_end = regular_expression_.size(),
-                str_begin = regular_expression_.size() - 1;
-                
+/*
+  union := concatenation ('|' concatenation)*
 
-            std::string target = pop_prev_expression(regular_expression_,
-                                                     str_begin,
-                                                     str_end);
-            regular_expression_.append("(" + target + "|)");
-        }
+  An empty side of a union is epsilon, so "a|" accepts "" and "a".
+*/
+int Regex::parse_union(const std::string & s, int & i)
+{
+    int n = s.size();
+    int first = parse_concatenation(s, i);
+    if (i >= n || s[i] != '|')
+        return first;
+
+    int node = new_node(Regex_Node::UNION);
+    nodes_[node].children.push_back(first);
+    while (i < n && s[i] == '|')
+    {
+        ++i;
+        //nodes_ may grow while parsing, so do not hold a reference.
+        int child = parse_concatenation(s, i);
+        nodes_[node].children.push_back(child);
+    }
+
+    return node;
+}
+
+// concatenation := repetition*
+int Regex::parse_concatenation(const std::string & s, int & i)
+{
+    int n = s.size();
+    std::vector< int > children;
+    while (i < n && s[i] != '|' && s[i] != ')')
+        children.push_back(parse_repetition(s, i));
+
+    if (children.empty())
+        return new_node(Regex_Node::EPSILON);
+    if (children.size() == 1)
+        return children[0];
+
+    int node = new_node(Regex_Node::CONCATENATION);
+    nodes_[node].children = children;
+    return node;
+}
+
+/*
+  repetition := atom ('*' | '+' | '?' | power)*
+
+  Every operator becomes a single REPETITION node with a lower and
+  upper bound. Nothing is expanded here, a{2,1000} is one node.
+*/
+int Regex::parse_repetition(const std::string & s, int & i)
+{
+    int n = s.size(), node;
+    
+    //An operator with nothing in front of it applies to epsilon.
+    if (s[i] == '*' || s[i] == '+' || s[i] == '?' || s[i] == '{')
+        node = new_node(Regex_Node::EPSILON);
+    else
+        node = parse_atom(s, i);
 
-        else if (f_expression[i] == '/')
+    bool unbounded = false;
+    while (i < n && (s[i] == '*' || s[i] == '+' ||
+                     s[i] == '?' || s[i] == '{'))
+    {
+        //++ or ** or +* or *+ or *? or {2,}? ...
+        if (unbounded)
+            throw Regex_NFA_Construction_Error();
+        
+        int min = 0, max = -1;
+        if (s[i] == '*')
+            ++i;
+        else if (s[i] == '+')
         {
-            if (i == n - 1)
-                throw Regex_Invalid_Escape_Character_Error();
-            
-            if (regular_symbols.find(f_expression[i + 1]) != regular_symbols.end())
-                regular_expression_.append(1, '/');
-            
-            regular_expression_.append(1, f_expression[i + 1]);
-            
+            min = 1;
             ++i;
         }
-
-        else if (f_expression[i] == ']')
-            throw Regex_Invalid_Range_Error();
-        else if (f_expression[i] == '}')
-            throw Regex_Invalid_Power_Error();
-        
-        else
+        else if (s[i] == '?')
         {
-            if (i - 1 < 0 || f_expression[i - 1] != '/')
-            {
-                if (f_expression[i] == '(')
-                    ++global_balance;
-                else if (f_expression[i] == ')')
-                    --global_balance;
-            }
-
-            //Append character
-            regular_expression_.append(1, f_expression[i]);
+            max = 1;
+            ++i;
         }
-    }
+        else
+            parse_power(s, i, min, max);
 
-    if (global_balance != 0)
-        throw Regex_Unbalanced_Parenthesized_Expression_Error();
+        int r = new_node(Regex_Node::REPETITION);
+        nodes_[r].min = min;
+        nodes_[r].max = max;
+        nodes_[r].children.push_back(node);
+        node = r;
 
-    std::cout << "regex: " << regular_expression_ << std::endl;
-    
-    return;
+        unbounded = max < 0;
+    }
+
+    return node;
 }
 
-NFA< std::string, std::string > Regex::nfa_of_epsilon(
-    const std::unordered_set< std::string > & sigma,
-    const std::string & epsilon,
-    int & state_num
-    )
+int Regex::parse_atom(const std::string & s, int & i)
 {
-    std::string q0 = get_next_state_str(state_num);
-    
-    std::unordered_set< std::string >
-        states = {q0},
-        accept_states = {q0};
-    
-    std::unordered_map< std::pair< std::string, std::string >,
-                        std::unordered_set< std::string > > delta;
-    delta[{q0, epsilon}] = {q0};
+    int n = s.size();
     
-    return NFA< std::string, std::string >(sigma,
-                                           states,
-                                           q0,
-                                           accept_states,
-                                           delta,
-                                           epsilon);
-}
-
-NFA< std::string, std::string > Regex::nfa_of_symbol(
-    const std::unordered_set< std::string > & sigma,
-    const std::string & epsilon,
-    const std::string & s,
-    int & state_num
-    )
-{
-    std::string q0 = get_next_state_str(state_num),
-        q1 = get_next_state_str(state_num);
-    
-    std::unordered_set< std::string >
-        states = {q0, q1},
-        accept_states = {q1};
-    
-    std::unordered_map< std::pair< std::string, std::string >,
-                        std::unordered_set< std::string > > delta;
+    //Every parenthesized expression is a group, numbered by its '('.
+    if (s[i] == '(')
+    {
+        ++i;
+        int group = ++groups_;
+        int child = parse_union(s, i);
+        if (i >= n || s[i] != ')')
+            throw Regex_Unbalanced_Parenthesized_Expression_Error();
+        ++i;
 
-    delta[{q0, s}] = {q1};
+        int node = new_node(Regex_Node::GROUP);
+        nodes_[node].group = group;
+        nodes_[node].children.push_back(child);
+        return node;
+    }
 
-    return NFA< std::string, std::string >(sigma,
-                                           states,
-                                           q0,
-                                           accept_states,
-                                           delta,
-                                           epsilon);
-}
+    if (s[i] == '[')
+        return parse_range(s, i);
+    if (s[i] == '.')
+    {
+        ++i;
+        if (!options_.utf8)
+        {
+            int node = new_node(Regex_Node::CLASS);
+            nodes_[node].symbols = dot;
+            return node;
+        }
+        
+        int node = new_node(Regex_Node::UNICODE_CLASS);
+        nodes_[node].ranges = utf8::complement({ {'\n', '\n'} });
+        return node;
+    }
+    if (s[i] == ']')
+        throw Regex_Invalid_Range_Error();
+    if (s[i] == '}')
+        throw Regex_Invalid_Power_Error();
+
+    if (s[i] == '/')
+    {
+        if (i == n - 1)
+            throw Regex_Invalid_Escape_Character_Error();
+        ++i;
+    }
 
+    return parse_symbol(s, i);
+}
 
-NFA< std::string, std::string > Regex::construct_nfa_recursive(
-    const std::unordered_set< std::string > & sigma,
-    const std::string & epsilon,
-    const std::string & s,
-    int & state_num
-    )
+/*
+  Reads one character. In UTF-8 mode a multi-byte character is read
+  whole, as a concatenation of its bytes, so that an operator after it
+  applies to the entire character. Bytes that are not valid UTF-8 are
+  read one at a time.
+*/
+int Regex::parse_symbol(const std::string & s, int & i)
 {
-    //Kleene start of epsilon or epsilon itself.
-    if (s.size() == 0 || s.size() == 1 && s[0] == '*')
+    int start = i;
+    uint32_t c;
+    if (!options_.utf8 || !utf8::decode(s, i, c) || i - start == 1)
     {
-        return NFA< std::string, std::string >(
-            nfa_of_epsilon(sigma,
-                           epsilon,
-                           state_num)
-            );
+        i = start + 1;
+        
+        int node = new_node(Regex_Node::SYMBOL);
+        nodes_[node].symbol = s[start];
+        return node;
+    }
+
+    int node = new_node(Regex_Node::CONCATENATION);
+    for (int k = start; k < i; ++k)
+    {
+        int child = new_node(Regex_Node::SYMBOL);
+        nodes_[child].symbol = s[k];
+        nodes_[node].children.push_back(child);
+    }
+
+    return node;
+}
+
+/*
+  A range is a set of characters matched by a single transition.
+
+  "[1-4]" --> any of 1, 2, 3, 4
+  "[a-dA-E1-3]" --> any of a to d, A to E, 1 to 3
+  "[^/]a]" --> any character except ']' and 'a'
+
+  A leading '^' negates the range. Ranges go off of the byte values (or
+  code points, in UTF-8 mode) of their first and last characters,
+  which must be in order. '-' is a plain character at the start or end
+  of a range, and any character may be escaped with '/'.
+*/
+int Regex::parse_range(const std::string & s, int & i)
+{
+    int n = s.size();
+    ++i;
+
+    bool negate = false;
+    if (i < n && s[i] == '^')
+    {
+        negate = true;
+        ++i;
+    }
+
+    std::vector< utf8::Range > ranges;
+    while (true)
+    {
+        if (i >= n)
+            throw Regex_Invalid_Range_Error();
+        if (s[i] == ']')
+            break;
+
+        uint32_t lower_bound = parse_range_symbol(s, i),
+            upper_bound = lower_bound;
+        if (i + 1 < n && s[i] == '-' && s[i + 1] != ']')
+        {
+            ++i;
+            upper_bound = parse_range_symbol(s, i);
+            if (lower_bound > upper_bound)
+                throw Regex_Invalid_Range_Error();
+        }
+        
+        ranges.push_back({lower_bound, upper_bound});
     }
+    ++i;
     
-    NFA< std::string, std::string > * N_ptr = nullptr;
+    if (ranges.empty())
+        throw Regex_Invalid_Range_Error();
+    utf8::normalize(ranges);
     
-    for (int i = 0, n = s.size(); i < n; ++i)
+    // Anything that may need more than one byte is compiled to a
+    // UTF-8 automaton, the rest is a plain set of bytes.
+    if (options_.utf8 && (negate || ranges.back().second >= 0x80))
     {
-        if (regular_symbols.find(s[i]) == regular_symbols.end() ||
-            s[i] == '/')
-        {
-            if (s[i] == '/')
-                ++i;
-            
-            NFA< std::string, std::string > new_N =
-                nfa_of_symbol(sigma,
-                              epsilon,
-                              std::to_string(s[i]),
-                              state_num);
+        int node = new_node(Regex_Node::UNICODE_CLASS);
+        nodes_[node].ranges = negate ? utf8::complement(ranges) : ranges;
+        return node;
+    }
+
+    Byte_Set set;
+    for (const utf8::Range & r : ranges)
+        set.insert(uint8_t(r.first), uint8_t(r.second));
+    if (negate)
+        set = set.complement();
+
+    int node = new_node(Regex_Node::CLASS);
+    nodes_[node].symbols = set;
+    return node;
+}
+
+// Reads one, possibly escaped, character of a range.
+uint32_t Regex::parse_range_symbol(const std::string & s, int & i) const
+{
+    if (s[i] == '/')
+    {
+        if (i + 1 >= int(s.size()))
+            throw Regex_Invalid_Escape_Character_Error();
+        ++i;
+    }
+
+    uint32_t c;
+    if (options_.utf8 && utf8::decode(s, i, c))
+        return c;
+
+    return uint8_t(s[i++]);
+}
+
+/*
+  a{4} = a repeated 4 times
+  a{2,3} = a repeated 2 or 3 times
+  a{2,} = a repeated at least 2 times (max = -1)
+*/
+void Regex::parse_power(const std::string & s, int & i,
+                        int & min, int & max) const
+{
+    int n = s.size();
+    ++i;
+
+    min = 0;
+    while (i < n && s[i] != ',' && s[i] != '}')
+    {
+        if (s[i] == '/')
+            throw Regex_Invalid_Escape_Character_Error();
+        if (!isdigit(s[i]))
+            throw Regex_Invalid_Power_Error();
             
-            if (i + 1 < n && s[i + 1] == '*')
+        min *= 10;
+        min += s[i] - '0';
+
+        ++i;
+    }
+    if (i >= n)
+        throw Regex_Invalid_Power_Error();
+
+    //Only one power
+    if (s[i] == '}')
+    {
+        max = min;
+        ++i;
+        return;
+    }
+
+    ++i;
+    if (i >= n)
+        throw Regex_Invalid_Power_Error();
+
+    //Must be at least that power.
+    if (s[i] == '}')
+    {
+        max = -1;
+        ++i;
+        return;
+    }
+
+    //Range of powers.
+    max = 0;
+    while (i < n && s[i] != '}')
+    {
+        if (s[i] == '/')
+            throw Regex_Invalid_Escape_Character_Error();
+        if (!isdigit(s[i]))
+            throw Regex_Invalid_Power_Error();
+
+        max *= 10;
+        max += s[i] - '0';
+
+        ++i;
+    }
+    if (i >= n || max < min)
+        throw Regex_Invalid_Power_Error();
+    ++i;
+
+    return;
+}
+
+// Returns the regular expression string of a node.
+std::string Regex::node_string(int node) const
+{
+    const Regex_Node & r = nodes_[node];
+    std::string ret = "";
+    
+    switch (r.type)
+    {
+    case Regex_Node::EPSILON:
+        break;
+        
+    case Regex_Node::SYMBOL:
+        if (symbols.find(r.symbol) != symbols.end())
+            ret.append(1, '/');
+        ret.append(1, r.symbol);
+        break;
+
+    case Regex_Node::CLASS:
+    {
+        if (r.symbols == dot)
+        {
+            ret = ".";
+            break;
+        }
+
+        // Write whichever of the set and its complement is smaller.
+        Byte_Set set = r.symbols;
+        ret = "[";
+        if (set.size() > 128)
+        {
+            ret += "^";
+            set = set.complement();
+        }
+        
+        for (int c = 0; c < 256; ++c)
+        {
+            if (!set.contains(uint8_t(c)))
+                continue;
+
+            int d = c;
+            while (d + 1 < 256 && set.contains(uint8_t(d + 1)))
+                ++d;
+
+            for (const int & k : {c, d})
             {
-                new_N = new_N.kleene_star(get_next_state_str(state_num));
-                ++i;
+                if (k == ']' || k == '-' || k == '^' || k == '/')
+                    ret.append(1, '/');
+                ret.append(1, char(k));
+
+                if (c == d)
+                    break;
+                if (k == c && d > c + 1)
+                    ret.append(1, '-');
             }
-            
-            if (N_ptr == nullptr)
+            c = d;
+        }
+        ret += "]";
+        break;
+    }
+    
+    case Regex_Node::UNICODE_CLASS:
+    {
+        if (r.ranges == utf8::complement({ {'\n', '\n'} }))
+        {
+            ret = ".";
+            break;
+        }
+
+        std::vector< utf8::Range > ranges = r.ranges;
+        ret = "[";
+        if (!ranges.empty() && ranges.back().second == utf8::max_code_point)
+        {
+            ret += "^";
+            ranges = utf8::complement(ranges);
+        }
+
+        for (const utf8::Range & range : ranges)
+        {
+            for (const uint32_t & k : {range.first, range.second})
             {
-                N_ptr = new NFA< std::string, std::string >(
-                    new_N
-                    );
+                if (k == ']' || k == '-' || k == '^' || k == '/')
+                    ret.append(1, '/');
+                ret += utf8::encode(k);
+
+                if (range.first == range.second)
+                    break;
+                if (k == range.first && range.second > range.first + 1)
+                    ret.append(1, '-');
             }
+        }
+        ret += "]";
+        break;
+    }
+    
+    case Regex_Node::CONCATENATION:
+        for (const int & child : r.children)
+        {
+            if (nodes_[child].type == Regex_Node::UNION)
+                ret += "(" + node_string(child) + ")";
             else
-            {
-                *N_ptr = nfa_concat< std::string, std::string >(
-                    *N_ptr,
-                    new_N
-                    );
-            }
+                ret += node_string(child);
         }
+        break;
 
-        else if (s[i] == '(')
+    case Regex_Node::UNION:
+    {
+        std::string delim = "";
+        for (const int & child : r.children)
         {
-            int start = i + 1, len = 0, balance = 1;
-            while (balance != 0)
-            {
-                //Skip over escape character.
-                if (s[start + len] == '/')
-                    ++len;
-                
-                else if (s[start + len] == '(')
-                    ++balance;
-                else if (s[start + len] == ')')
-                    --balance;
-                ++len;
-            }
-            --len;
+            ret += delim + node_string(child);
+            delim = "|";
+        }
+        break;
+    }
+    
+    case Regex_Node::GROUP:
+        ret = "(" + node_string(r.children[0]) + ")";
+        break;
+    
+    case Regex_Node::REPETITION:
+    {
+        const Regex_Node & child = nodes_[r.children[0]];
+        if (child.type == Regex_Node::SYMBOL ||
+            child.type == Regex_Node::CLASS ||
+            child.type == Regex_Node::UNICODE_CLASS ||
+            child.type == Regex_Node::GROUP)
+            ret = node_string(r.children[0]);
+        else
+            ret = "(" + node_string(r.children[0]) + ")";
+
+        if (r.min == 0 && r.max == -1)
+            ret += "*";
+        else if (r.min == 1 && r.max == -1)
+            ret += "+";
+        else if (r.min == 0 && r.max == 1)
+            ret += "?";
+        else if (r.min == r.max)
+            ret += "{" + std::to_string(r.min) + "}";
+        else if (r.max == -1)
+            ret += "{" + std::to_string(r.min) + ",}";
+        else
+            ret += "{" + std::to_string(r.min) + "," +
+                std::to_string(r.max) + "}";
+        break;
+    }
+    }
+
+    return ret;
+}
+
+// Keeps the literals within Regex_Literals::max_size bytes.
+static void limit_literals(Regex_Literals & l)
+{
+    const size_t m = Regex_Literals::max_size;
+    if (l.prefix.size() > m)
+    {
+        l.exact = false;
+        l.prefix.resize(m);
+    }
+    if (l.suffix.size() > m)
+        l.suffix.erase(0, l.suffix.size() - m);
+    if (l.required.size() > m)
+        l.required.resize(m);
+
+    return;
+}
+
+// Replaces the required literal with s if s is longer.
+static void prefer_longer(std::string & required, const std::string & s)
+{
+    if (s.size() > required.size())
+        required = s;
+    return;
+}
+
+// The literals of an expression that only matches s.
+static Regex_Literals exact_literals(const std::string & s)
+{
+    Regex_Literals ret;
+    ret.exact = true;
+    ret.prefix = ret.suffix = ret.required = s;
+    limit_literals(ret);
+    return ret;
+}
 
-            std::string sub_s = s.substr(start, len);
+// The literals of the concatenation of two expressions.
+static Regex_Literals concatenate_literals(const Regex_Literals & a,
+                                           const Regex_Literals & b)
+{
+    if (a.exact && b.exact)
+        return exact_literals(a.prefix + b.prefix);
 
-            NFA< std::string, std::string > new_N =
-                construct_nfa_recursive(sigma,
-                                        epsilon,
-                                        sub_s,
-                                        state_num);
+    Regex_Literals ret;
+    ret.prefix = a.exact ? a.prefix + b.prefix : a.prefix;
+    ret.suffix = b.exact ? a.suffix + b.suffix : b.suffix;
 
-            i += len + 1;
+    //Every match also holds the end of a followed by the start of b.
+    ret.required = a.required;
+    prefer_longer(ret.required, b.required);
+    prefer_longer(ret.required, a.suffix + b.prefix);
+    prefer_longer(ret.required, ret.prefix);
+    prefer_longer(ret.required, ret.suffix);
+    limit_literals(ret);
 
-            if (i + 1 < n && s[i + 1] == '*')
+    return ret;
+}
+
+/*
+  Returns the literals every match of a node must hold. Literals are
+  exact strings joined through concatenations and required
+  repetitions, and cut down to their common prefix and suffix at
+  unions. Anything optional holds no literal.
+*/
+Regex_Literals Regex::node_literals(int node) const
+{
+    const Regex_Node & r = nodes_[node];
+    
+    switch (r.type)
+    {
+    case Regex_Node::EPSILON:
+        return exact_literals("");
+        
+    case Regex_Node::SYMBOL:
+        return exact_literals(std::string(1, r.symbol));
+
+    case Regex_Node::CLASS:
+        if (r.symbols.size() == 1)
+            for (int c = 0; c < 256; ++c)
+                if (r.symbols.contains(uint8_t(c)))
+                    return exact_literals(std::string(1, char(c)));
+        return Regex_Literals();
+
+    case Regex_Node::UNICODE_CLASS:
+        if (r.ranges.size() == 1 && r.ranges[0].first == r.ranges[0].second)
+            return exact_literals(utf8::encode(r.ranges[0].first));
+        return Regex_Literals();
+
+    case Regex_Node::CONCATENATION:
+    {
+        Regex_Literals ret = node_literals(r.children[0]);
+        for (int k = 1, n = r.children.size(); k < n; ++k)
+            ret = concatenate_literals(ret, node_literals(r.children[k]));
+        return ret;
+    }
+
+    case Regex_Node::UNION:
+    {
+        Regex_Literals ret = node_literals(r.children[0]);
+        for (int k = 1, n = r.children.size(); k < n; ++k)
+        {
+            Regex_Literals l = node_literals(r.children[k]);
+            if (ret.exact && l.exact && ret.prefix == l.prefix)
+                continue;
+
+            ret.exact = false;
+            size_t i = 0;
+            while (i < ret.prefix.size() && i < l.prefix.size() &&
+                   ret.prefix[i] == l.prefix[i])
             {
-                new_N = new_N.kleene_star(get_next_state_str(state_num));
                 ++i;
             }
-            
-            if (N_ptr == nullptr)
-            {
-                N_ptr = new NFA< std::string, std::string >(
-                    new_N
-                    );
-            }
-            else
+            ret.prefix.resize(i);
+
+            i = 0;
+            while (i < ret.suffix.size() && i < l.suffix.size() &&
+                   ret.suffix[ret.suffix.size() - 1 - i] ==
+                   l.suffix[l.suffix.size() - 1 - i])
             {
-                *N_ptr = nfa_concat< std::string, std::string >(
-                    *N_ptr,
-                    new_N
-                    );
+                ++i;
             }
+            ret.suffix.erase(0, ret.suffix.size() - i);
         }
-        
-        else if (s[i] == '|')
+
+        if (!ret.exact)
+        {
+            ret.required = ret.prefix;
+            prefer_longer(ret.required, ret.suffix);
+        }
+        return ret;
+    }
+
+    case Regex_Node::GROUP:
+        return node_literals(r.children[0]);
+
+    case Regex_Node::REPETITION:
+    default:
+    {
+        if (r.max == 0)
+            return exact_literals("");
+        if (r.min == 0)
+            return Regex_Literals();
+
+        Regex_Literals l = node_literals(r.children[0]);
+        if (l.exact)
         {
-            if (N_ptr == nullptr)
+            //Every match starts and ends with the required copies.
+            if (l.prefix.empty())
+                return exact_literals("");
+            std::string s;
+            int copies = 0;
+            while (copies < r.min &&
+                   s.size() + l.prefix.size() <= Regex_Literals::max_size)
             {
-                N_ptr = new NFA< std::string, std::string >(
-                    nfa_of_epsilon(sigma,
-                                   epsilon,
-                                   state_num)
-                    );
+                s += l.prefix;
+                ++copies;
             }
-            
-            int start = i + 1, len = 0, balance = 0;
-            while (start + len < n && !(s[start + len] == '|' && balance == 0))
+            if (copies == r.min && r.min == r.max)
+                return exact_literals(s);
+
+            Regex_Literals ret;
+            ret.prefix = ret.suffix = ret.required = s;
+            return ret;
+        }
+
+        Regex_Literals ret = l;
+        if (r.min >= 2)
+            prefer_longer(ret.required, l.suffix + l.prefix);
+        limit_literals(ret);
+        return ret;
+    }
+    }
+}
+
+/*
+  Builds the tree N_ is built from, which matches the same strings as
+  the parsed tree of a node. The parsed tree is kept as it is for the
+  groups, and the new nodes are added to nodes_ bottom up:
+
+    groups         are dropped, only the Pike VM needs them
+    symbols        become classes of one byte
+    concatenation  is flattened, drops epsilon and merges x*x* into x*
+    union          is flattened, removes duplicates, merges its classes
+                   into one class and factors out the first, then the
+                   last, factor its alternatives share, so abc|abd|abe
+                   is ab[cde] and xa|ya is [xy]a
+    repetition     of epsilon, or at most 0 times, is epsilon, x{1} is
+                   x, (x*){m,n}, (x?)* and (x|epsilon)* are x*, and
+                   (x+){m,} is x{m,}
+
+  New nodes are interned by their contents, so equal subexpressions
+  are one node and duplicates are found by index. The order of the
+  alternatives of a union changes, which only the Pike VM would see.
+*/
+int Regex::simplify(int node)
+{
+    //nodes_ grows while simplifying, so do not hold a reference.
+    Regex_Node::Type type = nodes_[node].type;
+    std::vector< int > children = nodes_[node].children;
+    for (int & child : children)
+        child = simplify(child);
+
+    switch (type)
+    {
+    case Regex_Node::SYMBOL:
+    {
+        Regex_Node c = blank_node(Regex_Node::CLASS);
+        c.symbols.insert(uint8_t(nodes_[node].symbol));
+        return intern_node(c);
+    }
+
+    case Regex_Node::EPSILON:
+    case Regex_Node::CLASS:
+    case Regex_Node::UNICODE_CLASS:
+    {
+        Regex_Node r = nodes_[node];
+        return intern_node(r);
+    }
+
+    case Regex_Node::CONCATENATION:
+        return simplified_concatenation(children);
+
+    case Regex_Node::UNION:
+        return simplified_union(children);
+
+    case Regex_Node::GROUP:
+        return children[0];
+
+    case Regex_Node::REPETITION:
+    default:
+        return simplified_repetition(children[0], nodes_[node].min, nodes_[node].max);
+    }
+}
+
+// Returns the simplified node equal to node, adding it the first time.
+int Regex::intern_node(const Regex_Node & node)
+{
+    uint64_t h = node.type;
+    auto mix = [&](uint64_t x) { h = (h ^ x) * 0x9e3779b97f4a7c15ULL; };
+    for (int i = 0; i < 4; ++i)
+        mix(node.symbols.word(i));
+    for (const utf8::Range & range : node.ranges)
+        mix((uint64_t(range.first) << 32) | range.second);
+    mix((uint64_t(uint32_t(node.min)) << 32) | uint32_t(node.max));
+    for (const int & child : node.children)
+        mix(child);
+
+    auto range = interned_.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        const Regex_Node & other = nodes_[it->second];
+        if (other.type == node.type && other.symbols == node.symbols &&
+            other.ranges == node.ranges && other.min == node.min &&
+            other.max == node.max && other.children == node.children)
+            return it->second;
+    }
+
+    nodes_.push_back(node);
+    interned_.insert({h, int(nodes_.size()) - 1});
+    return nodes_.size() - 1;
+}
+
+// The concatenation of simplified nodes.
+int Regex::simplified_concatenation(const std::vector< int > & parts)
+{
+    std::vector< int > children;
+    for (const int & part : parts)
+    {
+        const Regex_Node & p = nodes_[part];
+        if (p.type == Regex_Node::EPSILON)
+            continue;
+
+        std::vector< int > pieces(1, part);
+        if (p.type == Regex_Node::CONCATENATION)
+            pieces = p.children;
+        for (const int & piece : pieces)
+        {
+            //x*x* is x*.
+            const Regex_Node & q = nodes_[piece];
+            if (!children.empty() && children.back() == piece &&
+                q.type == Regex_Node::REPETITION && q.min == 0 && q.max == -1)
+                continue;
+            children.push_back(piece);
+        }
+    }
+
+    if (children.empty())
+        return intern_node(blank_node(Regex_Node::EPSILON));
+    if (children.size() == 1)
+        return children[0];
+
+    Regex_Node c = blank_node(Regex_Node::CONCATENATION);
+    c.children = children;
+    return intern_node(c);
+}
+
+// The union of simplified nodes.
+int Regex::simplified_union(const std::vector< int > & alternatives)
+{
+    std::vector< int > children;
+    Byte_Set symbols;
+    bool classes = false;
+    for (const int & alternative : alternatives)
+    {
+        std::vector< int > flat(1, alternative);
+        if (nodes_[alternative].type == Regex_Node::UNION)
+            flat = nodes_[alternative].children;
+        for (const int & child : flat)
+        {
+            if (nodes_[child].type == Regex_Node::CLASS)
             {
-                if (s[start + len] == '(')
-                    ++balance;
-                if (s[start + len] == ')')
-                    --balance;
-                ++len;
+                symbols |= nodes_[child].symbols;
+                classes = true;
             }
-            if (balance == -1) 
-                --len;
+            else
+                children.push_back(child);
+        }
+    }
+    if (classes)
+    {
+        Regex_Node c = blank_node(Regex_Node::CLASS);
+        c.symbols = symbols;
+        children.push_back(intern_node(c));
+    }
+    std::sort(children.begin(), children.end());
+    children.erase(std::unique(children.begin(), children.end()),
+                   children.end());
+    if (children.size() == 1)
+        return children[0];
+
+    //The factors of a node, none for epsilon.
+    auto factors = [&](int node) -> std::vector< int >
+    {
+        const Regex_Node & r = nodes_[node];
+        if (r.type == Regex_Node::EPSILON)
+            return {};
+        if (r.type == Regex_Node::CONCATENATION)
+            return r.children;
+        return { node };
+    };
+
+    //Alternatives sharing their first factor, then their last one,
+    //are factored as in a trie of their factors.
+    std::vector< std::vector< int > > sequences;
+    for (const int & child : children)
+        sequences.push_back(factors(child));
+    for (const bool & last : { false, true })
+    {
+        std::vector< int > ends;
+        for (const std::vector< int > & f : sequences)
+            if (!f.empty())
+                ends.push_back(last ? f.back() : f.front());
+        std::sort(ends.begin(), ends.end());
+        if (std::adjacent_find(ends.begin(), ends.end()) == ends.end())
+            continue;
+
+        if (last)
+            for (std::vector< int > & f : sequences)
+                std::reverse(f.begin(), f.end());
+        std::sort(sequences.begin(), sequences.end());
+        return factored_union(sequences, 0, sequences.size(), 0, last);
+    }
+
+    Regex_Node u = blank_node(Regex_Node::UNION);
+    u.children = children;
+    return intern_node(u);
+}
+
+/*
+  The union of sequences[begin, end), sorted sequences of factors that
+  all start with the same depth factors, without those factors. Runs
+  of sequences sharing their next factor are factored out, and the
+  sequences are written backwards if reversed.
+*/
+int Regex::factored_union(const std::vector< std::vector< int > > & sequences,
+                          size_t begin, size_t end, size_t depth, bool reversed)
+{
+    std::vector< int > alternatives;
+    for (size_t i = begin, j; i < end; i = j)
+    {
+        const std::vector< int > & f = sequences[i];
+        j = i + 1;
+        if (f.size() == depth)
+        {
+            alternatives.push_back(intern_node(blank_node(Regex_Node::EPSILON)));
+            continue;
+        }
+        while (j < end && sequences[j][depth] == f[depth])
+            ++j;
+
+        if (j == i + 1)
+        {
+            std::vector< int > rest(f.begin() + depth, f.end());
+            if (reversed)
+                std::reverse(rest.begin(), rest.end());
+            alternatives.push_back(simplified_concatenation(rest));
+            continue;
+        }
+
+        int rest = factored_union(sequences, i, j, depth + 1, reversed);
+        alternatives.push_back(reversed ?
+                               simplified_concatenation({ rest, f[depth] }) :
+                               simplified_concatenation({ f[depth], rest }));
+    }
+    return simplified_union(alternatives);
+}
+
+// The repetition of a simplified node.
+int Regex::simplified_repetition(int child, int min, int max)
+{
+    Regex_Node c = nodes_[child];
+    if (max == 0 || c.type == Regex_Node::EPSILON)
+        return intern_node(blank_node(Regex_Node::EPSILON));
+    if (min == 1 && max == 1)
+        return child;
+
+    if (c.type == Regex_Node::REPETITION && c.min == 0 && c.max == -1)
+        return child;
+    if (max == -1 && c.type == Regex_Node::REPETITION)
+    {
+        //(x+)* and (x?)* are x*, and (x+){m,} is x{m,}.
+        if (c.max == -1 && c.min == 1)
+            return simplified_repetition(c.children[0], min, -1);
+        if (c.min == 0 && c.max == 1)
+            return simplified_repetition(c.children[0], 0, -1);
+    }
+
+    if (max == -1 && c.type == Regex_Node::UNION)
+    {
+        //(x|epsilon){m,} is x*.
+        std::vector< int > rest;
+        for (const int & alternative : c.children)
+            if (nodes_[alternative].type != Regex_Node::EPSILON)
+                rest.push_back(alternative);
+        if (rest.size() < c.children.size())
+            return simplified_repetition(simplified_union(rest), 0, -1);
+    }
 
-            i += len;
+    Regex_Node r = blank_node(Regex_Node::REPETITION);
+    r.children.push_back(child);
+    r.min = min;
+    r.max = max;
+    return intern_node(r);
+}
 
-            if (len == 0)
+void Regex::format_expression()
+{
+    Stats_Timer timer(collected_stats(), "parse");
+    
+    // Formatted expression
+    std::string f_expression = expression_;
+
+    //Remove all epsilon
+    if (epsilon_ != "")
+    {
+        int len = epsilon_.size();
+        for (int i = 0; i <= int(f_expression.size()) - len; ++i)
+            if (f_expression.substr(i, len) == epsilon_)
+                f_expression.erase(i--, len);
+    }
+
+    //About one node per character, and one more per concatenation.
+    nodes_.clear();
+    nodes_.reserve(f_expression.size() + f_expression.size() / 4 + 1);
+    groups_ = 0;
+    int i = 0;
+    root_ = parse_union(f_expression, i);
+
+    // parse_union only stops early on a ')' with no matching '('.
+    if (i != int(f_expression.size()))
+        throw Regex_Unbalanced_Parenthesized_Expression_Error();
+
+    regular_expression_ = node_string(root_);
+    literals_ = node_literals(root_);
+    
+    return;
+}
+
+/*
+  Adds the states and transitions of a node to N and returns the
+  (initial, accepting) states of the piece of NFA that was built.
+  Everything is built into the one NFA so no intermediate NFA objects
+  are ever copied.
+*/
+Regex::Fragment Regex::construct_nfa_recursive(
+    int node,
+    NFA< uint8_t, uint32_t > & N,
+    std::vector< int > * saves
+    ) const
+{
+    const Regex_Node & r = nodes_[node];
+    
+    switch (r.type)
+    {
+    case Regex_Node::EPSILON:
+    {
+        uint32_t q0 = N.add_state();
+        return {q0, q0};
+    }
+        
+    case Regex_Node::SYMBOL:
+    case Regex_Node::CLASS:
+    {
+        uint32_t q0 = N.add_state(), q1 = N.add_state();
+        if (r.type == Regex_Node::SYMBOL)
+        {
+            Byte_Set set;
+            set.insert(uint8_t(r.symbol));
+            N.add_transition(q0, set, q1);
+        }
+        else
+            N.add_transition(q0, r.symbols, q1);
+        return {q0, q1};
+    }
+
+    case Regex_Node::UNICODE_CLASS:
+    {
+        /*
+          Each range of code points is split into sequences of byte
+          ranges, e.g. [E1-EC][80-BF][80-BF], and each sequence becomes
+          a chain of states ending in q1. Chains are built from the end,
+          and a (byte range, next state) pair that was already built is
+          reused, so sequences that end the same way share their
+          suffix. Edges out of q0 that lead to the same state are
+          merged into one byte set.
+        */
+        uint32_t q0 = N.add_state(), q1 = N.add_state();
+        
+        std::map< std::pair< std::pair< uint8_t, uint8_t >, uint32_t >,
+                  uint32_t > suffixes;
+        std::map< uint32_t, Byte_Set > first;
+        for (const utf8::Range & range : r.ranges)
+        {
+            for (const utf8::Sequence & seq :
+                     utf8::sequences(range.first, range.second))
             {
-                NFA< std::string, std::string > new_N =
-                    nfa_of_epsilon(sigma,
-                                   epsilon,
-                                   state_num);
-                // An NFA must already exist prior, so dont check
-                // for nullptr.
-                *N_ptr = nfa_union< std::string, std::string >(
-                    *N_ptr,
-                    new_N,
-                    get_next_state_str(state_num)
-                    );
+                uint32_t next = q1;
+                for (int k = seq.size() - 1; k > 0; --k)
+                {
+                    std::pair< std::pair< uint8_t, uint8_t >, uint32_t >
+                        key = {seq[k], next};
+
+                    if (suffixes.find(key) == suffixes.end())
+                    {
+                        Byte_Set set;
+                        set.insert(seq[k].first, seq[k].second);
+                        uint32_t q = N.add_state();
+                        N.add_transition(q, set, next);
+                        suffixes[key] = q;
+                    }
+                    next = suffixes[key];
+                }
+                first[next].insert(seq[0].first, seq[0].second);
             }
+        }
 
-            else
+        for (const std::pair< const uint32_t, Byte_Set > & pair : first)
+            N.add_transition(q0, pair.second, pair.first);
+        
+        return {q0, q1};
+    }
+
+    case Regex_Node::CONCATENATION:
+    {
+        Fragment f = construct_nfa_recursive(r.children[0], N, saves);
+        for (int k = 1, n = r.children.size(); k < n; ++k)
+        {
+            Fragment g = construct_nfa_recursive(r.children[k], N, saves);
+            N.add_epsilon(f.second, g.first);
+            f.second = g.second;
+        }
+        return f;
+    }
+
+    case Regex_Node::UNION:
+    {
+        uint32_t q0 = N.add_state(), q1 = N.add_state();
+        for (const int & child : r.children)
+        {
+            Fragment g = construct_nfa_recursive(child, N, saves);
+            N.add_epsilon(q0, g.first);
+            N.add_epsilon(g.second, q1);
+        }
+        return {q0, q1};
+    }
+
+    case Regex_Node::GROUP:
+    {
+        //Groups only matter to the Pike VM.
+        if (saves == nullptr)
+            return construct_nfa_recursive(r.children[0], N, saves);
+
+        uint32_t q0 = N.add_state();
+        Fragment g = construct_nfa_recursive(r.children[0], N, saves);
+        uint32_t q1 = N.add_state();
+        N.add_epsilon(q0, g.first);
+        N.add_epsilon(g.second, q1);
+        saves->resize(N.size(), -1);
+        (*saves)[q0] = 2 * r.group;
+        (*saves)[q1] = 2 * r.group + 1;
+        return {q0, q1};
+    }
+
+    case Regex_Node::REPETITION:
+    default:
+    {
+        /*
+          x{m,n} is built as a chain of n copies of x. The first m
+          copies are required, and each of the optional copies after
+          them has an epsilon edge to one shared final state:
+
+            x{2,4} = x x (x (x)?)?
+
+          so the size of the NFA grows linearly with the bound instead
+          of the quadratic (xx|xxx|xxxx) expansion. Entering a copy
+          comes before skipping it, so repetitions are greedy for the
+          Pike VM.
+        */
+        uint32_t q0 = N.add_state(), current = q0;
+        
+        for (int k = 0; k < r.min; ++k)
+        {
+            Fragment g = construct_nfa_recursive(r.children[0], N, saves);
+            N.add_epsilon(current, g.first);
+            current = g.second;
+        }
+
+        //x{m,} = x{m} x*
+        if (r.max < 0)
+        {
+            uint32_t loop = N.add_state();
+            Fragment g = construct_nfa_recursive(r.children[0], N, saves);
+            N.add_epsilon(current, loop);
+            N.add_epsilon(loop, g.first);
+            N.add_epsilon(g.second, loop);
+            return {q0, loop};
+        }
+
+        uint32_t q1 = N.add_state();
+        for (int k = r.min; k < r.max; ++k)
+        {
+            Fragment g = construct_nfa_recursive(r.children[0], N, saves);
+            N.add_epsilon(current, g.first);
+            N.add_epsilon(current, q1);
+            current = g.second;
+        }
+        N.add_epsilon(current, q1);
+        return {q0, q1};
+    }
+    }
+}
+
+
+// Returns the DFA of .*(expression), building it the first time.
+const Lazy_DFA & Regex::search_dfa() const
+{
+    Lazy_DFA * S = S_.load(std::memory_order_acquire);
+    if (S != nullptr)
+        return *S;
+    
+    //A new initial state loops on every byte before the expression.
+    NFA< uint8_t, uint32_t > N = nfa();
+    uint32_t q = N.add_state();
+    N.add_transition(q, Byte_Set::all(), q);
+    N.add_epsilon(q, nfa().initial_state());
+    N.set_initial_state(q);
+
+    //Threads racing to create it keep the first one published.
+    Lazy_DFA * created = new Lazy_DFA(std::move(N), options_.dfa_memory_limit);
+    if (S_.compare_exchange_strong(S, created, std::memory_order_acq_rel))
+        return *created;
+    delete created;
+    return *S;
+}
+
+// Returns the DFA of the reversed expression, building it the first
+// time.
+const Lazy_DFA & Regex::reverse_dfa() const
+{
+    Lazy_DFA * R = R_.load(std::memory_order_acquire);
+    if (R != nullptr)
+        return *R;
+
+    Lazy_DFA * created = new Lazy_DFA(nfa().reverse(), options_.dfa_memory_limit);
+    if (R_.compare_exchange_strong(R, created, std::memory_order_acq_rel))
+        return *created;
+    delete created;
+    return *R;
+}
+
+/*
+  Returns the Pike VM of the groups, building it the first time. Its
+  NFA is built like N_, except that each group has a state saving the
+  position before it and one saving the position after it.
+*/
+const Pike_VM & Regex::capture_vm() const
+{
+    Pike_VM * P = P_.load(std::memory_order_acquire);
+    if (P != nullptr)
+        return *P;
+
+    NFA< uint8_t, uint32_t > N;
+    std::vector< int > saves;
+    Fragment f = construct_nfa_recursive(root_, N, &saves);
+    N.set_initial_state(f.first);
+    N.set_accepting(f.second);
+
+    Pike_VM * created = new Pike_VM(N, saves, 2 * (groups_ + 1));
+    if (P_.compare_exchange_strong(P, created, std::memory_order_acq_rel))
+        return *created;
+    delete created;
+    return *P;
+}
+
+/*
+  Returns where the longest match that ends at end starts, running the
+  reverse DFA backwards from end until no match can start further
+  back.
+*/
+size_t Regex::match_begin(const char * str, size_t end) const
+{
+    const Lazy_DFA & R = reverse_dfa();
+    const uint8_t * bytes = (const uint8_t *)str;
+
+    Lazy_DFA::State state = R.initial_state();
+    size_t ret = R.is_accepting(state) ? end : Regex_Span::npos;
+    for (size_t i = end; i > 0 && !R.is_dead(state); --i)
+    {
+        state = R.next_state(state, bytes[i - 1]);
+        if (state == Lazy_DFA::over_limit)
+        {
+            //The NFA reads the reversed string instead.
+            std::vector< uint8_t > reversed(bytes, bytes + end);
+            std::reverse(reversed.begin(), reversed.end());
+            return end - R.nfa_prefix(reversed.data(), end, true);
+        }
+        if (R.is_accepting(state))
+            ret = i - 1;
+    }
+
+    return ret;
+}
+
+// Sets spans to the groups of str[begin, end), which must match.
+void Regex::captures(const char * str, size_t begin, size_t end,
+                     std::vector< Regex_Span > & spans) const
+{
+    const Pike_VM & P = capture_vm();
+    std::vector< size_t > slots(P.slots());
+    P.match((const uint8_t *)str + begin, end - begin, slots.data());
+
+    spans.assign(groups_ + 1, {Regex_Span::npos, Regex_Span::npos});
+    spans[0] = {begin, end};
+    for (int g = 1; g <= groups_; ++g)
+        if (slots[2 * g] != Pike_VM::npos && slots[2 * g + 1] != Pike_VM::npos)
+            spans[g] = {begin + slots[2 * g], begin + slots[2 * g + 1]};
+
+    return;
+}
+
+// The derivative term of a node of the simplified tree.
+int Regex::derivative_term(int node, helper::Derivative_Terms & terms) const
+{
+    const Regex_Node & r = nodes_[node];
+    switch (r.type)
+    {
+    case Regex_Node::EPSILON:
+        return terms.epsilon;
+
+    case Regex_Node::SYMBOL:
+    {
+        Byte_Set set;
+        set.insert(uint8_t(r.symbol));
+        return terms.symbols(set);
+    }
+
+    case Regex_Node::CLASS:
+        return terms.symbols(r.symbols);
+
+    case Regex_Node::UNICODE_CLASS:
+    {
+        //The sequences of byte ranges of the code points, as for the
+        //NFA.
+        std::vector< int > alternatives;
+        for (const utf8::Range & range : r.ranges)
+        {
+            for (const utf8::Sequence & seq :
+                     utf8::sequences(range.first, range.second))
             {
-                
-                std::string sub_s = s.substr(start, len);
-                NFA< std::string, std::string > new_N =
-                    construct_nfa_recursive(sigma,
-                                            epsilon,
-                                            sub_s,
-                                            state_num);
-                // An NFA must already exist prior, so dont check
-                // for nullptr.
-                *N_ptr = nfa_union< std::string, std::string >(
-                    *N_ptr,
-                    new_N,
-                    get_next_state_str(state_num)
-                    );
+                int t = terms.epsilon;
+                for (int k = seq.size() - 1; k >= 0; --k)
+                {
+                    Byte_Set set;
+                    set.insert(seq[k].first, seq[k].second);
+                    t = terms.concatenation(terms.symbols(set), t);
+                }
+                alternatives.push_back(t);
             }
         }
+        return terms.alternation(alternatives);
+    }
 
-        else
-            throw Regex_NFA_Construction_Error();
-  
+    case Regex_Node::CONCATENATION:
+    {
+        int t = terms.epsilon;
+        for (int k = r.children.size() - 1; k >= 0; --k)
+            t = terms.concatenation(derivative_term(r.children[k], terms), t);
+        return t;
     }
 
-    NFA< std::string, std::string > ret(*N_ptr);
-    delete N_ptr;
-    return ret;
+    case Regex_Node::UNION:
+    {
+        std::vector< int > alternatives;
+        for (const int & child : r.children)
+            alternatives.push_back(derivative_term(child, terms));
+        return terms.alternation(alternatives);
+    }
+
+    case Regex_Node::REPETITION:
+        return terms.repetition(derivative_term(r.children[0], terms),
+                                r.min, r.max);
+
+    case Regex_Node::GROUP:
+        return derivative_term(r.children[0], terms);
+    }
+
+    return terms.empty;
+}
+
+Derivative_DFA * Regex::new_derivative_dfa() const
+{
+    helper::Derivative_Terms terms;
+    int t = derivative_term(terms);
+    return new Derivative_DFA(terms, t, options_.dfa_memory_limit);
 }
 
+// Returns the NFA of the expression, building it the first time.
+const NFA< uint8_t, uint32_t > & Regex::nfa() const
+{
+    if (L_ != nullptr)
+        return L_->nfa();
+
+    NFA< uint8_t, uint32_t > * N = N_.load(std::memory_order_acquire);
+    if (N != nullptr)
+        return *N;
+
+    NFA< uint8_t, uint32_t > * created = new NFA< uint8_t, uint32_t >;
+    Fragment f = construct_nfa_recursive(dfa_root_, *created);
+    created->set_initial_state(f.first);
+    created->set_accepting(f.second);
+
+    //Threads racing to create it keep the first one published.
+    if (N_.compare_exchange_strong(N, created, std::memory_order_acq_rel))
+        return *created;
+    delete created;
+    return *N;
+}
 
 void Regex::construct_nfa()
 {
-    std::unordered_set< std::string > sigma;
+    Automaton_Stats * stats = collected_stats();
+
+    //Literal alternations need neither the simplified tree nor the
+    //NFA, their trie is already a DFA. The NFA is only built if a
+    //search asks for spans or counts.
+    std::vector< std::string > words;
+    bool over_limit = false;
+    if (literal_alternation(words))
+    {
+        Stats_Timer timer(stats, "aho-corasick");
+        try
+        {
+            A_ = new Aho_Corasick(words, options_.dfa_memory_limit);
+            dfa_root_ = root_;
+            min_length_ = helper::DFA_Analysis::unbounded;
+            max_length_ = 0;
+            for (const std::string & w : words)
+            {
+                min_length_ = std::min(min_length_, w.size());
+                max_length_ = std::max(max_length_, w.size());
+            }
+        }
+        catch (NFA_To_DFA_Memory_Limit_Error &)
+        {
+            //A DFA of the words takes at least as many states as
+            //their trie, so the DFA is built lazily.
+            over_limit = true;
+            if (stats != nullptr)
+                ++stats->memory_limit_hits;
+        }
+    }
 
-    //Construct sigma.
-    bool delimiter = false;
-    for (const char & c : regular_expression_)
+    if (A_ == nullptr)
     {
-        
-        if (!delimiter && c == '/')
-            delimiter = true;
-        else if (delimiter ||
-                 regular_symbols.find(c) == regular_symbols.end() &&
-                 sigma.find(std::to_string(c)) == sigma.end())
         {
-            sigma.insert(std::to_string(c));
-            
-            if (delimiter)
-                delimiter = false;
+            Stats_Timer timer(stats, "simplify");
+            dfa_root_ = simplify(root_);
+            interned_.clear();
+        }
+
+        if (options_.derivatives)
+        {
+            Stats_Timer timer(stats, "derivatives");
+            D_ = new_derivative_dfa();
+        }
+        else
+        {
+            {
+                Stats_Timer timer(stats, "nfa");
+                nfa();
+            }
+
+            //A DFA over the memory limit is built lazily instead, whose
+            //states are bounded by the same limit.
+            try
+            {
+                if (!over_limit)
+                    M_ = new DFA< uint8_t, uint32_t >(
+                        nfa().to_dfa(stats, options_.dfa_memory_limit,
+                                     options_.thread_count()));
+            }
+            catch (NFA_To_DFA_Memory_Limit_Error &)
+            {
+                if (stats != nullptr)
+                    ++stats->memory_limit_hits;
+            }
+            if (M_ == nullptr)
+            {
+                //The lazy DFA takes over the NFA.
+                NFA< uint8_t, uint32_t > * N = N_.exchange(nullptr);
+                L_ = new Lazy_DFA(std::move(*N), options_.dfa_memory_limit);
+                delete N;
+            }
+        }
+
+        if (M_ != nullptr)
+        {
+            M_->build_stride_table(options_.stride_table_limit);
+            min_length_ = M_->min_length();
+            max_length_ = M_->max_length();
+        }
+        else if (D_ != nullptr)
+        {
+            min_length_ = D_->min_length();
+            max_length_ = D_->max_length();
+        }
+        else
+        {
+            min_length_ = nfa().min_length();
+            max_length_ = helper::DFA_Analysis::unbounded;
         }
     }
-    
-    std::string epsilon = "";
-    sigma.insert(epsilon);
-    int state_num = 0;
-
-    N_ = new NFA< std::string, std::string >(construct_nfa_recursive(
-                                                 sigma,
-                                                 epsilon,
-                                                 regular_expression_,
-                                                 state_num));
+
+    if (stats != nullptr)
+    {
+        const NFA< uint8_t, uint32_t > * N = L_ != nullptr ? &L_->nfa() :
+            N_.load(std::memory_order_relaxed);
+        stats->nfa_states = N != nullptr ? N->size() : 0;
+        stats->dfa_states = A_ != nullptr ? A_->states() :
+            M_ != nullptr ? M_->size() :
+            D_ != nullptr ? D_->size() : L_->size();
+        stats->resident_bytes = (N != nullptr ? N->memory_bytes() : 0) +
+            (A_ != nullptr ? A_->memory_bytes() :
+             M_ != nullptr ? M_->memory_bytes() :
+             D_ != nullptr ? D_->memory_bytes() : L_->memory_bytes());
+        stats->add_bytes(stats->resident_bytes);
+    }
     
     return;
 }
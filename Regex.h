@@ -2,6 +2,12 @@
 #define REGEX_H
 
 #include "Common.h"
+#include "Byte_Set.h"
+#include "UTF8.h"
+#include "Stats.h"
+
+#include <atomic>
+#include <thread>
 
 //Errors
 class Regex_Invalid_Escape_Character_Error{};
@@ -10,13 +16,147 @@ class Regex_Invalid_Power_Error{};
 class Regex_Unbalanced_Parenthesized_Expression_Error{};
 class Regex_NFA_Construction_Error{}; //++ or ** or +* or *+ or ...
 
+/*
+  Node of the parsed form of a regular expression. Nodes are stored
+  in a vector owned by the Regex and refer to their children by
+  index into that vector.
+*/
+struct Regex_Node
+{
+    enum Type
+    {
+        EPSILON,
+        SYMBOL,
+        CLASS,
+        UNICODE_CLASS,
+        CONCATENATION,
+        UNION,
+        REPETITION,
+        GROUP
+    };
+
+    Type type;
+    char symbol;                 // SYMBOL
+    Byte_Set symbols;            // CLASS
+    std::vector< utf8::Range > ranges; // UNICODE_CLASS, normalized
+    std::vector< int > children; // CONCATENATION, UNION, REPETITION, GROUP
+    int min;                     // REPETITION
+    int max;                     // REPETITION, -1 when unbounded
+    int group;                   // GROUP, numbered from 1 by its '('
+};
+
+/*
+  Bytes [begin, end) of a string matched by an expression, or by one
+  of its groups. A group that took no part in the match is
+  [npos, npos).
+*/
+struct Regex_Span
+{
+    static constexpr size_t npos = size_t(-1);
+
+    bool matched() const
+    { return begin != npos; }
+
+    size_t begin;
+    size_t end;
+};
+
+// Options given to a Regex upon construction.
+struct Regex_Options
+{
+    Regex_Options()
+        : utf8(true), collect_stats(false), dfa_memory_limit(size_t(256) << 20),
+          stride_table_limit(size_t(256) << 10), derivatives(false),
+          threads(1)
+    {}
+
+    /*
+      When true, the expression and the strings given to the Regex
+      are UTF-8. A multi-byte character is a single operand, ranges
+      hold code points, and '.' and negated ranges match whole
+      characters. When false, every byte is its own character.
+    */
+    bool utf8;
+
+    // When true, building the Regex is recorded in Regex::stats().
+    bool collect_stats;
+
+    /*
+      Bytes each DFA of the Regex may take for its states, 0 for no
+      limit. When the DFA used for full matches would take more, it is
+      built lazily instead, and when a lazily built DFA reaches the
+      limit, matching runs the NFA (see Regex::fallbacks()).
+    */
+    size_t dfa_memory_limit;
+
+    /*
+      Bytes the DFA used for full matches may take for a table that
+      reads 2 or 4 bytes per lookup (see DFA::build_stride_table()), 0
+      for no such table. The default fits in a typical L2 cache.
+    */
+    size_t stride_table_limit;
+
+    /*
+      When true, full matches run a DFA whose states are derivatives
+      of the expression, built as matching reaches them (see
+      Derivative_DFA.h), instead of a DFA built from the NFA by subset
+      construction. It skips subset construction, and the NFA unless a
+      search or the groups need it, and often has fewer states.
+      Literal alternations still use Aho-Corasick.
+    */
+    bool derivatives;
+
+    /*
+      Threads that build the DFA by subset construction (see
+      NFA::to_dfa() in Byte_NFA.h), and that build the expressions of
+      a RegexSet, 0 for one per core. The automata are the same with
+      any number of threads.
+    */
+    int threads;
+
+    // threads, with 0 replaced by the number of cores.
+    int thread_count() const
+    {
+        if (threads > 0)
+            return threads;
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+};
+
+/*
+  Literals that every match of an expression must hold, found from its
+  parsed form:
+
+    "GET .*"             prefix "GET "
+    "[0-9]+ ERROR [a-z]+" required " ERROR "
+    "(ab|cb)d"           suffix "bd"
+
+  They let the matcher reject most strings with a memcmp or memmem
+  before running the automaton. Each is at most max_size bytes.
+*/
+struct Regex_Literals
+{
+    static constexpr size_t max_size = 256;
+
+    Regex_Literals() : exact(false)
+    {}
+
+    std::string prefix;   // Every match starts with it.
+    std::string suffix;   // Every match ends with it.
+    std::string required; // Every match holds it, the longest one found.
+    bool exact;           // The only match is prefix.
+};
+
 class Regex
 {
 public:
     
     Regex(const std::string & expression,
           const std::string & epsilon = "",
-          const std::string & emptyset = "\0");
+          const std::string & emptyset = "\0",
+          const Regex_Options & options = Regex_Options());
+    Regex(const std::string & expression,
+          const Regex_Options & options);
     Regex(const Regex & r);
     ~Regex();
 
@@ -24,7 +164,96 @@ public:
     Regex & operator=(const std::string & s);
 
     bool operator()(const std::vector< std::string > & str) const;
-    bool operator()(std::string str) const;
+    bool operator()(const std::string & str) const;
+    bool operator()(const char * str, size_t n) const;
+
+    /*
+      Sets results[i] to operator()(strs[i]) for every string of a
+      batch. The strings the literals of the expression do not rule
+      out are matched several at a time on the dense DFA (see
+      match_batch() in Byte_DFA.h), which pays off when most of them
+      must be read far before they are decided.
+    */
+    void match_batch(const std::vector< std::string > & strs,
+                     std::vector< bool > & results) const;
+    void match_batch(const char * const * strs, const size_t * lengths,
+                     size_t count, bool * results) const;
+
+    /*
+      Renumbers the states of the dense DFA by how often matching the
+      strings of a sample visits them, so the states the input keeps
+      coming back to share cache lines (see renumber_by_visits() in
+      Byte_DFA.h). Matches are unchanged. Does nothing if there is no
+      dense DFA. Must not run while other threads use this Regex.
+    */
+    void profile(const std::vector< std::string > & sample);
+
+    /*
+      Returns true if some substring of str matches. The required
+      literal is searched for first, and the automaton is only run
+      around its occurrences when matches have a bounded length.
+    */
+    bool search(const std::string & str) const;
+    bool search(const char * str, size_t n) const;
+
+    /*
+      Capture groups. Every parenthesized expression is a group,
+      numbered from 1 in the order of its '(', and group 0 is the whole
+      match. spans gets one span per group.
+
+      match() succeeds if the whole string matches. search() finds the
+      match that ends first, and of those the longest. The DFAs find
+      where the match is, so strings that do not match cost no more
+      than they would without groups, and the groups are then found
+      by a Pike VM over the match only (see Pike_VM.h). When a group
+      matches more than once, as in "(a|b)*", its last match is given.
+    */
+    bool match(const std::string & str, std::vector< Regex_Span > & spans) const;
+    bool match(const char * str, size_t n, std::vector< Regex_Span > & spans) const;
+    bool search(const std::string & str, std::vector< Regex_Span > & spans) const;
+    bool search(const char * str, size_t n, std::vector< Regex_Span > & spans) const;
+
+    /*
+      Counts without building matches or allocating anything per match.
+
+      count_matches() counts the matches search() would find one after
+      the other, each search starting where the previous match ended.
+      Matches never overlap, and each is the match that ends first, so
+      only where the last match ended is kept. An expression matching
+      the empty string matches once at every position, n + 1 times,
+      or with Regex_Options::utf8 once at every boundary between code
+      points, both ends included.
+
+      count_matching_lines() counts the lines, ended by '\n' or by the
+      end of the buffer, that match in whole, as operator() would.
+    */
+    size_t count_matches(const std::string & str) const;
+    size_t count_matches(const char * str, size_t n) const;
+    size_t count_matching_lines(const std::string & str) const;
+    size_t count_matching_lines(const char * str, size_t n) const;
+
+    /*
+      Line mode: the lines count_matching_lines() counts, as offsets
+      into the buffer without their '\n'. Lines are matched in place
+      with no copy, and their ends are found 64 bytes at a time (see
+      Line_Splitter in Byte_DFA.h), so a buffer holding a whole log
+      file can be given as is.
+    */
+    std::vector< Regex_Span > matching_lines(const std::string & str) const;
+    std::vector< Regex_Span > matching_lines(const char * str, size_t n) const;
+
+    // Number of capture groups, not counting group 0.
+    int groups() const
+    { return groups_; }
+
+    // Returns true if some string starting with prefix matches.
+    bool can_still_match(const std::string & prefix) const;
+
+    // Lengths in bytes of the shortest and longest matching strings.
+    // See DFA< uint8_t, uint32_t >::min_length() and max_length().
+    // The longest is unbounded if the DFA went over the memory limit.
+    size_t min_length() const;
+    size_t max_length() const;
 
     std::string expression() const
     { return expression_; }
@@ -33,12 +262,52 @@ public:
     { return epsilon_; }
 
     std::string emptyset() const
-    { return regular_expression_; }
+    { return emptyset_; }
 
     std::string regular_expression() const
-    { return emptyset_; }
+    { return regular_expression_; }
+
+    const Regex_Options & options() const
+    { return options_; }
+
+    const Regex_Literals & literals() const
+    { return literals_; }
+
+    /*
+      Time spent in each phase of building this Regex (parse, nfa, and
+      determinize or aho-corasick), the sizes of its automata and the
+      memory they hold. Empty unless Regex_Options::collect_stats was
+      set.
+    */
+    const Automaton_Stats & stats() const
+    { return stats_; }
+
+    /*
+      Number of matches and searches that ran the NFA, or took
+      derivatives, because a DFA reached Regex_Options::dfa_memory_limit.
+    */
+    size_t fallbacks() const;
+
+    /*
+      Returns true if the expression is an alternation of literals,
+      such as "GET|POST|PUT", putting them in words. Such expressions
+      are compiled to an Aho-Corasick automaton instead of an NFA.
+    */
+    bool literal_alternation(std::vector< std::string > & words) const;
 
     NFA< std::string, std::string > to_nfa() const;
+
+    // Returns the computational DFA, over bytes. Throws
+    // NFA_To_DFA_Memory_Limit_Error if it goes over the memory limit.
+    DFA< uint8_t, uint32_t > to_dfa() const;
+
+    /*
+      Adds the expression to a store of derivative terms and returns
+      its term, to be combined with the terms of other expressions,
+      e.g. by intersection or complement, and matched by a
+      Derivative_DFA.
+    */
+    int derivative_term(helper::Derivative_Terms & terms) const;
     
     // For validating characters with the '/' delimiter in front of
     // them, as well as for usage within the to_regex function within
@@ -46,45 +315,109 @@ public:
     static const std::unordered_set< char > symbols;
     static const std::unordered_set< char > regular_symbols;
 
+    // The set matched by '.', every byte except the newline.
+    static const Byte_Set dot;
+
 private:
-    char get_range_type(const char) const;
-    std::string get_range_string(const std::string & s) const;
-    std::string get_power_string(const std::string & s,
-                                 const std::string & p) const;
-    std::string pop_prev_expression(std::string & s,
-                                    int & str_begin,
-                                    int & str_end);
+    typedef std::pair< uint32_t, uint32_t > Fragment;
+
+    int new_node(Regex_Node::Type type);
+    int parse_union(const std::string & s, int & i);
+    int parse_concatenation(const std::string & s, int & i);
+    int parse_repetition(const std::string & s, int & i);
+    int parse_atom(const std::string & s, int & i);
+    int parse_range(const std::string & s, int & i);
+    uint32_t parse_range_symbol(const std::string & s, int & i) const;
+    int parse_symbol(const std::string & s, int & i);
+    void parse_power(const std::string & s, int & i,
+                     int & min, int & max) const;
+    std::string node_string(int node) const;
+    Regex_Literals node_literals(int node) const;
+    int simplify(int node);
+    int intern_node(const Regex_Node & node);
+    int simplified_concatenation(const std::vector< int > & parts);
+    int simplified_union(const std::vector< int > & alternatives);
+    int factored_union(const std::vector< std::vector< int > > & sequences,
+                       size_t begin, size_t end, size_t depth, bool reversed);
+    int simplified_repetition(int child, int min, int max);
     
     void format_expression();
-
-    inline std::string get_next_state_str(int & i)
-    {
-        std::string ret = "q" + std::to_string(i);
-        ++i;
-        return ret;
-    }
     
-    NFA< std::string, std::string > nfa_of_epsilon(
-        const std::unordered_set< std::string > & sigma,
-        const std::string & epsilon,
-        int & state_num);
-    NFA< std::string, std::string > nfa_of_symbol(
-        const std::unordered_set< std::string > & sigma,
-        const std::string & epsilon,
-        const std::string & s,
-        int & state_num);
-    NFA< std::string, std::string > construct_nfa_recursive(
-        const std::unordered_set< std::string > & sigma,
-        const std::string & epsilon,
-        const std::string & s,
-        int & state_num);
+    int derivative_term(int node, helper::Derivative_Terms & terms) const;
+    Derivative_DFA * new_derivative_dfa() const;
+    Fragment construct_nfa_recursive(int node,
+                                     NFA< uint8_t, uint32_t > & N,
+                                     std::vector< int > * saves = nullptr) const;
     void construct_nfa();
+    const NFA< uint8_t, uint32_t > & nfa() const;
+    const Lazy_DFA & search_dfa() const;
+    const Lazy_DFA & reverse_dfa() const;
+    const Pike_VM & capture_vm() const;
+    bool literals_possible(const char * str, size_t n) const;
+    template< typename F >
+    void for_each_matching_line(const char * str, size_t n, F f) const;
+    size_t search_end(const char * str, size_t n) const;
+    bool suffix_search_end(const char * str, size_t n, size_t & end) const;
+    size_t match_begin(const char * str, size_t end) const;
+    void captures(const char * str, size_t begin, size_t end,
+                  std::vector< Regex_Span > & spans) const;
+
+    // stats_ if stats are collected, nullptr otherwise.
+    Automaton_Stats * collected_stats()
+    { return options_.collect_stats ? &stats_ : nullptr; }
 
     std::string epsilon_;
     std::string emptyset_;
     std::string expression_;
     std::string regular_expression_;
-    NFA< std::string, std::string > * N_;
+    Regex_Options options_;
+    std::vector< Regex_Node > nodes_;
+    int root_;
+
+    //Root of the simplified tree N_ is built from, which matches the
+    //same strings as root_ with no groups (see simplify()), and its
+    //nodes by the hash of their contents while it is built. Literal
+    //alternations are not simplified, dfa_root_ is root_.
+    int dfa_root_;
+    std::unordered_multimap< uint64_t, int > interned_;
+
+    int groups_;
+    Regex_Literals literals_;
+
+    //NFA of the expression, built with M_, or the first time it is
+    //needed, e.g. by search(), when A_ or D_ is used instead. L_ holds
+    //its own, nullptr here.
+    mutable std::atomic< NFA< uint8_t, uint32_t > * > N_;
+    DFA< uint8_t, uint32_t > * M_;
+
+    //DFA of the expression built lazily, when M_ went over the memory
+    //limit, nullptr otherwise.
+    Lazy_DFA * L_;
+
+    //DFA of the derivatives of the expression, used instead of M_ and
+    //L_ with Regex_Options::derivatives, nullptr otherwise.
+    Derivative_DFA * D_;
+    size_t min_length_;
+    size_t max_length_;
+
+    /*
+      DFA of .*(expression) used by search(). It is created on the
+      first search and its states are built as searches reach them,
+      so it can be shared by threads searching at the same time.
+    */
+    mutable std::atomic< Lazy_DFA * > S_;
+
+    //DFA of the reversed expression, which finds where a match that
+    //ends at a given position starts, and the Pike VM of the groups.
+    //Both are created the first time groups are asked for.
+    mutable std::atomic< Lazy_DFA * > R_;
+    mutable std::atomic< Pike_VM * > P_;
+
+    //Automaton of a literal alternation, used instead of M_, L_ and
+    //D_, nullptr otherwise.
+    Aho_Corasick * A_;
+
+    Automaton_Stats stats_;
 };
 
 std::ostream & operator<<(std::ostream & cout, const Regex & r);
@@ -0,0 +1,184 @@
+#include "RegexSet.h"
+#include "Byte_DFA.h"
+#include "Byte_NFA.h"
+#include "Aho_Corasick.h"
+
+#include <exception>
+#include <memory>
+#include <thread>
+
+RegexSet::RegexSet(const std::vector< std::string > & expressions,
+                   const Regex_Options & options)
+    : A_(nullptr)
+{
+    //Expressions are built on several threads at once, each taking
+    //the next one left, and each building its DFA on its share of
+    //the threads.
+    size_t n = expressions.size();
+    int threads = std::min(options.thread_count(), int(std::max(n, size_t(1))));
+    Regex_Options each = options;
+    each.threads = std::max(1, options.thread_count() / threads);
+
+    std::vector< std::unique_ptr< Regex > > built(n);
+    std::vector< std::exception_ptr > errors(n);
+    std::atomic< size_t > next(0);
+    auto build = [&]()
+    {
+        for (size_t i; (i = next.fetch_add(1)) < n; )
+        {
+            try
+            {
+                built[i].reset(new Regex(expressions[i], each));
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+    if (threads > 1)
+    {
+        std::vector< std::thread > workers;
+        for (int t = 0; t < threads; ++t)
+            workers.emplace_back(build);
+        for (std::thread & w : workers)
+            w.join();
+    }
+    else
+        build();
+
+    //The error of the first invalid expression, as when built in
+    //order.
+    for (const std::exception_ptr & e : errors)
+        if (e)
+            std::rethrow_exception(e);
+
+    //The built expressions are kept as they are, not copied.
+    regexes_ = std::move(built);
+    std::vector< std::string > words, expression_words;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!regexes_[i]->literal_alternation(expression_words))
+        {
+            others_.push_back(i);
+            continue;
+        }
+
+        for (const std::string & w : expression_words)
+        {
+            words.push_back(w);
+            word_expression_.push_back(i);
+        }
+    }
+
+    //Over the memory limit, the literal alternations are matched one
+    //at a time like the other expressions.
+    if (!words.empty())
+    {
+        try
+        {
+            A_ = new Aho_Corasick(words, options.dfa_memory_limit);
+        }
+        catch (NFA_To_DFA_Memory_Limit_Error &)
+        {
+            others_.clear();
+            for (size_t i = 0; i < n; ++i)
+                others_.push_back(i);
+            word_expression_.clear();
+        }
+    }
+
+    return;
+}
+
+RegexSet::RegexSet(const RegexSet & s)
+    : A_(nullptr),
+      word_expression_(s.word_expression_),
+      others_(s.others_)
+{
+    regexes_.reserve(s.regexes_.size());
+    for (const std::unique_ptr< Regex > & r : s.regexes_)
+        regexes_.emplace_back(new Regex(*r));
+    if (s.A_ != nullptr)
+        A_ = new Aho_Corasick(*s.A_);
+
+    return;
+}
+
+RegexSet::~RegexSet()
+{
+    if (A_ != nullptr)
+        delete A_;
+    return;
+}
+
+RegexSet & RegexSet::operator=(const RegexSet & s)
+{
+    if (this == &s)
+        return *this;
+
+    regexes_.clear();
+    regexes_.reserve(s.regexes_.size());
+    for (const std::unique_ptr< Regex > & r : s.regexes_)
+        regexes_.emplace_back(new Regex(*r));
+    word_expression_ = s.word_expression_;
+    others_ = s.others_;
+
+    if (A_ != nullptr)
+        delete A_;
+    A_ = nullptr;
+    if (s.A_ != nullptr)
+        A_ = new Aho_Corasick(*s.A_);
+
+    return *this;
+}
+
+std::vector< size_t > RegexSet::matches(const std::string & str) const
+{
+    return matches(str.data(), str.size());
+}
+
+std::vector< size_t > RegexSet::matches(const char * str, size_t n) const
+{
+    std::vector< uint8_t > matched(regexes_.size(), 0);
+    if (A_ != nullptr)
+    {
+        //The same word may appear in several expressions.
+        for (const uint32_t & id : A_->lookup((const uint8_t *)str, n))
+            matched[word_expression_[id]] = 1;
+    }
+
+    for (const size_t & i : others_)
+        matched[i] = (*regexes_[i])(str, n);
+
+    std::vector< size_t > ret;
+    for (size_t i = 0; i < matched.size(); ++i)
+        if (matched[i])
+            ret.push_back(i);
+    return ret;
+}
+
+std::vector< size_t > RegexSet::search(const std::string & str) const
+{
+    return search(str.data(), str.size());
+}
+
+std::vector< size_t > RegexSet::search(const char * str, size_t n) const
+{
+    std::vector< uint8_t > matched(regexes_.size(), 0);
+    if (A_ != nullptr)
+    {
+        A_->occurrences((const uint8_t *)str, n,
+                        [&](uint32_t id)
+                        { matched[word_expression_[id]] = 1; });
+    }
+
+    for (const size_t & i : others_)
+        matched[i] = regexes_[i]->search(str, n);
+
+    std::vector< size_t > ret;
+    for (size_t i = 0; i < matched.size(); ++i)
+        if (matched[i])
+            ret.push_back(i);
+    return ret;
+}
@@ -0,0 +1,64 @@
+#ifndef REGEXSET_H
+#define REGEXSET_H
+
+#include "Common.h"
+#include "Regex.h"
+
+#include <memory>
+
+/*
+  A set of regular expressions matched against a string together,
+  answering which of them match.
+
+  The expressions that are alternations of literals (see
+  Regex::literal_alternation()) share a single Aho-Corasick automaton
+  over all of their words, so a blocklist of many keywords costs one
+  pass over the string however many expressions it is split into.
+  The other expressions are matched one at a time.
+
+  The expressions are built on Regex_Options::threads threads at once,
+  which share them out, so a large set compiles faster with more cores.
+*/
+class RegexSet
+{
+public:
+    RegexSet(const std::vector< std::string > & expressions,
+             const Regex_Options & options = Regex_Options());
+    RegexSet(const RegexSet & s);
+    ~RegexSet();
+
+    RegexSet & operator=(const RegexSet & s);
+
+    size_t size() const
+    { return regexes_.size(); }
+
+    const Regex & operator[](size_t i) const
+    { return *regexes_[i]; }
+
+    // Indices of the expressions that match the whole string, in
+    // increasing order.
+    std::vector< size_t > matches(const std::string & str) const;
+    std::vector< size_t > matches(const char * str, size_t n) const;
+
+    // Indices of the expressions that match some substring of the
+    // string, in increasing order.
+    std::vector< size_t > search(const std::string & str) const;
+    std::vector< size_t > search(const char * str, size_t n) const;
+
+private:
+    //Owned one by one, so building or copying the set never copies
+    //a Regex more than once.
+    std::vector< std::unique_ptr< Regex > > regexes_;
+
+    //Automaton over the words of every literal alternation, nullptr
+    //if there is none.
+    Aho_Corasick * A_;
+
+    //Expression each word of A_ comes from.
+    std::vector< size_t > word_expression_;
+
+    //Expressions that are not literal alternations.
+    std::vector< size_t > others_;
+};
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef REGEX_TERMS_H
+#define REGEX_TERMS_H
+
+#include "Common.h"
+
+namespace helper
+{
+    /*
+      Hash-consed regular expression terms, used to build expressions
+      out of automata (see NFA::to_regex()).
+
+      Every term is stored once and referred to by its id, so a partial
+      result used on many edges is shared rather than copied, and two
+      equal terms always have the same id. The constructors simplify as
+      they go:
+
+        concatenation  drops epsilon, is empty if a part is empty,
+                       and merges x*x* into x*
+        alternation    flattens, removes duplicates and the emptyset,
+                       and drops epsilon next to a star
+        star           of the emptyset or epsilon is epsilon,
+                       (x*)* is x*, and (x|epsilon)* is x*
+
+      Terms are only written out as a string once, at the end.
+    */
+    class Regex_Terms
+    {
+    public:
+        enum Type
+        {
+            EMPTY,
+            EPSILON,
+            SYMBOL,
+            CONCATENATION,
+            ALTERNATION,
+            STAR
+        };
+
+        struct Term
+        {
+            Type type;
+            std::string text;            // SYMBOL, written as is
+            std::vector< int > children; // CONCATENATION, ALTERNATION, STAR
+        };
+
+        static constexpr int empty = 0;
+        static constexpr int epsilon = 1;
+
+        Regex_Terms()
+        {
+            intern({EMPTY, "", {}});
+            intern({EPSILON, "", {}});
+        }
+
+        const Term & operator[](int t) const
+        { return terms_[t]; }
+
+        int size() const
+        { return terms_.size(); }
+
+        // A symbol, its text already escaped for the Regex parser.
+        int symbol(const std::string & text)
+        { return intern({SYMBOL, text, {}}); }
+
+        int concatenation(int a, int b)
+        {
+            if (a == empty || b == empty)
+                return empty;
+            if (a == epsilon)
+                return b;
+            if (b == epsilon)
+                return a;
+
+            std::vector< int > children;
+            for (const int & t : { a, b })
+            {
+                if (terms_[t].type != CONCATENATION)
+                {
+                    push_factor(children, t);
+                    continue;
+                }
+                //terms_ is not changed by push_factor.
+                for (const int & child : terms_[t].children)
+                    push_factor(children, child);
+            }
+
+            if (children.size() == 1)
+                return children[0];
+            return intern({CONCATENATION, "", children});
+        }
+
+        int alternation(int a, int b)
+        {
+            if (a == empty || a == b)
+                return b;
+            if (b == empty)
+                return a;
+
+            std::vector< int > children;
+            for (const int & t : { a, b })
+            {
+                if (terms_[t].type == ALTERNATION)
+                    children.insert(children.end(),
+                                    terms_[t].children.begin(),
+                                    terms_[t].children.end());
+                else
+                    children.push_back(t);
+            }
+            std::sort(children.begin(), children.end());
+            children.erase(std::unique(children.begin(), children.end()),
+                           children.end());
+
+            //A star already matches epsilon.
+            if (children[0] == epsilon)
+            {
+                for (const int & t : children)
+                {
+                    if (terms_[t].type == STAR)
+                    {
+                        children.erase(children.begin());
+                        break;
+                    }
+                }
+            }
+
+            if (children.size() == 1)
+                return children[0];
+            return intern({ALTERNATION, "", children});
+        }
+
+        int star(int a)
+        {
+            if (a == empty || a == epsilon)
+                return epsilon;
+            if (terms_[a].type == STAR)
+                return a;
+
+            //(x|epsilon)* is x*.
+            if (terms_[a].type == ALTERNATION && terms_[a].children[0] == epsilon)
+            {
+                std::vector< int > children(terms_[a].children.begin() + 1,
+                                            terms_[a].children.end());
+                if (children.size() == 1)
+                    return star(children[0]);
+                a = intern({ALTERNATION, "", children});
+            }
+
+            return intern({STAR, "", { a }});
+        }
+
+        /*
+          Writes a term out for the Regex parser. Parentheses are only
+          added where precedence needs them, and an alternation with
+          epsilon is written with '?'. The emptyset can not be written
+          in the Regex syntax, so emptyset is written in its place.
+        */
+        std::string to_string(int t, const std::string & emptyset) const
+        {
+            if (t == empty)
+                return emptyset;
+            return write(t);
+        }
+
+    private:
+        // Appends a factor of a concatenation, merging x*x* into x*.
+        void push_factor(std::vector< int > & children, int t)
+        {
+            if (!children.empty() && children.back() == t &&
+                terms_[t].type == STAR)
+                return;
+            children.push_back(t);
+        }
+
+        int intern(Term && term)
+        {
+            std::string key(1, char(term.type));
+            key += term.text;
+            for (const int & child : term.children)
+                key += "," + std::to_string(child);
+
+            std::unordered_map< std::string, int >::iterator it = ids_.find(key);
+            if (it != ids_.end())
+                return it->second;
+
+            int id = terms_.size();
+            ids_[key] = id;
+            terms_.push_back(std::move(term));
+            return id;
+        }
+
+        // Returns true if a term needs no parentheses before a '*'.
+        bool atomic(int t) const
+        {
+            const Term & term = terms_[t];
+            if (term.type == SYMBOL)
+                return term.text.size() == 1 ||
+                    (term.text.size() == 2 && term.text[0] == '/');
+            return term.type == EPSILON;
+        }
+
+        std::string write(int t) const
+        {
+            const Term & term = terms_[t];
+            std::string ret;
+            switch (term.type)
+            {
+            case EMPTY:
+            case EPSILON:
+                break;
+
+            case SYMBOL:
+                ret = term.text;
+                break;
+
+            case CONCATENATION:
+                for (const int & child : term.children)
+                {
+                    if (terms_[child].type == ALTERNATION &&
+                        terms_[child].children[0] != epsilon)
+                        ret += "(" + write(child) + ")";
+                    else
+                        ret += write(child);
+                }
+                break;
+
+            case ALTERNATION:
+            {
+                std::string delim = "";
+                int n = term.children.size();
+                bool optional = term.children[0] == epsilon;
+                for (int i = optional ? 1 : 0; i < n; ++i)
+                {
+                    ret += delim + write(term.children[i]);
+                    delim = "|";
+                }
+                if (optional)
+                {
+                    if (n == 2 && atomic(term.children[1]))
+                        ret += "?";
+                    else
+                        ret = "(" + ret + ")?";
+                }
+                break;
+            }
+
+            case STAR:
+                if (atomic(term.children[0]))
+                    ret = write(term.children[0]) + "*";
+                else
+                    ret = "(" + write(term.children[0]) + ")*";
+                break;
+            }
+
+            return ret;
+        }
+
+        std::vector< Term > terms_;
+        std::unordered_map< std::string, int > ids_;
+    };
+}
+
+#endif
@@ -6,6 +6,9 @@
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
+#include <type_traits>
+#include <cstdint>
+#include <algorithm>
 
 /// TO STRING ///
 namespace std
@@ -101,8 +104,9 @@ namespace std
     {
         size_t operator()(const std::pair< S, T > & x) const
         {
-            std::hash< std::string > hasher;
-            return hasher(std::to_string(x));
+            size_t h = std::hash< S >()(x.first);
+            return h ^ (std::hash< T >()(x.second) + 0x9e3779b97f4a7c15ULL +
+                        (h << 6) + (h >> 2));
         }
     };
 
@@ -144,6 +148,93 @@ namespace helper
 
         return;
     }
+
+    template< typename T >
+    void sort_if(std::vector< T > & x, std::true_type)
+    { std::sort(x.begin(), x.end()); }
+
+    template< typename T >
+    void sort_if(std::vector< T > &, std::false_type)
+    {}
+
+    // Returns the values of a set, sorted when T is an arithmetic type
+    // and in the order of the set otherwise.
+    template< typename T >
+    std::vector< T > ordered(const std::unordered_set< T > & s)
+    {
+        std::vector< T > ret(s.begin(), s.end());
+        sort_if(ret, std::is_arithmetic< T >());
+        return ret;
+    }
+
+    /*
+      Numbers the symbols of an alphabet 0, 1, 2, ... so automata can
+      index arrays by symbol. Symbols are looked up in a hash table,
+      except for the specialization below.
+    */
+    template< typename S_t,
+              bool Small = std::is_integral< S_t >::value && sizeof(S_t) == 1 >
+    class Symbol_Index
+    {
+    public:
+        // Returns the number of c, numbering it if it is new.
+        int insert(const S_t & c)
+        {
+            typename std::unordered_map< S_t, int >::const_iterator it =
+                index_.find(c);
+            if (it != index_.end())
+                return it->second;
+
+            int ret = index_.size();
+            index_[c] = ret;
+            return ret;
+        }
+
+        // Returns the number of c, or -1 if c is not in the alphabet.
+        int find(const S_t & c) const
+        {
+            typename std::unordered_map< S_t, int >::const_iterator it =
+                index_.find(c);
+            return it == index_.end() ? -1 : it->second;
+        }
+
+        int size() const
+        { return index_.size(); }
+
+    private:
+        std::unordered_map< S_t, int > index_;
+    };
+
+    // Single byte integral symbols (char, uint8_t, ...) are looked up
+    // in a 256 entry array instead of being hashed.
+    template< typename S_t >
+    class Symbol_Index< S_t, true >
+    {
+    public:
+        Symbol_Index() : size_(0)
+        {
+            for (int k = 0; k < 256; ++k)
+                index_[k] = -1;
+        }
+
+        int insert(const S_t & c)
+        {
+            int & ret = index_[uint8_t(c)];
+            if (ret < 0)
+                ret = size_++;
+            return ret;
+        }
+
+        int find(const S_t & c) const
+        { return index_[uint8_t(c)]; }
+
+        int size() const
+        { return size_; }
+
+    private:
+        int index_[256];
+        int size_;
+    };
 }
 
 #endif
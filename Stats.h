@@ -0,0 +1,143 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "Common.h"
+
+#include <chrono>
+#include <cstdio>
+
+/*
+  Statistics about building an automaton. Nothing is collected unless
+  a stats object is given (see set_stats() on NFA and DFA, and
+  Regex_Options::collect_stats), so building costs nothing extra by
+  default.
+
+    phases             wall time of each phase, in the order first run
+    nfa_states         states of the NFA
+    dfa_states         states of the DFA, including the dead state
+    closures           epsilon closures computed
+    hash_probes        lookups into the tables of known states
+    peak_bytes         largest working memory used while building
+    resident_bytes     memory held by the finished automaton
+    memory_limit_hits  automata not built for going over a memory limit
+
+  Byte counts are computed from the sizes of the containers used, not
+  measured from the allocator.
+*/
+struct Automaton_Stats
+{
+    struct Phase
+    {
+        std::string name;
+        double milliseconds;
+    };
+
+    Automaton_Stats()
+        : nfa_states(0), dfa_states(0), closures(0), hash_probes(0),
+          peak_bytes(0), resident_bytes(0), memory_limit_hits(0)
+    {}
+
+    // Adds time to a phase, creating it the first time.
+    void add_time(const std::string & phase, double milliseconds)
+    {
+        for (Phase & p : phases)
+        {
+            if (p.name == phase)
+            {
+                p.milliseconds += milliseconds;
+                return;
+            }
+        }
+        phases.push_back({phase, milliseconds});
+    }
+
+    // Wall time of a phase, 0 if it never ran.
+    double time(const std::string & phase) const
+    {
+        for (const Phase & p : phases)
+            if (p.name == phase)
+                return p.milliseconds;
+        return 0;
+    }
+
+    double total_time() const
+    {
+        double ret = 0;
+        for (const Phase & p : phases)
+            ret += p.milliseconds;
+        return ret;
+    }
+
+    void add_bytes(size_t bytes)
+    { peak_bytes = std::max(peak_bytes, bytes); }
+
+    std::string to_json() const
+    {
+        char buffer[64];
+        std::string ret = "{\"phases\":{", delim = "";
+        for (const Phase & p : phases)
+        {
+            snprintf(buffer, sizeof(buffer), "%.3f", p.milliseconds);
+            ret += delim + "\"" + p.name + "\":" + buffer;
+            delim = ",";
+        }
+        ret += "}";
+        ret += ",\"nfa_states\":" + std::to_string(nfa_states);
+        ret += ",\"dfa_states\":" + std::to_string(dfa_states);
+        ret += ",\"closures\":" + std::to_string(closures);
+        ret += ",\"hash_probes\":" + std::to_string(hash_probes);
+        ret += ",\"peak_bytes\":" + std::to_string(peak_bytes);
+        ret += ",\"resident_bytes\":" + std::to_string(resident_bytes);
+        ret += ",\"memory_limit_hits\":" + std::to_string(memory_limit_hits);
+        ret += "}";
+        return ret;
+    }
+
+    std::vector< Phase > phases;
+    size_t nfa_states;
+    size_t dfa_states;
+    size_t closures;
+    size_t hash_probes;
+    size_t peak_bytes;
+    size_t resident_bytes;
+    size_t memory_limit_hits;
+};
+
+/*
+  Adds the wall time of its scope to a phase of a stats object. Does
+  nothing when the stats object is null.
+*/
+class Stats_Timer
+{
+public:
+    Stats_Timer(Automaton_Stats * stats, const char * phase)
+        : stats_(stats), phase_(phase)
+    {
+        if (stats_ != nullptr)
+            start_ = std::chrono::steady_clock::now();
+    }
+
+    ~Stats_Timer()
+    {
+        if (stats_ == nullptr)
+            return;
+        std::chrono::duration< double, std::milli > elapsed =
+            std::chrono::steady_clock::now() - start_;
+        stats_->add_time(phase_, elapsed.count());
+    }
+
+private:
+    Automaton_Stats * stats_;
+    const char * phase_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+namespace helper
+{
+    // Bytes held by a vector, not counting the vector itself.
+    template< typename T >
+    size_t vector_bytes(const std::vector< T > & v)
+    { return v.capacity() * sizeof(T); }
+}
+
+#endif
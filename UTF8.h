@@ -0,0 +1,245 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include "Common.h"
+
+/*
+  UTF-8 helpers used by Regex to compile sets of code points into
+  byte-level automata.
+*/
+namespace utf8
+{
+    const uint32_t max_code_point = 0x10FFFF;
+
+    // A range of code points, both ends included.
+    typedef std::pair< uint32_t, uint32_t > Range;
+
+    // A sequence of byte ranges, one per encoded byte.
+    typedef std::vector< std::pair< uint8_t, uint8_t > > Sequence;
+
+    // Writes the encoding of c to out and returns its length.
+    inline int encode(uint32_t c, uint8_t out[4])
+    {
+        if (c < 0x80)
+        {
+            out[0] = c;
+            return 1;
+        }
+        if (c < 0x800)
+        {
+            out[0] = 0xC0 | (c >> 6);
+            out[1] = 0x80 | (c & 0x3F);
+            return 2;
+        }
+        if (c < 0x10000)
+        {
+            out[0] = 0xE0 | (c >> 12);
+            out[1] = 0x80 | ((c >> 6) & 0x3F);
+            out[2] = 0x80 | (c & 0x3F);
+            return 3;
+        }
+        out[0] = 0xF0 | (c >> 18);
+        out[1] = 0x80 | ((c >> 12) & 0x3F);
+        out[2] = 0x80 | ((c >> 6) & 0x3F);
+        out[3] = 0x80 | (c & 0x3F);
+        return 4;
+    }
+
+    inline std::string encode(uint32_t c)
+    {
+        uint8_t out[4];
+        int n = encode(c, out);
+        return std::string((const char *)out, n);
+    }
+
+    /*
+      Decodes the code point starting at s[i] into c and moves i past
+      it. Returns false, leaving i alone, if s[i] does not start a
+      valid (shortest form, non surrogate) encoding.
+    */
+    inline bool decode(const std::string & s, int & i, uint32_t & c)
+    {
+        int n = s.size();
+        uint8_t b = s[i];
+        int len;
+
+        if (b < 0x80)
+        {
+            c = b;
+            ++i;
+            return true;
+        }
+        else if (b >= 0xC2 && b <= 0xDF)
+        {
+            c = b & 0x1F;
+            len = 2;
+        }
+        else if (b >= 0xE0 && b <= 0xEF)
+        {
+            c = b & 0x0F;
+            len = 3;
+        }
+        else if (b >= 0xF0 && b <= 0xF4)
+        {
+            c = b & 0x07;
+            len = 4;
+        }
+        else
+            return false;
+
+        if (i + len > n)
+            return false;
+        for (int k = 1; k < len; ++k)
+        {
+            uint8_t t = s[i + k];
+            if ((t & 0xC0) != 0x80)
+                return false;
+            c = (c << 6) | (t & 0x3F);
+        }
+
+        // Overlong encodings, surrogates and values past the maximum.
+        if ((len == 3 && c < 0x800) || (len == 4 && c < 0x10000) ||
+            (c >= 0xD800 && c <= 0xDFFF) || c > max_code_point)
+        {
+            return false;
+        }
+
+        i += len;
+        return true;
+    }
+
+    // Number of positions between code points in the n bytes, counting
+    // both ends: one more than the bytes that are not continuation bytes.
+    inline size_t boundaries(const uint8_t * str, size_t n)
+    {
+        size_t ret = 1;
+        for (size_t i = 0; i < n; ++i)
+            ret += (str[i] & 0xC0) != 0x80;
+        return ret;
+    }
+
+    // Sorts and merges overlapping or adjacent ranges.
+    inline void normalize(std::vector< Range > & ranges)
+    {
+        std::sort(ranges.begin(), ranges.end());
+
+        std::vector< Range > ret;
+        for (const Range & r : ranges)
+        {
+            if (!ret.empty() && r.first <= ret.back().second + 1)
+                ret.back().second = std::max(ret.back().second, r.second);
+            else
+                ret.push_back(r);
+        }
+        ranges = ret;
+
+        return;
+    }
+
+    // Returns every code point not in the normalized ranges.
+    inline std::vector< Range > complement(const std::vector< Range > & ranges)
+    {
+        std::vector< Range > ret;
+        uint32_t next = 0;
+        for (const Range & r : ranges)
+        {
+            if (r.first > next)
+                ret.push_back({next, r.first - 1});
+            next = r.second + 1;
+        }
+        if (next <= max_code_point)
+            ret.push_back({next, max_code_point});
+
+        return ret;
+    }
+
+    /*
+      Splits the code points from lo to hi into sequences of byte
+      ranges, so that the encodings of the code points are exactly the
+      byte strings matched by the sequences. Surrogates are skipped.
+
+      [0x80-0x10FFFF] -->
+        [C2-DF][80-BF]
+        [E0][A0-BF][80-BF]
+        [E1-EC][80-BF][80-BF]
+        ...
+    */
+    inline std::vector< Sequence > sequences(uint32_t lo, uint32_t hi)
+    {
+        std::vector< Sequence > ret;
+        std::vector< Range > to_split = { {lo, hi} };
+
+        while (!to_split.empty())
+        {
+            Range r = to_split.back();
+            to_split.pop_back();
+            lo = r.first;
+            hi = r.second;
+
+            if (lo > hi)
+                continue;
+
+            // Cut out the surrogates.
+            if (lo <= 0xDFFF && hi >= 0xD800)
+            {
+                if (hi > 0xDFFF)
+                    to_split.push_back({0xE000, hi});
+                if (lo < 0xD800)
+                    to_split.push_back({lo, 0xD7FF});
+                continue;
+            }
+
+            // Split where the length of the encoding changes.
+            bool split = false;
+            for (const uint32_t & b : {0x7Fu, 0x7FFu, 0xFFFFu})
+            {
+                if (lo <= b && b < hi)
+                {
+                    to_split.push_back({b + 1, hi});
+                    to_split.push_back({lo, b});
+                    split = true;
+                    break;
+                }
+            }
+            if (split)
+                continue;
+
+            // Split until every continuation byte covers a full range
+            // below the point where lo and hi differ.
+            for (int k = 1; k < 4 && !split; ++k)
+            {
+                uint32_t m = (uint32_t(1) << (6 * k)) - 1;
+                if ((lo & ~m) != (hi & ~m))
+                {
+                    if ((lo & m) != 0)
+                    {
+                        to_split.push_back({(lo | m) + 1, hi});
+                        to_split.push_back({lo, lo | m});
+                        split = true;
+                    }
+                    else if ((hi & m) != m)
+                    {
+                        to_split.push_back({hi & ~m, hi});
+                        to_split.push_back({lo, (hi & ~m) - 1});
+                        split = true;
+                    }
+                }
+            }
+            if (split)
+                continue;
+
+            uint8_t lo_bytes[4], hi_bytes[4];
+            int n = encode(lo, lo_bytes);
+            encode(hi, hi_bytes);
+
+            Sequence s;
+            for (int k = 0; k < n; ++k)
+                s.push_back({lo_bytes[k], hi_bytes[k]});
+            ret.push_back(s);
+        }
+
+        return ret;
+    }
+}
+
+#endif
@@ -0,0 +1,591 @@
+/*
+  Benchmarks of compiling and matching, built and run by "make bench".
+
+  Every result is printed as one JSON object per line:
+
+    {"bench":"compile","family":"alternation","size":100,"ms":0.412,...}
+
+  where ms is the best wall time over the repetitions of one case.
+  Throughput results also give bytes_per_sec. Passing an argument
+  only runs the benchmarks whose name contains it, for instance
+
+    ./bench.out match
+*/
+#include "../RegLang.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <thread>
+
+static std::string filter;
+
+// Returns the best time in milliseconds of running f, repeated until
+// at least min_ms have passed or max_runs runs were made.
+template< typename F >
+static double best_time(F f, double min_ms = 100, int max_runs = 20)
+{
+    double best = 0, total = 0;
+    for (int run = 0; run < max_runs && (run < 1 || total < min_ms); ++run)
+    {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration< double, std::milli > elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        if (run == 0 || elapsed.count() < best)
+            best = elapsed.count();
+        total += elapsed.count();
+    }
+    return best;
+}
+
+static bool selected(const std::string & bench)
+{ return filter.empty() || bench.find(filter) != std::string::npos; }
+
+static std::string json_string(const std::string & s)
+{
+    std::string ret = "\"";
+    for (const char & c : s)
+    {
+        if (c == '"' || c == '\\')
+            ret += '\\';
+        if (uint8_t(c) < 0x20)
+        {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            ret += buffer;
+        }
+        else
+            ret += c;
+    }
+    return ret + "\"";
+}
+
+// Prints one result. extra holds more "key":value fields, if any.
+static void report(const std::string & bench, const std::string & family,
+                   size_t size, double ms, const std::string & extra = "")
+{
+    printf("{\"bench\":%s,\"family\":%s,\"size\":%zu,\"ms\":%.4f%s%s}\n",
+           json_string(bench).c_str(), json_string(family).c_str(),
+           size, ms, extra.empty() ? "" : ",", extra.c_str());
+    fflush(stdout);
+}
+
+static std::mt19937 rng(1);
+
+static std::string random_word(int min, int max)
+{
+    int n = min + rng() % (max - min + 1);
+    std::string ret;
+    for (int i = 0; i < n; ++i)
+        ret += char('a' + rng() % 26);
+    return ret;
+}
+
+/// COMPILE ///
+
+static void compile_case(const std::string & family, size_t size,
+                         const std::string & expression)
+{
+    Regex_Options options;
+    options.collect_stats = true;
+
+    Automaton_Stats stats;
+    double ms = best_time([&]()
+    {
+        Regex r(expression, options);
+        stats = r.stats();
+    });
+
+    report("compile", family, size, ms,
+           "\"dfa_states\":" + std::to_string(stats.dfa_states) +
+           ",\"stats\":" + stats.to_json());
+}
+
+/*
+  Compiles an expression and builds its whole DFA, by subset
+  construction and from derivatives (Regex_Options::derivatives),
+  and compares the states of the two.
+*/
+static void derivatives_case(const std::string & family, size_t size,
+                             const std::string & expression)
+{
+    for (const bool & derivatives : { false, true })
+    {
+        Regex_Options options;
+        options.derivatives = derivatives;
+
+        size_t states = 0;
+        double ms = best_time([&]()
+        {
+            Regex r(expression, options);
+            states = r.to_dfa().size();
+        });
+
+        report("compile", family + (derivatives ? " derivatives" : " subset"),
+               size, ms, "\"dfa_states\":" + std::to_string(states));
+    }
+}
+
+static void bench_compile()
+{
+    if (!selected("compile"))
+        return;
+
+    //Keyword lists, as in blocklists.
+    for (const int & n : { 10, 100, 1000, 10000 })
+    {
+        std::string expression, delim = "";
+        for (int i = 0; i < n; ++i)
+        {
+            expression += delim + random_word(4, 12);
+            delim = "|";
+        }
+        compile_case("alternation", n, expression);
+    }
+
+    //Alternations of expressions that are not literals.
+    for (const int & n : { 10, 100, 1000 })
+    {
+        std::string expression, delim = "";
+        for (int i = 0; i < n; ++i)
+        {
+            expression += delim + random_word(2, 5) + "[0-9]+" + random_word(1, 3);
+            delim = "|";
+        }
+        compile_case("pattern alternation", n, expression);
+    }
+
+    //Alternations whose alternatives share prefixes and suffixes, as
+    //in (abc|abd|abe), which simplification factors out.
+    for (const int & n : { 10, 100, 1000 })
+    {
+        std::string expression, delim = "";
+        for (int i = 0; i < n; ++i)
+        {
+            expression += delim + "(get|set)_" + random_word(2, 4) + "(_at|_by)?";
+            delim = "|";
+        }
+        compile_case("shared affixes", n, expression);
+    }
+
+    //The n-th symbol from the end, a DFA of 2^(n+1) states.
+    for (const int & n : { 4, 8, 12 })
+        compile_case("nth from end", n, "(a|b)*a(a|b){" + std::to_string(n) + "}");
+
+    //Nested quantifiers.
+    for (const int & n : { 2, 3, 4 })
+    {
+        std::string expression = "a";
+        for (int i = 0; i < n; ++i)
+            expression = "(" + expression + "*b|c){1," + std::to_string(2 + i % 3) + "}";
+        compile_case("nested quantifiers", n, expression);
+    }
+
+    //Counted repetitions of ranges.
+    for (const int & n : { 4, 16, 64 })
+        compile_case("ranges", n,
+                     "[a-zA-Z_][0-9a-fA-F]{" + std::to_string(n) + "}[^ ]*");
+
+    //Whole DFAs from derivatives against subset construction.
+    for (const int & n : { 4, 8, 12 })
+        derivatives_case("nth from end", n,
+                         "(a|b)*a(a|b){" + std::to_string(n) + "}");
+    for (const int & n : { 2, 3, 4 })
+    {
+        std::string expression = "a";
+        for (int i = 0; i < n; ++i)
+            expression = "(" + expression + "*b|c){1," + std::to_string(2 + i % 3) + "}";
+        derivatives_case("nested quantifiers", n, expression);
+    }
+    for (const int & n : { 10, 100 })
+    {
+        std::string expression, delim = "";
+        for (int i = 0; i < n; ++i)
+        {
+            expression += delim + random_word(2, 5) + "[0-9]+" + random_word(1, 3);
+            delim = "|";
+        }
+        derivatives_case("pattern alternation", n, expression);
+    }
+
+    //Subset construction on 1 to 8 threads, of one large DFA and of
+    //a set of expressions.
+    std::vector< std::string > rules;
+    for (int i = 0; i < 64; ++i)
+        rules.push_back("[a-d]*" + random_word(1, 2) + "[a-d]{" +
+                        std::to_string(8 + i % 3) + "}" + random_word(2, 4));
+    for (const int & n : { 1, 2, 4, 8 })
+    {
+        Regex_Options options;
+        options.threads = n;
+        options.dfa_memory_limit = 0;
+        double ms = best_time([&]()
+        { Regex r("(a|b|c)*a(a|b|c){14}", options); });
+        report("compile", "threads nth from end", n, ms);
+
+        ms = best_time([&]() { RegexSet set(rules, options); });
+        report("compile", "threads regex set", n, ms);
+    }
+
+    //Ranges of multi-byte characters.
+    for (const int & n : { 1, 4, 16 })
+        compile_case("unicode ranges", n,
+                     "([α-ω]|[一-龥]|[а-я]){" + std::to_string(n) + "}");
+
+    return;
+}
+
+/// AUTOMATA ///
+
+// NFA of (a|b)*a(a|b){n}, whose DFA has 2^(n+1) states.
+static NFA< int, int > nth_from_end_nfa(int n)
+{
+    std::unordered_set< int > states, accept = { n + 1 };
+    NFA< int, int >::D_t delta;
+    for (int q = 0; q <= n + 1; ++q)
+        states.insert(q);
+
+    delta[{0, 0}] = { 0, 1 };
+    delta[{0, 1}] = { 0 };
+    for (int q = 1; q <= n; ++q)
+        delta[{q, 0}] = delta[{q, 1}] = { q + 1 };
+
+    return NFA< int, int >({ -1, 0, 1 }, states, 0, accept, delta, -1);
+}
+
+// A complete DFA with n states and random transitions over k symbols.
+static DFA< int, int > random_dfa(int n, int k)
+{
+    std::unordered_set< int > sigma, states, accept;
+    DFA< int, int >::D_t delta;
+    for (int c = 0; c < k; ++c)
+        sigma.insert(c);
+    for (int q = 0; q < n; ++q)
+    {
+        states.insert(q);
+        if (rng() % 2)
+            accept.insert(q);
+        for (int c = 0; c < k; ++c)
+            delta[{q, c}] = rng() % n;
+    }
+    return DFA< int, int >(sigma, states, 0, accept, delta);
+}
+
+static void bench_automata()
+{
+    if (selected("construct_dfa"))
+    {
+        for (const int & n : { 4, 6, 8 })
+        {
+            NFA< int, int > N = nth_from_end_nfa(n);
+            size_t states = 0;
+            double ms = best_time([&]()
+            {
+                //Copies do not share the lazily built DFA.
+                NFA< int, int > copy(N);
+                states = copy.to_dfa().states().size();
+            });
+            report("construct_dfa", "nth from end", n, ms,
+                   "\"dfa_states\":" + std::to_string(states));
+        }
+    }
+
+    if (selected("minimal"))
+    {
+        for (const int & n : { 50, 200, 800 })
+        {
+            DFA< int, int > M = random_dfa(n, 4);
+            size_t states = 0;
+            double ms = best_time([&]()
+            { states = M.minimal().states().size(); });
+            report("minimal", "random", n, ms,
+                   "\"minimal_states\":" + std::to_string(states));
+        }
+    }
+
+    if (selected("intersection"))
+    {
+        for (const int & n : { 20, 60, 180 })
+        {
+            DFA< int, int > M0 = random_dfa(n, 4), M1 = random_dfa(n, 4);
+            size_t states = 0;
+            double ms = best_time([&]()
+            { states = dfa_intersection(M0, M1).states().size(); });
+            report("intersection", "random", n, ms,
+                   "\"product_states\":" + std::to_string(states));
+        }
+
+        //Byte DFAs of two expressions.
+        for (const int & n : { 4, 8, 10 })
+        {
+            std::string k = std::to_string(n);
+            DFA< uint8_t, uint32_t > M0 = Regex("[ab]*a[ab]{" + k + "}").to_dfa(),
+                M1 = Regex("[ab]*b[ab]{" + k + "}b").to_dfa();
+            size_t states = 0;
+            double ms = best_time([&]()
+            { states = dfa_product(M0, M1, DFA_INTERSECTION).size(); });
+            report("intersection", "byte nth from end", n, ms,
+                   "\"product_states\":" + std::to_string(states));
+        }
+    }
+
+    if (selected("to_regex"))
+    {
+        for (const int & n : { 10, 40, 160 })
+        {
+            NFA< std::string, std::string > N =
+                Regex("((a|b)(c|d)*e){" + std::to_string(n) + "}").to_nfa();
+            size_t length = 0;
+            double ms = best_time([&]()
+            { length = N.to_regex("qi", "qa", "\x01").expression().size(); });
+            report("to_regex", "repeated group", n, ms,
+                   "\"nfa_states\":" + std::to_string(N.states().size()) +
+                   ",\"length\":" + std::to_string(length));
+        }
+    }
+
+    return;
+}
+
+/// MATCHING ///
+
+// Synthetic access log of about size bytes, one request per line.
+static std::string log_corpus(size_t size)
+{
+    static const char * methods[] = { "GET", "GET", "GET", "POST", "PUT", "DELETE" };
+    static const char * levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN" };
+    static const char * paths[] = { "/api/v1/items", "/api/v1/users",
+                                    "/static/app.js", "/health", "/login" };
+    std::string ret;
+    char line[256];
+    while (ret.size() < size)
+    {
+        snprintf(line, sizeof(line),
+                 "2024-%02d-%02dT%02d:%02d:%02d %s [worker-%d] %s %s/%u %d %dms\n",
+                 int(1 + rng() % 12), int(1 + rng() % 28), int(rng() % 24),
+                 int(rng() % 60), int(rng() % 60),
+                 levels[rng() % 5], int(rng() % 32), methods[rng() % 6],
+                 paths[rng() % 5], unsigned(rng() % 100000),
+                 rng() % 20 ? 200 : 404, int(rng() % 500));
+        ret += line;
+    }
+    return ret;
+}
+
+static void bench_match()
+{
+    if (!selected("match"))
+        return;
+
+    const std::string corpus = log_corpus(32 << 20);
+    std::vector< std::pair< const char *, size_t > > lines;
+    for (size_t i = 0, start = 0; i < corpus.size(); ++i)
+    {
+        if (corpus[i] == '\n')
+        {
+            lines.push_back({corpus.data() + start, i - start});
+            start = i + 1;
+        }
+    }
+
+    std::vector< const char * > line_starts;
+    std::vector< size_t > line_lengths;
+    for (const std::pair< const char *, size_t > & l : lines)
+    {
+        line_starts.push_back(l.first);
+        line_lengths.push_back(l.second);
+    }
+    std::unique_ptr< bool[] > line_results(new bool[lines.size()]);
+
+    auto throughput = [&](double ms) -> std::string
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "\"bytes_per_sec\":%.0f",
+                 corpus.size() / (ms / 1000));
+        return buffer;
+    };
+
+    //Full matches of every line.
+    for (const char * expression :
+             { "2024-[0-9]+-[0-9]+T[0-9:]+ INFO .*",
+               "[^ ]+ [A-Z]+ /[worker-[0-9]+/] (GET|POST) [^ ]+ 404 [0-9]+ms",
+               "2024-(0[1-9]|1[0-2])-[0-9]{2}T.* [0-9]{3}ms" })
+    {
+        Regex r(expression);
+        size_t matches = 0;
+        double ms = best_time([&]()
+        {
+            matches = 0;
+            for (const std::pair< const char *, size_t > & l : lines)
+                matches += r(l.first, l.second);
+        });
+        report("match lines", expression, corpus.size(), ms,
+               throughput(ms) + ",\"matches\":" + std::to_string(matches));
+
+        ms = best_time([&]()
+        {
+            r.match_batch(line_starts.data(), line_lengths.data(), lines.size(),
+                          line_results.get());
+            matches = std::count(line_results.get(),
+                                 line_results.get() + lines.size(), true);
+        });
+        report("match lines batch", expression, corpus.size(), ms,
+               throughput(ms) + ",\"matches\":" + std::to_string(matches));
+
+        ms = best_time([&]()
+        { matches = r.matching_lines(corpus).size(); });
+        report("match line mode", expression, corpus.size(), ms,
+               throughput(ms) + ",\"matches\":" + std::to_string(matches));
+    }
+
+    //Searches of the whole corpus, none of which is found.
+    for (const char * expression :
+             { "ERROR", "FATAL|PANIC|SEGFAULT", "worker-[0-9]+/] PATCH",
+               "[0-9]+ 500 [0-9]+ms", "(a|b)*a(a|b){6}X" })
+    {
+        Regex r(expression);
+        bool found = false;
+        double ms = best_time([&]()
+        { found = r.search(corpus); });
+        report("match search", expression, corpus.size(), ms,
+               throughput(ms) + ",\"found\":" + (found ? "true" : "false"));
+    }
+
+    //Counts over the whole corpus.
+    for (const char * expression :
+             { "2024-[0-9]+-[0-9]+T[0-9:]+ INFO .*", "[0-9]+ 404 [0-9]+ms" })
+    {
+        Regex r(expression);
+        size_t lines = 0, matches = 0;
+        double ms = best_time([&]()
+        { lines = r.count_matching_lines(corpus); });
+        report("match count lines", expression, corpus.size(), ms,
+               throughput(ms) + ",\"matches\":" + std::to_string(lines));
+
+        ms = best_time([&]()
+        { matches = r.count_matches(corpus); });
+        report("match count", expression, corpus.size(), ms,
+               throughput(ms) + ",\"matches\":" + std::to_string(matches));
+    }
+
+    //Full matches of one long string, reading 1, 2 or 4 bytes per
+    //lookup of the DFA.
+    std::string long_string;
+    for (size_t i = 0; i < (16 << 20); ++i)
+        long_string += "abcd"[rng() % 4];
+    for (const char * expression :
+             { "[a-d]*a[a-d]{3}", "([a-d][a-d])*(ab|cd){2}[a-d]*e?" })
+    {
+        for (const size_t & limit : { size_t(0), size_t(4) << 10, size_t(256) << 10 })
+        {
+            Regex_Options options;
+            options.stride_table_limit = limit;
+            Regex r(expression, options);
+            double ms = best_time([&]() { r(long_string); });
+            char buffer[96];
+            snprintf(buffer, sizeof(buffer), "\"bytes_per_sec\":%.0f,\"stride\":%d",
+                     long_string.size() / (ms / 1000), r.to_dfa().stride());
+            report("match stride", expression, long_string.size(), ms, buffer);
+        }
+    }
+
+    //Full matches on a DFA larger than the L1 cache, with its states in
+    //breadth first order and then by how often a sample of the string
+    //visits them.
+    std::string skewed;
+    for (size_t i = 0; i < (16 << 20); ++i)
+        skewed += rng() % 8 == 0 ? 'a' : "bcd"[rng() % 3];
+    for (const char * expression : { "[a-d]*a[a-d]{11}", "[a-d]*(ab|cd)[a-d]{10}" })
+    {
+        Regex_Options options;
+        options.stride_table_limit = 0;
+        Regex r(expression, options);
+        for (const char * order : { "breadth first", "profiled" })
+        {
+            if (std::string(order) == "profiled")
+                r.profile({ skewed.substr(0, 1 << 16) });
+            double ms = best_time([&]() { r(skewed); });
+            char buffer[96];
+            snprintf(buffer, sizeof(buffer), "\"bytes_per_sec\":%.0f,\"states\":%u,\"order\":\"%s\"",
+                     skewed.size() / (ms / 1000), r.to_dfa().size(), order);
+            report("match profile", expression, skewed.size(), ms, buffer);
+        }
+    }
+
+    //Classification of the words of the corpus, one call per word and
+    //in batches.
+    std::vector< const char * > words;
+    std::vector< size_t > lengths;
+    size_t word_bytes = 0;
+    for (size_t i = 0, start = 0; i < corpus.size(); ++i)
+    {
+        if (corpus[i] == ' ' || corpus[i] == '\n')
+        {
+            words.push_back(corpus.data() + start);
+            lengths.push_back(i - start);
+            word_bytes += i - start;
+            start = i + 1;
+        }
+    }
+    std::unique_ptr< bool[] > results(new bool[words.size()]);
+    for (const char * expression :
+             { "[0-9]+ms", "[0-9T:-]+", "//api//.*[0-9]" })
+    {
+        Regex r(expression);
+        size_t matches = 0;
+        double ms = best_time([&]()
+        {
+            matches = 0;
+            for (size_t i = 0; i < words.size(); ++i)
+                matches += r(words[i], lengths[i]);
+        });
+        report("match words", expression, words.size(), ms,
+               "\"matches\":" + std::to_string(matches));
+
+        ms = best_time([&]()
+        {
+            r.match_batch(words.data(), lengths.data(), words.size(), results.get());
+            matches = std::count(results.get(), results.get() + words.size(), true);
+        });
+        report("match batch", expression, words.size(), ms,
+               "\"matches\":" + std::to_string(matches));
+    }
+
+    //Threads sharing one Regex, each searching the whole corpus, on a
+    //warm search DFA.
+    Regex shared("[0-9]+ 4[0-9]{2} [0-9]{3}msX");
+    shared.search(corpus);
+    for (const int & n : { 1, 2, 4, 8 })
+    {
+        double ms = best_time([&]()
+        {
+            std::vector< std::thread > threads;
+            for (int t = 0; t < n; ++t)
+                threads.emplace_back([&]() { shared.search(corpus); });
+            for (std::thread & t : threads)
+                t.join();
+        });
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "\"bytes_per_sec\":%.0f",
+                 n * corpus.size() / (ms / 1000));
+        report("match threads", shared.expression(), n, ms, buffer);
+    }
+
+    return;
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc > 1)
+        filter = argv[1];
+
+    bench_compile();
+    bench_automata();
+    bench_match();
+
+    return 0;
+}
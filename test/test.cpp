@@ -0,0 +1,1227 @@
+/*
+  Tests of the matchers against std::regex, built and run by
+  "make test".
+
+  Every expression is built once per option variant (see variants())
+  and every check compares it with std::regex on strings made of
+  pieces of the expression, so that most of them come close to
+  matching. The generic NFA and DFA templates are checked once, on
+  the automata of the expressions. One line is printed per check and
+  variant:
+
+    match            default               16200 compared, 0 failed
+
+  followed by the first few failures in full. The exit status is 1 if
+  any comparison failed. Passing an argument only runs the checks
+  whose name contains it, for instance
+
+    ./test.out search
+*/
+#include "../RegLang.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <regex>
+#include <set>
+#include <thread>
+
+static std::string filter;
+static std::mt19937 rng(1);
+
+// Expressions in the syntax of Regex, '/' escaping the next character.
+static const std::vector< std::string > expressions = {
+    //Counted repetition.
+    "a{3}", "(ab){2,4}", "a{2,}b", "[0-9]{1,5}", "(a|b)*a(a|b){3}",
+    "a{0}b", "(a{1,3}b){2}", "(ab){0,3}c{2}", "x{2}(y|z){1,2}",
+    "a{1,1}b{0,1}",
+
+    //Plain operators.
+    "a(b|c)*d", "(ab|a)(bc|c)", "a|", "(a|b)+c?", "((a|b)c)*", "(a*)*b",
+    "x(y|z)*x?", "ab?c+", "/++a", "(a|)(b|)", "",
+
+    //Classes, negated classes and '.'.
+    "[^a-c]+", "[-a]b[a-]", ".*a.{2}", "[^\n]*", "[ -~]*", "(.|\n)x",
+    "[^^]a", "a./.b", "\"[^\"]*\"", "[/]/-]+", "[a-cx-z]+[^x-z]",
+
+    //Prefixes, suffixes and required literals.
+    "GET .*", "[0-9]+ ERROR [a-z]+", "(ab|cb)d", "abc", "x(abc|abd)y",
+    "(foo)+bar", "a*needle[a-c]*", "(ab){2}c", "[ab]*(xyz|xyw)[ab]*",
+
+    //Unions factored and repetitions merged by simplification.
+    "xa|ya", "ab|ac|ad|b", "(ab|ac)d|(ab|ac)e", "(a|a|b)c", "a*a*b",
+    "(a*){2,3}", "(a?)*b", "(a|)*c", "(a+){2,}", "(a+){0,2}b", "a{1}b{0}",
+    "(x|xy)(z|yz)", "[ab]|[bc]|d", "(abc|ab)c*", "(a|ab|abc)*d",
+
+    //Suffixes that overlap themselves, found backwards from each
+    //occurrence.
+    "xa*aa", "a*aa", "[^a]a*aa", "b(ab)*abab", "(ab|b)*bab", "c[ab]*aba",
+
+    //Capture groups.
+    "([0-9]+)-([0-9]+)", "(a*)(a*)", "((a)|b)+", "(a|ab)(c|bcd)(d*)",
+    "x(y(z)?)*", "(a|b)*(b)", "((ab)|(a))(b*)",
+
+    //Alternations of literals, and one of many words in cases().
+    "GET|POST|PUT", "cat|dog|do|g", "a|ab|abc|", "(he|she)|(his|hers)",
+    "x|xy|xyz|y", "abc|abd|abe",
+};
+
+/*
+  Expressions and strings in UTF-8, tested as code points against
+  std::wregex with Regex_Options::utf8, and as bytes against std::regex
+  without it. Ranges of code points only have the first meaning.
+*/
+static const std::vector< std::string > utf8_expressions = {
+    "\u00e9+", ".{2}", "[^a]b", "(\u20ac|\U0001f600)*a", "a.b", "\U0001f600{2}",
+    "x[^a-z]y", "[^\u00e9]*",
+};
+static const std::vector< std::string > code_point_expressions = {
+    "[\u00e0-\u00ff]x", "[\u03b1-\u03c9]+", "[a\u00e9-\u00ea\u20ac]{1,2}",
+};
+
+/*
+  The expression in the syntax of std::regex, which escapes with '\'
+  where Regex escapes with '/'.
+*/
+static std::string ecmascript(const std::string & expression)
+{
+    std::string ret;
+    for (size_t i = 0; i < expression.size(); ++i)
+    {
+        if (expression[i] == '/' && i + 1 < expression.size())
+            ret += '\\', ret += expression[++i];
+        else
+            ret += expression[i];
+    }
+    return ret;
+}
+
+/*
+  Pieces strings are made of: every character the expression names,
+  every run of them, and ones it does not name, among them the newline
+  '.' and negated classes leave out. Only expressions in UTF-8 get
+  characters of several bytes they do not name, and in bytes a lone
+  continuation byte.
+*/
+static std::vector< std::string > pieces(const std::string & expression,
+                                         bool utf8, bool bytes)
+{
+    const std::string operators = "()|*+?{},[]-^.";
+    std::vector< std::string > ret = { "#", "\n" };
+    if (utf8 || bytes)
+        ret.insert(ret.end(), { "\u00fc", "\U0001f600" });
+    if (bytes)
+        ret.push_back("\xa9");
+    std::string run;
+    for (size_t i = 0; i <= expression.size(); ++i)
+    {
+        bool escaped = i < expression.size() && expression[i] == '/';
+        if (escaped)
+            ++i;
+        if (i < expression.size() &&
+            (escaped || operators.find(expression[i]) == std::string::npos))
+        {
+            //A character of UTF-8 is one piece.
+            size_t length = 1;
+            while (i + length < expression.size() &&
+                   (uint8_t(expression[i + length]) & 0xc0) == 0x80)
+                ++length;
+            ret.push_back(expression.substr(i, length));
+            run += expression.substr(i, length);
+            i += length - 1;
+            continue;
+        }
+        if (run.size() > 1)
+            ret.push_back(run);
+        run.clear();
+    }
+    return ret;
+}
+
+static std::vector< std::string > random_strings(const std::vector< std::string > & from,
+                                                 int count, int max_pieces)
+{
+    std::vector< std::string > ret;
+    for (int i = 0; i < count; ++i)
+    {
+        std::string s;
+        int n = rng() % (max_pieces + 1);
+        for (int k = 0; k < n; ++k)
+            s += from[rng() % from.size()];
+        ret.push_back(s);
+    }
+    return ret;
+}
+
+/*
+  The code points of a string of UTF-8, and in offsets the offset of
+  each of them followed by the length of the string.
+*/
+static std::wstring decode(const std::string & s, std::vector< size_t > & offsets)
+{
+    std::wstring ret;
+    offsets.clear();
+    for (size_t i = 0; i < s.size(); )
+    {
+        uint8_t c = s[i];
+        int length = c < 0x80 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+        uint32_t code = length == 1 ? c : c & (0x7f >> length);
+        for (int k = 1; k < length; ++k)
+            code = (code << 6) | (uint8_t(s[i + k]) & 0x3f);
+        offsets.push_back(i);
+        ret += wchar_t(code);
+        i += length;
+    }
+    offsets.push_back(s.size());
+    return ret;
+}
+
+/*
+  Which substrings of a string std::regex matches in whole, found once
+  and shared by every variant. Offsets are in bytes either way, and
+  with std::wregex substrings start and end between code points.
+*/
+class Oracle
+{
+public:
+    Oracle(const std::regex & e, const std::string & s)
+        : n_(s.size()), matched_((n_ + 1) * (n_ + 1), 0)
+    {
+        for (size_t begin = 0; begin <= n_; ++begin)
+            for (size_t end = begin; end <= n_; ++end)
+                matched_[begin * (n_ + 1) + end] =
+                    std::regex_match(s.begin() + begin, s.begin() + end, e);
+    }
+
+    Oracle(const std::wregex & e, const std::string & s)
+        : n_(s.size()), matched_((n_ + 1) * (n_ + 1), 0)
+    {
+        std::vector< size_t > offsets;
+        std::wstring w = decode(s, offsets);
+        for (size_t begin = 0; begin <= w.size(); ++begin)
+            for (size_t end = begin; end <= w.size(); ++end)
+                matched_[offsets[begin] * (n_ + 1) + offsets[end]] =
+                    std::regex_match(w.begin() + begin, w.begin() + end, e);
+    }
+
+    bool at(size_t begin, size_t end) const
+    { return matched_[begin * (n_ + 1) + end]; }
+
+    bool match() const
+    { return at(0, n_); }
+
+    /*
+      The match starting from from on that ends first, and of those the
+      longest, as Regex::search() finds it.
+    */
+    bool search(size_t from, size_t & begin, size_t & end) const
+    {
+        for (end = from; end <= n_; ++end)
+            for (begin = from; begin <= end; ++begin)
+                if (at(begin, end))
+                    return true;
+        return false;
+    }
+
+    bool search() const
+    {
+        size_t begin, end;
+        return search(0, begin, end);
+    }
+
+private:
+    size_t n_;
+    std::vector< uint8_t > matched_;
+};
+
+/*
+  An expression, the strings it is tested on and what std::regex says,
+  for the variants with or without Regex_Options::utf8, or both.
+*/
+struct Case
+{
+    enum Mode
+    {
+        ANY,
+        UTF8,
+        BYTES
+    };
+
+    std::string expression;
+    Mode mode;
+    std::vector< std::string > strings;
+    std::vector< Oracle > oracles;
+
+    //True if the string followed by at most two pieces matches, so
+    //that a match can still be reached from it.
+    std::vector< uint8_t > extends;
+
+    //Spans std::regex gives the whole string and the match
+    //Oracle::search() finds, empty for strings without.
+    int groups;
+    std::vector< std::vector< Regex_Span > > match_groups;
+    std::vector< std::vector< Regex_Span > > search_groups;
+};
+
+static bool oracle_match(const std::regex & e, const std::string & s)
+{ return std::regex_match(s, e); }
+
+static bool oracle_match(const std::wregex & e, const std::string & s)
+{
+    std::vector< size_t > offsets;
+    return std::regex_match(decode(s, offsets), e);
+}
+
+/*
+  Spans of the groups std::regex finds in s[begin, end), in bytes of s.
+  Groups std::regex matches to the empty string are left unmatched, as
+  Regex may place those elsewhere.
+*/
+static std::vector< Regex_Span > oracle_groups(const std::regex & e, const std::string & s,
+                                               size_t begin, size_t end)
+{
+    std::smatch m;
+    std::regex_match(s.begin() + begin, s.begin() + end, m, e);
+    std::vector< Regex_Span > ret;
+    for (size_t g = 0; g < m.size(); ++g)
+    {
+        if (!m[g].matched || (g != 0 && m.length(g) == 0))
+            ret.push_back({ Regex_Span::npos, Regex_Span::npos });
+        else
+            ret.push_back({ begin + m.position(g), begin + m.position(g) + m.length(g) });
+    }
+    return ret;
+}
+
+static std::vector< Regex_Span > oracle_groups(const std::wregex & e, const std::string & s,
+                                               size_t begin, size_t end)
+{
+    std::vector< size_t > offsets;
+    std::wstring w = decode(s.substr(begin, end - begin), offsets);
+    std::wsmatch m;
+    std::regex_match(w, m, e);
+    std::vector< Regex_Span > ret;
+    for (size_t g = 0; g < m.size(); ++g)
+    {
+        if (!m[g].matched || (g != 0 && m.length(g) == 0))
+            ret.push_back({ Regex_Span::npos, Regex_Span::npos });
+        else
+            ret.push_back({ begin + offsets[m.position(g)],
+                            begin + offsets[m.position(g) + m.length(g)] });
+    }
+    return ret;
+}
+
+template< typename R >
+static void find_oracles(Case & c, const R & e, const std::vector< std::string > & from)
+{
+    //Pairs of pieces only when there are few of them.
+    std::vector< std::string > suffixes = from;
+    if (from.size() <= 16)
+        for (const std::string & a : from)
+            for (const std::string & b : from)
+                suffixes.push_back(a + b);
+
+    c.groups = e.mark_count();
+    for (const std::string & s : c.strings)
+    {
+        c.oracles.push_back(Oracle(e, s));
+        bool extends = c.oracles.back().match();
+        for (size_t k = 0; k < suffixes.size() && !extends; ++k)
+            extends = oracle_match(e, s + suffixes[k]);
+        c.extends.push_back(extends);
+
+        size_t begin, end;
+        c.match_groups.push_back(c.oracles.back().match() ?
+                                 oracle_groups(e, s, 0, s.size()) :
+                                 std::vector< Regex_Span >());
+        c.search_groups.push_back(c.oracles.back().search(0, begin, end) ?
+                                  oracle_groups(e, s, begin, end) :
+                                  std::vector< Regex_Span >());
+    }
+    return;
+}
+
+static Case new_case(const std::string & expression, Case::Mode mode)
+{
+    Case c;
+    c.expression = expression;
+    c.mode = mode;
+    std::vector< std::string > from = pieces(expression, mode == Case::UTF8,
+                                             mode == Case::BYTES);
+    c.strings = random_strings(from, 200, 8);
+    if (mode == Case::UTF8)
+    {
+        std::vector< size_t > offsets;
+        find_oracles(c, std::wregex(decode(ecmascript(expression), offsets)), from);
+    }
+    else
+        find_oracles(c, std::regex(ecmascript(expression)), from);
+    return c;
+}
+
+// An alternation of count random words of a to c.
+static std::string word_alternation(int count)
+{
+    std::string ret;
+    for (int i = 0; i < count; ++i)
+    {
+        ret += i == 0 ? "" : "|";
+        for (int n = 1 + rng() % 5; n > 0; --n)
+            ret += char('a' + rng() % 3);
+    }
+    return ret;
+}
+
+static std::vector< Case > cases()
+{
+    std::vector< Case > ret;
+    for (const std::string & expression : expressions)
+        ret.push_back(new_case(expression, Case::ANY));
+    for (const std::string & expression : utf8_expressions)
+    {
+        ret.push_back(new_case(expression, Case::UTF8));
+        ret.push_back(new_case(expression, Case::BYTES));
+    }
+    for (const std::string & expression : code_point_expressions)
+        ret.push_back(new_case(expression, Case::UTF8));
+    ret.push_back(new_case(word_alternation(300), Case::ANY));
+    return ret;
+}
+
+// Returns true if the case is tested on the variant with options o.
+static bool applies(const Case & c, const Regex_Options & o)
+{
+    return c.mode == Case::ANY || (c.mode == Case::UTF8) == o.utf8;
+}
+
+struct Variant
+{
+    std::string name;
+    Regex_Options options;
+};
+
+static std::vector< Variant > variants()
+{
+    std::vector< Variant > ret;
+    Regex_Options o;
+    ret.push_back({ "default", o });
+
+    o = Regex_Options();
+    o.utf8 = false;
+    ret.push_back({ "bytes", o });
+
+    //Every DFA over the limit: lazy DFAs falling back to the NFA.
+    o = Regex_Options();
+    o.dfa_memory_limit = 1;
+    ret.push_back({ "limit", o });
+
+    o.utf8 = false;
+    ret.push_back({ "bytes, limit", o });
+
+    //Reading one byte at a time, mostly 2 bytes, and 4 bytes whenever
+    //the table fits.
+    o = Regex_Options();
+    o.stride_table_limit = 0;
+    ret.push_back({ "no stride", o });
+
+    o.stride_table_limit = size_t(4) << 10;
+    ret.push_back({ "small stride", o });
+
+    o.stride_table_limit = size_t(16) << 20;
+    ret.push_back({ "wide stride", o });
+
+    //Derivatives, with room for a few states before the NFA takes
+    //over, and with none.
+    o = Regex_Options();
+    o.derivatives = true;
+    ret.push_back({ "derivatives", o });
+
+    o.utf8 = false;
+    ret.push_back({ "bytes, derivatives", o });
+
+    o.utf8 = true;
+    o.dfa_memory_limit = size_t(4) << 10;
+    ret.push_back({ "derivatives, 4 KiB", o });
+
+    o.dfa_memory_limit = 1;
+    ret.push_back({ "derivatives, limit", o });
+
+    //Subset construction and RegexSet built on several threads.
+    o = Regex_Options();
+    o.threads = 4;
+    ret.push_back({ "threads", o });
+    return ret;
+}
+
+// The string with newlines shown as \n.
+static std::string printable(const std::string & s)
+{
+    std::string ret;
+    for (const char & c : s)
+        ret += c == '\n' ? std::string("\\n") : std::string(1, c);
+    return ret;
+}
+
+// Comparisons of one check on one variant, and the first failures.
+class Check
+{
+public:
+    Check(const std::string & name, const std::string & variant)
+        : name_(name), variant_(variant), compared_(0), failed_(0)
+    {}
+
+    void expect(bool ok, const Case & c, const std::string & str,
+                const std::string & what = "")
+    {
+        ++compared_;
+        if (ok)
+            return;
+        if (failed_++ < 5)
+            details_ += "  " + printable(c.expression) + " on \"" +
+                printable(str) + "\"" +
+                (what.empty() ? "" : ": " + what) + "\n";
+    }
+
+    ~Check()
+    {
+        printf("%-16s %-19s %7zu compared, %zu failed\n%s", name_.c_str(),
+               variant_.c_str(), compared_, failed_, details_.c_str());
+        fflush(stdout);
+        if (failed_ != 0)
+            failures = true;
+    }
+
+    static bool failures;
+
+private:
+    std::string name_;
+    std::string variant_;
+    size_t compared_;
+    size_t failed_;
+    std::string details_;
+};
+
+bool Check::failures = false;
+
+static void check_match(const Case & c, const Regex & r, Check & check)
+{
+    for (size_t i = 0; i < c.strings.size(); ++i)
+        check.expect(r(c.strings[i]) == c.oracles[i].match(), c, c.strings[i]);
+    return;
+}
+
+static void check_search(const Case & c, const Regex & r, Check & check)
+{
+    for (size_t i = 0; i < c.strings.size(); ++i)
+        check.expect(r.search(c.strings[i]) == c.oracles[i].search(),
+                     c, c.strings[i]);
+    return;
+}
+
+// Every matching string lies within the length bounds.
+static void check_lengths(const Case & c, const Regex & r, Check & check)
+{
+    for (size_t i = 0; i < c.strings.size(); ++i)
+    {
+        size_t n = c.strings[i].size();
+        if (c.oracles[i].match())
+            check.expect(r.min_length() <= n && n <= r.max_length(), c, c.strings[i],
+                         "lengths " + std::to_string(r.min_length()) + " to " +
+                         std::to_string(r.max_length()));
+    }
+    return;
+}
+
+/*
+  Strings that match, their prefixes, and strings std::regex finds an
+  extension of, can still match. For an alternation of literals, the
+  strings that can are exactly the prefixes of its words.
+*/
+static void check_can_still_match(const Case & c, const Regex & r, Check & check)
+{
+    std::vector< std::string > words;
+    bool literal = r.literal_alternation(words);
+    for (size_t i = 0; i < c.strings.size(); ++i)
+    {
+        const std::string & s = c.strings[i];
+        check.expect(!c.extends[i] || r.can_still_match(s), c, s);
+        if (literal)
+        {
+            bool prefix = false;
+            for (const std::string & w : words)
+                prefix = prefix || w.compare(0, s.size(), s) == 0;
+            check.expect(r.can_still_match(s) == prefix, c, s, "word prefix");
+        }
+        if (c.oracles[i].match())
+            for (size_t n = 0; n < s.size(); ++n)
+                check.expect(r.can_still_match(s.substr(0, n)), c, s,
+                             "prefix of " + std::to_string(n) + " bytes");
+    }
+    return;
+}
+
+/*
+  count_matches() counts what searching again from the end of each
+  match finds, one past it after an empty match.
+*/
+static void check_count_matches(const Case & c, const Regex & r, Check & check)
+{
+    for (size_t i = 0; i < c.strings.size(); ++i)
+    {
+        const std::string & s = c.strings[i];
+        size_t expected = 0;
+        size_t begin, end;
+        for (size_t p = 0; p <= s.size() && c.oracles[i].search(p, begin, end);
+             p = end + (begin == end))
+            ++expected;
+
+        size_t n = r.count_matches(s);
+        check.expect(n == expected, c, s, "count " + std::to_string(n) + ", not " +
+                     std::to_string(expected));
+    }
+    return;
+}
+
+// Both forms of match_batch() agree with std::regex on all the strings.
+static void check_batch(const Case & c, const Regex & r, Check & check)
+{
+    std::vector< bool > results;
+    r.match_batch(c.strings, results);
+
+    std::vector< const char * > strs;
+    std::vector< size_t > lengths;
+    for (const std::string & s : c.strings)
+    {
+        strs.push_back(s.data());
+        lengths.push_back(s.size());
+    }
+    std::unique_ptr< bool[] > pointer_results(new bool[c.strings.size()]);
+    r.match_batch(strs.data(), lengths.data(), c.strings.size(), pointer_results.get());
+
+    check.expect(results.size() == c.strings.size(), c, "",
+                 std::to_string(results.size()) + " results");
+    for (size_t i = 0; i < c.strings.size() && i < results.size(); ++i)
+        check.expect(results[i] == c.oracles[i].match() &&
+                     pointer_results[i] == c.oracles[i].match(), c, c.strings[i]);
+    return;
+}
+
+// A copy profiled on the strings renumbers its states and still agrees.
+static void check_profile(const Case & c, const Regex & r, Check & check)
+{
+    Regex profiled(r);
+    profiled.profile(c.strings);
+
+    std::vector< bool > results;
+    profiled.match_batch(c.strings, results);
+    for (size_t i = 0; i < c.strings.size(); ++i)
+        check.expect(profiled(c.strings[i]) == c.oracles[i].match() &&
+                     results[i] == c.oracles[i].match() &&
+                     profiled.search(c.strings[i]) == c.oracles[i].search(),
+                     c, c.strings[i]);
+    return;
+}
+
+/*
+  The strings without a newline, one per line of a buffer, are the
+  matching lines where std::regex matches them. The buffer is checked
+  with and without a '\n' after the last line, which adds no line.
+*/
+static void check_lines(const Case & c, const Regex & r, Check & check)
+{
+    std::string buffer;
+    std::vector< Regex_Span > expected;
+    for (size_t i = 0; i < c.strings.size(); ++i)
+    {
+        const std::string & s = c.strings[i];
+        if (s.find('\n') != std::string::npos)
+            continue;
+        if (c.oracles[i].match())
+            expected.push_back({ buffer.size(), buffer.size() + s.size() });
+        buffer += s + "\n";
+    }
+
+    for (int newline = 1; newline >= 0; --newline)
+    {
+        if (!newline && !buffer.empty())
+        {
+            buffer.pop_back();
+            if (!expected.empty() && expected.back().begin == buffer.size())
+                expected.pop_back();
+        }
+
+        std::vector< Regex_Span > lines = r.matching_lines(buffer);
+        bool same = lines.size() == expected.size();
+        for (size_t k = 0; k < lines.size() && same; ++k)
+            same = lines[k].begin == expected[k].begin && lines[k].end == expected[k].end;
+        check.expect(same, c, "", std::to_string(lines.size()) + " lines, not " +
+                     std::to_string(expected.size()));
+
+        size_t n = r.count_matching_lines(buffer);
+        check.expect(n == expected.size(), c, "", "count " + std::to_string(n) +
+                     ", not " + std::to_string(expected.size()));
+    }
+    return;
+}
+
+// The spans agree with those std::regex gives, where it gives one.
+static bool same_groups(const std::vector< Regex_Span > & spans,
+                        const std::vector< Regex_Span > & expected)
+{
+    if (spans.size() != expected.size())
+        return false;
+    for (size_t g = 0; g < spans.size(); ++g)
+        if (expected[g].matched() &&
+            (spans[g].begin != expected[g].begin || spans[g].end != expected[g].end))
+            return false;
+    return true;
+}
+
+static std::string spans_string(const std::vector< Regex_Span > & spans)
+{
+    std::string ret;
+    for (const Regex_Span & span : spans)
+        ret += span.matched() ? " [" + std::to_string(span.begin) + ", " +
+            std::to_string(span.end) + ")" : " unmatched";
+    return "spans" + ret;
+}
+
+/*
+  The whole match and the groups of match() and search() are where
+  std::regex puts them. std::regex forgets the groups inside a
+  repetition on every iteration, and only then may Regex give a group
+  std::regex does not.
+*/
+static void check_spans(const Case & c, const Regex & r, Check & check)
+{
+    check.expect(r.groups() == c.groups, c, "", "groups " + std::to_string(r.groups()));
+    std::vector< Regex_Span > spans;
+    for (size_t i = 0; i < c.strings.size(); ++i)
+    {
+        const std::string & s = c.strings[i];
+        bool matched = r.match(s, spans);
+        check.expect(matched == c.oracles[i].match() &&
+                     (!matched || same_groups(spans, c.match_groups[i])),
+                     c, s, "match " + spans_string(spans));
+
+        bool found = r.search(s, spans);
+        check.expect(found == c.oracles[i].search() &&
+                     (!found || same_groups(spans, c.search_groups[i])),
+                     c, s, "search " + spans_string(spans));
+    }
+    return;
+}
+
+/*
+  Several threads matching and searching with the same Regex, which
+  builds its lazy DFAs and falls back to the NFA while they run, agree
+  with std::regex.
+*/
+static void check_threads(const Case & c, const Regex & r, Check & check)
+{
+    const int count = 4;
+    std::vector< std::vector< uint8_t > > results(count);
+    std::vector< std::thread > threads;
+    for (int t = 0; t < count; ++t)
+    {
+        threads.emplace_back([&c, &r, &results, t, count]()
+        {
+            for (size_t i = t; i < c.strings.size() + t; ++i)
+            {
+                const std::string & s = c.strings[i % c.strings.size()];
+                results[t].push_back(r(s));
+                results[t].push_back(r.search(s));
+            }
+        });
+    }
+    for (std::thread & t : threads)
+        t.join();
+
+    for (int t = 0; t < count; ++t)
+    {
+        for (size_t k = 0; k < c.strings.size(); ++k)
+        {
+            size_t i = (k + t) % c.strings.size();
+            check.expect(results[t][2 * k] == c.oracles[i].match() &&
+                         results[t][2 * k + 1] == c.oracles[i].search(),
+                         c, c.strings[i], "thread " + std::to_string(t));
+        }
+    }
+    return;
+}
+
+/*
+  A RegexSet of every expression, and a copy of it, give the
+  expressions std::regex matches on the strings of their own case and
+  the expressions built alone match on the strings of the others. One
+  string in ten is checked.
+*/
+static void check_set(const std::vector< Case > & all,
+                      const std::vector< std::unique_ptr< Regex > > & built,
+                      const Variant & v, Check & check)
+{
+    std::vector< std::string > expressions;
+    std::vector< size_t > case_of;
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        if (built[i] != nullptr)
+        {
+            expressions.push_back(all[i].expression);
+            case_of.push_back(i);
+        }
+    }
+
+    RegexSet set(expressions, v.options);
+    RegexSet copy(set);
+    for (size_t k = 0; k < case_of.size(); ++k)
+    {
+        const Case & c = all[case_of[k]];
+        for (size_t i = 0; i < c.strings.size(); i += 10)
+        {
+            const std::string & s = c.strings[i];
+            std::vector< size_t > matches, found;
+            for (size_t j = 0; j < case_of.size(); ++j)
+            {
+                const Regex & r = *built[case_of[j]];
+                if (j == k ? c.oracles[i].match() : r(s))
+                    matches.push_back(j);
+                if (j == k ? c.oracles[i].search() : r.search(s))
+                    found.push_back(j);
+            }
+
+            check.expect(set.matches(s) == matches && copy.matches(s) == matches,
+                         c, s, "matches");
+            check.expect(set.search(s) == found && copy.search(s) == found,
+                         c, s, "search");
+        }
+    }
+    return;
+}
+
+typedef void (* Check_Function)(const Case &, const Regex &, Check &);
+
+//Threads first, while the lazy DFAs are still empty.
+static const std::vector< std::pair< std::string, Check_Function > > checks = {
+    { "threads", check_threads },
+    { "match", check_match },
+    { "search", check_search },
+    { "lengths", check_lengths },
+    { "can_still_match", check_can_still_match },
+    { "spans", check_spans },
+    { "count_matches", check_count_matches },
+    { "lines", check_lines },
+    { "batch", check_batch },
+    { "profile", check_profile },
+};
+
+static bool selected(const std::string & check)
+{ return filter.empty() || check.find(filter) != std::string::npos; }
+
+/*
+  The generic NFA and DFA templates, on the automata Regex::to_nfa()
+  gives for the expressions. Their symbols are strings of one byte,
+  and sigma is widened to every byte of the strings tested, so that
+  none is outside of it. Subset construction of the generic NFA is
+  slow, so only the expressions with small NFAs are used.
+*/
+typedef NFA< std::string, std::string > Generic_NFA;
+typedef DFA< std::string, int > Generic_DFA;
+
+static const size_t max_generic_states = 40;
+
+// The string as symbols of a generic automaton.
+static std::vector< std::string > symbols(const std::string & s)
+{
+    std::vector< std::string > ret;
+    for (const char & c : s)
+        ret.push_back(std::string(1, c));
+    return ret;
+}
+
+// The sigma of the NFAs of the cases, and every byte of their strings.
+static std::unordered_set< std::string > generic_sigma(
+    const std::vector< const Case * > & cases,
+    const std::vector< const Regex * > & regexes)
+{
+    std::unordered_set< std::string > ret;
+    for (const Case * c : cases)
+        for (const std::string & s : c->strings)
+            for (const std::string & symbol : symbols(s))
+                ret.insert(symbol);
+    for (const Regex * r : regexes)
+        helper::merge(ret, r->to_nfa().sigma());
+    return ret;
+}
+
+// The NFA of the expression over the given sigma, holding its own.
+static Generic_NFA generic_nfa(const Regex & r, const std::unordered_set< std::string > & sigma)
+{
+    Generic_NFA N = r.to_nfa();
+    return Generic_NFA(sigma, N.states(), N.initial_state(), N.accept_states(),
+                       N.delta(), N.epsilon());
+}
+
+/*
+  The DFA of an NFA with its sets of states numbered. Equal sets can
+  hash differently, so they are told apart by their sorted elements.
+*/
+static Generic_DFA generic_dfa(const Generic_NFA & N)
+{
+    typedef std::unordered_set< std::string > Set;
+    DFA< std::string, Set > M = N.to_dfa();
+
+    std::map< std::set< std::string >, int > ids;
+    auto id = [&](const Set & q)
+    {
+        std::set< std::string > sorted(q.begin(), q.end());
+        return ids.insert({ sorted, int(ids.size()) }).first->second;
+    };
+
+    std::unordered_set< int > states, accept_states;
+    for (const Set & q : M.states())
+    {
+        states.insert(id(q));
+        for (const std::string & r : q)
+            if (N.is_accepting(r))
+                accept_states.insert(id(q));
+    }
+
+    Generic_DFA::D_t delta;
+    for (const std::pair< const std::pair< Set, std::string >, Set > & p : M.delta())
+        delta[{ id(p.first.first), p.first.second }] = id(p.second);
+    return Generic_DFA(M.sigma(), states, id(M.initial_state()), accept_states, delta);
+}
+
+// The cases built on the variant whose NFA is small enough.
+static std::vector< size_t > generic_cases(const std::vector< Case > & all,
+                                           const std::vector< std::unique_ptr< Regex > > & built)
+{
+    std::vector< size_t > ret;
+    for (size_t i = 0; i < all.size(); ++i)
+        if (built[i] != nullptr && built[i]->to_nfa().states().size() <= max_generic_states)
+            ret.push_back(i);
+    return ret;
+}
+
+typedef void (* Generic_Check_Function)(const std::vector< Case > &,
+                                        const std::vector< std::unique_ptr< Regex > > &,
+                                        Check &);
+
+/*
+  Each operation of dfa_product on the DFAs of a case and of the next
+  one, and the minimal DFA of the product, accept the strings of the
+  first case that std::regex and the second expression say they do.
+*/
+static void check_products(const std::vector< Case > & all,
+                           const std::vector< std::unique_ptr< Regex > > & built,
+                           Check & check)
+{
+    std::vector< size_t > cases = generic_cases(all, built);
+    for (size_t k = 0; k < cases.size(); ++k)
+    {
+        const Case & c = all[cases[k]];
+        const Regex & r0 = *built[cases[k]];
+        const Regex & r1 = *built[cases[(k + 1) % cases.size()]];
+        std::unordered_set< std::string > sigma = generic_sigma({ &c }, { &r0, &r1 });
+        Generic_DFA M0 = generic_dfa(generic_nfa(r0, sigma)),
+            M1 = generic_dfa(generic_nfa(r1, sigma));
+
+        for (DFA_Product_Operation op : { DFA_INTERSECTION, DFA_UNION, DFA_DIFFERENCE,
+                                          DFA_SYMMETRIC_DIFFERENCE })
+        {
+            DFA< std::string, std::pair< int, int > > P = dfa_product(M0, M1, op);
+            DFA< std::string, std::pair< int, int > > minimal = P.minimal();
+            for (size_t i = 0; i < c.strings.size(); ++i)
+            {
+                const std::string & s = c.strings[i];
+                bool expected = dfa_product_accepts(op, c.oracles[i].match(), r1(s));
+                check.expect(P(symbols(s)) == expected && minimal(symbols(s)) == expected,
+                             c, s, "operation " + std::to_string(int(op)) + " with " +
+                             printable(r1.expression()));
+            }
+        }
+    }
+    return;
+}
+
+// The symbols of a generic automaton as a string.
+static std::string joined(const std::vector< std::string > & symbols)
+{
+    std::string ret;
+    for (const std::string & symbol : symbols)
+        ret += symbol;
+    return ret;
+}
+
+/*
+  equivalent(), includes() and is_empty() on the DFAs of a case and of
+  the next one, and on their NFAs determinized lazily, give the same
+  answers, and every counterexample is a string the expressions
+  disagree on as it says. A DFA is equivalent to its minimal DFA.
+*/
+static void check_languages(const std::vector< Case > & all,
+                            const std::vector< std::unique_ptr< Regex > > & built,
+                            Check & check)
+{
+    std::vector< size_t > cases = generic_cases(all, built);
+    for (size_t k = 0; k < cases.size(); ++k)
+    {
+        const Case & c = all[cases[k]];
+        const Regex & r0 = *built[cases[k]];
+        const Regex & r1 = *built[cases[(k + 1) % cases.size()]];
+        std::unordered_set< std::string > sigma = generic_sigma({ &c }, { &r0, &r1 });
+        Generic_NFA N0 = generic_nfa(r0, sigma), N1 = generic_nfa(r1, sigma);
+        Generic_DFA M0 = generic_dfa(N0), M1 = generic_dfa(N1);
+        std::string with = " with " + printable(r1.expression());
+
+        Generic_DFA minimal = M0.minimal();
+        check.expect(equivalent(M0, minimal) && includes(M0, minimal) &&
+                     includes(minimal, M0), c, "", "minimal DFA");
+
+        std::vector< std::string > x, y;
+        bool same = equivalent(M0, M1, &x);
+        std::string s = joined(x);
+        check.expect(equivalent(N0, N1, &y) == same, c, "", "NFA equivalent" + with);
+        check.expect(same || r0(s) != r1(s), c, s, "counterexample" + with);
+        for (size_t i = 0; i < c.strings.size() && same; ++i)
+            check.expect(c.oracles[i].match() == r1(c.strings[i]), c, c.strings[i],
+                         "equivalent" + with);
+
+        x.clear();
+        y.clear();
+        bool contains = includes(M0, M1, &x);
+        s = joined(x);
+        check.expect(includes(N0, N1, &y) == contains && x.size() == y.size(),
+                     c, s, "NFA includes" + with);
+        check.expect(contains || (r1(s) && !r0(s)), c, s, "not included" + with);
+        for (size_t i = 0; i < c.strings.size() && contains; ++i)
+            check.expect(c.oracles[i].match() || !r1(c.strings[i]), c, c.strings[i],
+                         "includes" + with);
+
+        x.clear();
+        y.clear();
+        bool empty = is_empty(M0, &x);
+        s = joined(x);
+        check.expect(is_empty(N0, &y) == empty && x.size() == y.size(), c, s, "NFA is_empty");
+        check.expect(empty || r0(s), c, s, "witness");
+        for (size_t i = 0; i < c.strings.size() && empty; ++i)
+            check.expect(!c.oracles[i].match(), c, c.strings[i], "is_empty");
+    }
+    return;
+}
+
+// The DFA without its dead states and the transitions into them.
+static Generic_DFA partial(const Generic_DFA & M)
+{
+    std::unordered_set< int > live = M.live_states();
+    std::unordered_set< int > states = live;
+    states.insert(M.initial_state());
+
+    Generic_DFA::D_t delta;
+    for (const std::pair< const Generic_DFA::Q_t_S_t, int > & p : M.delta())
+        if (states.count(p.first.first) && live.count(p.second))
+            delta.insert(p);
+    return Generic_DFA(M.sigma(), states, M.initial_state(), M.accept_states(), delta);
+}
+
+// Runs a product and compares it with what the operands accept,
+// unless it throws DFA_Incomplete_Error and that is allowed.
+template< typename D0, typename D1 >
+static void check_product(const D0 & M0, const D1 & M1, DFA_Product_Operation op,
+                          const Case & c, const std::vector< uint8_t > & accept0,
+                          const std::vector< uint8_t > & accept1, bool may_throw,
+                          Check & check, const std::string & what)
+{
+    try
+    {
+        DFA< std::string, std::pair< int, int > > P = dfa_product(M0, M1, op);
+        for (size_t i = 0; i < c.strings.size(); ++i)
+            check.expect(P(symbols(c.strings[i])) ==
+                         dfa_product_accepts(op, accept0[i], accept1[i]), c, c.strings[i],
+                         what + ", operation " + std::to_string(int(op)));
+    }
+    catch (DFA_Incomplete_Error &)
+    {
+        check.expect(may_throw, c, "", what + ", operation " + std::to_string(int(op)) +
+                     " throws");
+    }
+    return;
+}
+
+/*
+  A partial DFA, missing every transition into a dead state, accepts
+  the same strings and rejects a string exactly where it reaches a
+  missing transition, which is where Regex::can_still_match() first
+  fails. Its minimal DFA is equivalent, and every product operation
+  takes it: with the complete DFA of the same expression the missing
+  transitions always meet a dead state, so none of them throws.
+*/
+static void check_partial(const std::vector< Case > & all,
+                          const std::vector< std::unique_ptr< Regex > > & built,
+                          Check & check)
+{
+    std::vector< size_t > cases = generic_cases(all, built);
+    for (size_t k = 0; k < cases.size(); ++k)
+    {
+        const Case & c = all[cases[k]];
+        const Regex & r0 = *built[cases[k]];
+        const Regex & r1 = *built[cases[(k + 1) % cases.size()]];
+        std::unordered_set< std::string > sigma = generic_sigma({ &c }, { &r0, &r1 });
+        Generic_DFA M0 = generic_dfa(generic_nfa(r0, sigma)), P0 = partial(M0),
+            P1 = partial(generic_dfa(generic_nfa(r1, sigma)));
+
+        check.expect(equivalent(P0.minimal(), M0), c, "", "minimal partial DFA");
+        std::unordered_set< int > live = P0.live_states();
+
+        std::vector< uint8_t > accept0, accept1;
+        for (size_t i = 0; i < c.strings.size(); ++i)
+        {
+            const std::string & s = c.strings[i];
+            accept0.push_back(c.oracles[i].match());
+            accept1.push_back(r1(s));
+            check.expect(P0(symbols(s)) == c.oracles[i].match(), c, s, "partial DFA");
+
+            //Where the walk stops, n if it does not.
+            int q = P0.initial_state();
+            size_t n = 0;
+            for (; n < s.size(); ++n)
+            {
+                Generic_DFA::D_t::const_iterator it =
+                    P0.delta().find({ q, std::string(1, s[n]) });
+                if (it == P0.delta().end())
+                    break;
+                q = it->second;
+            }
+            bool stops = n < s.size();
+            check.expect(r0.can_still_match(s.substr(0, n)) == (live.count(q) != 0) &&
+                         (!stops || !r0.can_still_match(s.substr(0, n + 1))),
+                         c, s, "missing transition after " + std::to_string(n) + " bytes");
+        }
+
+        for (DFA_Product_Operation op : { DFA_INTERSECTION, DFA_UNION, DFA_DIFFERENCE,
+                                          DFA_SYMMETRIC_DIFFERENCE })
+        {
+            check_product(P0, M0, op, c, accept0, accept0, false, check, "partial, complete");
+            check_product(M0, P0, op, c, accept0, accept0, false, check, "complete, partial");
+            check_product(P0, P1, op, c, accept0, accept1, op != DFA_INTERSECTION, check,
+                          "partial with " + printable(r1.expression()));
+        }
+    }
+    return;
+}
+
+/*
+  The expression NFA::to_regex() gives for the NFA of a case matches
+  what std::regex does, and its own automaton is equivalent.
+*/
+static void check_to_regex(const std::vector< Case > & all,
+                           const std::vector< std::unique_ptr< Regex > > & built,
+                           Check & check)
+{
+    for (const size_t & k : generic_cases(all, built))
+    {
+        const Case & c = all[k];
+        const Regex & r = *built[k];
+        Regex e = generic_nfa(r, generic_sigma({ &c }, { &r })).to_regex("qi", "qa", "\x01");
+        std::string what = "to_regex " + printable(e.expression());
+
+        for (size_t i = 0; i < c.strings.size(); ++i)
+            check.expect(e(c.strings[i]) == c.oracles[i].match(), c, c.strings[i], what);
+
+        std::unordered_set< std::string > sigma = generic_sigma({ &c }, { &r, &e });
+        check.expect(equivalent(generic_dfa(generic_nfa(r, sigma)),
+                                generic_dfa(generic_nfa(e, sigma))), c, "", what);
+    }
+    return;
+}
+
+/*
+  The reverse of the NFA of a case and of its DFA, matched by
+  simulation and by their DFAs built lazily, accept exactly the
+  strings std::regex matches read backwards. Reversing twice gives
+  back the language.
+*/
+static void check_reverse(const std::vector< Case > & all,
+                          const std::vector< std::unique_ptr< Regex > > & built,
+                          Check & check)
+{
+    for (const size_t & k : generic_cases(all, built))
+    {
+        const Case & c = all[k];
+        const Regex & r = *built[k];
+        Generic_NFA N = generic_nfa(r, generic_sigma({ &c }, { &r }));
+        Generic_NFA NR = N.reverse("qr");
+        NFA< std::string, int > MR = generic_dfa(N).reverse(-1, N.epsilon());
+        DFA< std::string, std::unordered_set< std::string > > NR_dfa = NR.to_dfa();
+        DFA< std::string, std::unordered_set< int > > MR_dfa = MR.to_dfa();
+
+        for (size_t i = 0; i < c.strings.size(); ++i)
+        {
+            std::vector< std::string > backwards = symbols(c.strings[i]);
+            std::reverse(backwards.begin(), backwards.end());
+            bool expected = c.oracles[i].match();
+            check.expect(NR(backwards) == expected && NR_dfa(backwards) == expected,
+                         c, c.strings[i], "NFA::reverse()");
+            check.expect(MR(backwards) == expected && MR_dfa(backwards) == expected,
+                         c, c.strings[i], "DFA::reverse()");
+        }
+
+        check.expect(equivalent(NR.reverse("qf"), N) && equivalent(MR.reverse(-2), N),
+                     c, "", "reversed twice");
+    }
+    return;
+}
+
+// Checks of the generic automata, which the options do not change.
+static const std::vector< std::pair< std::string, Generic_Check_Function > > generic_checks = {
+    { "products", check_products },
+    { "languages", check_languages },
+    { "partial", check_partial },
+    { "to_regex", check_to_regex },
+    { "reverse", check_reverse },
+};
+
+int main(int argc, char ** argv)
+{
+    if (argc > 1)
+        filter = argv[1];
+
+    std::vector< Case > all = cases();
+    std::vector< Variant > all_variants = variants();
+    for (const Variant & v : all_variants)
+    {
+        std::vector< std::unique_ptr< Regex > > built(all.size());
+        for (size_t i = 0; i < all.size(); ++i)
+            if (applies(all[i], v.options))
+                built[i].reset(new Regex(all[i].expression, v.options));
+
+        for (const std::pair< std::string, Check_Function > & check : checks)
+        {
+            if (!selected(check.first))
+                continue;
+            Check result(check.first, v.name);
+            for (size_t i = 0; i < all.size(); ++i)
+                if (built[i] != nullptr)
+                    check.second(all[i], *built[i], result);
+        }
+
+        if (selected("set"))
+        {
+            Check result("set", v.name);
+            check_set(all, built, v, result);
+        }
+
+        for (const std::pair< std::string, Generic_Check_Function > & check : generic_checks)
+        {
+            if (&v != &all_variants.front() || !selected(check.first))
+                continue;
+            Check result(check.first, v.name);
+            check.second(all, built, result);
+        }
+    }
+
+    return Check::failures ? 1 : 0;
+}